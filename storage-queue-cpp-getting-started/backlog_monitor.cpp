@@ -0,0 +1,334 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "backlog_monitor.h"
+#include "queue_bulk_operations.h"
+
+#include <algorithm>
+
+using namespace azure::storage;
+
+backlog_monitor_options::backlog_monitor_options()
+    : sample_interval(10000), history_size(30), max_concurrency(64), discovery_interval(60)
+{
+}
+
+queue_backlog::queue_backlog()
+    : message_count(0), growth_rate(0), seconds_to_empty(0), sample_count(0), stale(false)
+{
+}
+
+backlog_snapshot::backlog_snapshot()
+    : total_messages(0), total_growth_rate(0), failed_count(0), sweep_duration(0)
+{
+}
+
+const queue_backlog* backlog_snapshot::find(const utility::string_t& name) const
+{
+    auto it = std::lower_bound(queues.begin(), queues.end(), name, [](const queue_backlog& entry, const utility::string_t& key)
+    {
+        return entry.name < key;
+    });
+
+    return it != queues.end() && it->name == name ? &*it : nullptr;
+}
+
+backlog_monitor::fetch_result::fetch_result()
+    : succeeded(false), message_count(0)
+{
+}
+
+backlog_monitor::backlog_monitor(cloud_queue_client queue_client, const backlog_monitor_options& options)
+    : m_queue_client(queue_client), m_options(options), m_has_discovered(false),
+    m_snapshot(std::make_shared<backlog_snapshot>()), m_running(false)
+{
+    m_options.history_size = std::max<size_t>(m_options.history_size, 2);
+    m_options.max_concurrency = std::max<size_t>(m_options.max_concurrency, 1);
+}
+
+backlog_monitor::~backlog_monitor()
+{
+    stop();
+}
+
+void backlog_monitor::start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    m_thread = std::thread(&backlog_monitor::run, this);
+}
+
+void backlog_monitor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running.exchange(false))
+        {
+            return;
+        }
+
+        m_stopping.notify_all();
+    }
+
+    m_thread.join();
+}
+
+std::shared_ptr<const backlog_snapshot> backlog_monitor::snapshot() const
+{
+    return std::atomic_load(&m_snapshot);
+}
+
+std::shared_ptr<const backlog_snapshot> backlog_monitor::sample()
+{
+    std::lock_guard<std::mutex> lock(m_sweep_mutex);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (!m_has_discovered || start - m_discovered >= m_options.discovery_interval)
+    {
+        discover();
+    }
+
+    std::vector<fetch_result> results = fetch_all();
+
+    std::shared_ptr<backlog_snapshot> next = std::make_shared<backlog_snapshot>();
+    next->queues.reserve(m_names.size());
+    for (size_t i = 0; i < m_names.size(); i++)
+    {
+        history& samples = m_histories[m_names[i]];
+        if (results[i].succeeded)
+        {
+            record(samples, results[i]);
+        }
+        else
+        {
+            next->failed_count++;
+        }
+
+        queue_backlog entry;
+        entry.name = m_names[i];
+        entry.stale = !results[i].succeeded;
+        entry.sample_count = samples.samples.size();
+        if (!samples.samples.empty())
+        {
+            const sample_point& latest = samples.samples[(samples.next + samples.samples.size() - 1) % samples.samples.size()];
+            entry.message_count = latest.message_count;
+            entry.sampled_at = latest.time;
+        }
+
+        entry.growth_rate = growth_rate(samples);
+        if (entry.message_count == 0)
+        {
+            entry.seconds_to_empty = 0;
+        }
+        else
+        {
+            entry.seconds_to_empty = entry.growth_rate < 0 ? entry.message_count / -entry.growth_rate : -1;
+        }
+
+        next->total_messages += entry.message_count;
+        next->total_growth_rate += entry.growth_rate;
+        next->queues.push_back(entry);
+    }
+
+    next->taken_at = std::chrono::steady_clock::now();
+    next->sweep_duration = std::chrono::duration_cast<std::chrono::milliseconds>(next->taken_at - start);
+
+    std::shared_ptr<const backlog_snapshot> published = next;
+    std::atomic_store(&m_snapshot, published);
+    return published;
+}
+
+void backlog_monitor::run()
+{
+    while (m_running)
+    {
+        std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + m_options.sample_interval;
+        try
+        {
+            sample();
+        }
+        catch (const std::exception&)
+        {
+            // Keep the last snapshot; listing the queues is retried on the next sweep.
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping.wait_until(lock, due, [this] { return !m_running; });
+    }
+}
+
+///
+/// Lists the queues matching the prefix and forgets the history of queues that are gone.
+/// Throws if the listing fails, leaving the previous list in place.
+///
+void backlog_monitor::discover()
+{
+    queue_bulk_options bulk_options;
+    bulk_options.request_options = m_options.request_options;
+    queue_bulk_operations bulk(m_queue_client, bulk_options);
+
+    std::vector<utility::string_t> names;
+    bulk.for_each_queue(m_options.prefix, [&names](const cloud_queue& queue)
+    {
+        names.push_back(queue.name());
+    });
+
+    std::sort(names.begin(), names.end());
+
+    std::unordered_map<utility::string_t, history> histories;
+    for (auto it = names.begin(); it != names.end(); ++it)
+    {
+        auto existing = m_histories.find(*it);
+        if (existing != m_histories.end())
+        {
+            histories[*it] = std::move(existing->second);
+        }
+        else
+        {
+            histories[*it].next = 0;
+        }
+    }
+
+    m_names.swap(names);
+    m_histories.swap(histories);
+    m_discovered = std::chrono::steady_clock::now();
+    m_has_discovered = true;
+}
+
+///
+/// Downloads the attributes of every queue with at most max_concurrency requests in flight,
+/// and waits for all of them. Each result is timed when its response arrives.
+///
+std::vector<backlog_monitor::fetch_result> backlog_monitor::fetch_all()
+{
+    struct fan_out
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        size_t in_flight;
+        std::vector<fetch_result> results;
+    };
+
+    std::shared_ptr<fan_out> state = std::make_shared<fan_out>();
+    state->in_flight = 0;
+    state->results.resize(m_names.size());
+
+    for (size_t i = 0; i < m_names.size(); i++)
+    {
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->changed.wait(lock, [this, &state] { return state->in_flight < m_options.max_concurrency; });
+            ++state->in_flight;
+        }
+
+        // The queue is captured so it outlives the request.
+        std::shared_ptr<cloud_queue> queue = std::make_shared<cloud_queue>(m_queue_client.get_queue_reference(m_names[i]));
+        pplx::task<void> operation;
+        try
+        {
+            operation = queue->download_attributes_async(m_options.request_options, operation_context());
+        }
+        catch (...)
+        {
+            operation = pplx::task_from_exception<void>(std::current_exception());
+        }
+
+        operation.then([state, queue, i](pplx::task<void> previous)
+        {
+            fetch_result result;
+            try
+            {
+                previous.get();
+                result.message_count = queue->approximate_message_count();
+                result.succeeded = true;
+            }
+            catch (const std::exception&)
+            {
+                // Reported as stale in the snapshot.
+            }
+
+            result.time = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->results[i] = result;
+            --state->in_flight;
+            state->changed.notify_all();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->changed.wait(lock, [&state] { return state->in_flight == 0; });
+    return state->results;
+}
+
+void backlog_monitor::record(history& samples, const fetch_result& result) const
+{
+    sample_point point;
+    point.time = result.time;
+    point.message_count = result.message_count;
+
+    if (samples.samples.size() < m_options.history_size)
+    {
+        samples.samples.push_back(point);
+        samples.next = samples.samples.size() % m_options.history_size;
+    }
+    else
+    {
+        samples.samples[samples.next] = point;
+        samples.next = (samples.next + 1) % samples.samples.size();
+    }
+}
+
+///
+/// Least-squares slope of message count over time, in messages per second. The samples'
+/// order in the ring doesn't matter to the fit.
+///
+double backlog_monitor::growth_rate(const history& samples)
+{
+    size_t count = samples.samples.size();
+    if (count < 2)
+    {
+        return 0;
+    }
+
+    std::chrono::steady_clock::time_point origin = samples.samples[0].time;
+    double sum_t = 0;
+    double sum_y = 0;
+    double sum_tt = 0;
+    double sum_ty = 0;
+    for (auto it = samples.samples.begin(); it != samples.samples.end(); ++it)
+    {
+        double t = std::chrono::duration<double>(it->time - origin).count();
+        double y = it->message_count;
+        sum_t += t;
+        sum_y += y;
+        sum_tt += t * t;
+        sum_ty += t * y;
+    }
+
+    double denominator = count * sum_tt - sum_t * sum_t;
+    if (denominator <= 0)
+    {
+        return 0;
+    }
+
+    return (count * sum_ty - sum_t * sum_y) / denominator;
+}
@@ -0,0 +1,181 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Settings for backlog_monitor.
+///
+struct backlog_monitor_options
+{
+    backlog_monitor_options();
+
+    // Queues whose names start with this are monitored; empty means every queue in the account.
+    utility::string_t prefix;
+
+    // Time between the starts of two sweeps. A sweep that takes longer is followed straight away.
+    std::chrono::milliseconds sample_interval;
+
+    // Samples kept per queue; rates are fitted over all of them.
+    size_t history_size;
+
+    // Maximum number of download_attributes requests outstanding at once.
+    size_t max_concurrency;
+
+    // How often the queue list is fetched again to pick up new and deleted queues.
+    std::chrono::seconds discovery_interval;
+
+    queue_request_options request_options;
+};
+
+///
+/// Backlog of one queue as of a sweep.
+///
+struct queue_backlog
+{
+    queue_backlog();
+
+    utility::string_t name;
+
+    // Latest approximate message count. If the last fetch failed, the one before it.
+    int message_count;
+
+    // Messages per second the backlog grew (positive) or shrank (negative), fitted by least
+    // squares over the kept samples. Depth alone can't tell arrivals from deletes, so this is
+    // the net of the two.
+    double growth_rate;
+
+    // Seconds until the queue is empty at growth_rate: 0 if it is empty now, and negative if it
+    // isn't shrinking.
+    double seconds_to_empty;
+
+    size_t sample_count;
+    std::chrono::steady_clock::time_point sampled_at;
+
+    // True if this sweep's fetch failed and the values are from an earlier one.
+    bool stale;
+};
+
+///
+/// Backlog of every monitored queue as of one sweep. Published snapshots are never modified.
+///
+struct backlog_snapshot
+{
+    backlog_snapshot();
+
+    // Ordered by name.
+    std::vector<queue_backlog> queues;
+
+    int64_t total_messages;
+    double total_growth_rate;
+    size_t failed_count;
+
+    std::chrono::steady_clock::time_point taken_at;
+    std::chrono::milliseconds sweep_duration;
+
+    // The queue's entry, or null if it isn't monitored.
+    const queue_backlog* find(const utility::string_t& name) const;
+};
+
+///
+/// Samples the approximate message count of many queues on an interval for autoscaling.
+/// Each sweep downloads the attributes of every queue matching the prefix, with at most
+/// max_concurrency requests in flight, so a sweep takes about as long as the slowest few
+/// requests rather than all of them in turn. The last history_size samples of each queue
+/// are kept in a ring buffer to fit growth rates and time-to-empty estimates.
+///
+/// Each sweep publishes a new immutable snapshot. snapshot() only copies a shared pointer,
+/// so it can be called as often as needed from any thread.
+///
+class backlog_monitor
+{
+public:
+    explicit backlog_monitor(cloud_queue_client queue_client, const backlog_monitor_options& options = backlog_monitor_options());
+
+    // Stops the monitor if it is still running.
+    ~backlog_monitor();
+
+    // Sweeps on a background thread every sample_interval.
+    void start();
+    void stop();
+
+    // Runs one sweep on the calling thread and returns the snapshot it published.
+    std::shared_ptr<const backlog_snapshot> sample();
+
+    // Latest published snapshot; empty until the first sweep finishes.
+    std::shared_ptr<const backlog_snapshot> snapshot() const;
+
+private:
+    struct sample_point
+    {
+        std::chrono::steady_clock::time_point time;
+        int message_count;
+    };
+
+    // The last samples of one queue; next is where the next sample goes once the buffer is full.
+    struct history
+    {
+        std::vector<sample_point> samples;
+        size_t next;
+    };
+
+    struct fetch_result
+    {
+        fetch_result();
+
+        bool succeeded;
+        int message_count;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    backlog_monitor(const backlog_monitor&);
+    backlog_monitor& operator=(const backlog_monitor&);
+
+    void run();
+    void discover();
+    std::vector<fetch_result> fetch_all();
+    void record(history& samples, const fetch_result& result) const;
+    static double growth_rate(const history& samples);
+
+    cloud_queue_client m_queue_client;
+    backlog_monitor_options m_options;
+
+    // Guards the sweep state below, so sample() can run alongside the background thread.
+    std::mutex m_sweep_mutex;
+    std::vector<utility::string_t> m_names;
+    std::unordered_map<utility::string_t, history> m_histories;
+    std::chrono::steady_clock::time_point m_discovered;
+    bool m_has_discovered;
+
+    std::shared_ptr<const backlog_snapshot> m_snapshot;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_stopping;
+};
@@ -0,0 +1,459 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "base64_codec.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BASE64_X86
+#define BASE64_TARGET(isa)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+using namespace azure::storage;
+
+static const char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const uint8_t invalid_character = 0xFF;
+
+static const uint8_t* decode_table()
+{
+    static const std::vector<uint8_t> table = []
+    {
+        std::vector<uint8_t> values(256, invalid_character);
+        for (uint8_t i = 0; i < 64; i++)
+        {
+            values[static_cast<uint8_t>(encode_table[i])] = i;
+        }
+
+        return values;
+    }();
+
+    return table.data();
+}
+
+static size_t encode_scalar(const uint8_t* data, size_t size, char* output)
+{
+    char* position = output;
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3)
+    {
+        uint32_t value = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8) | data[i + 2];
+        *position++ = encode_table[value >> 18];
+        *position++ = encode_table[(value >> 12) & 0x3F];
+        *position++ = encode_table[(value >> 6) & 0x3F];
+        *position++ = encode_table[value & 0x3F];
+    }
+
+    if (i < size)
+    {
+        uint32_t value = uint32_t(data[i]) << 16;
+        if (i + 1 < size)
+        {
+            value |= uint32_t(data[i + 1]) << 8;
+        }
+
+        *position++ = encode_table[value >> 18];
+        *position++ = encode_table[(value >> 12) & 0x3F];
+        *position++ = i + 1 < size ? encode_table[(value >> 6) & 0x3F] : '=';
+        *position++ = '=';
+    }
+
+    return static_cast<size_t>(position - output);
+}
+
+static size_t decode_scalar(const char* text, size_t size, uint8_t* output)
+{
+    if (size % 4 != 0)
+    {
+        throw std::invalid_argument("Base64 text length must be a multiple of 4");
+    }
+
+    const uint8_t* table = decode_table();
+    uint8_t* position = output;
+    for (size_t i = 0; i < size; i += 4)
+    {
+        // Padding is only allowed in the last group: "xx==" or "xxx=".
+        size_t padding = 0;
+        if (i + 4 == size)
+        {
+            padding = text[i + 3] == '=' ? (text[i + 2] == '=' ? 2 : 1) : 0;
+        }
+
+        uint8_t a = table[static_cast<uint8_t>(text[i])];
+        uint8_t b = table[static_cast<uint8_t>(text[i + 1])];
+        uint8_t c = padding >= 2 ? 0 : table[static_cast<uint8_t>(text[i + 2])];
+        uint8_t d = padding >= 1 ? 0 : table[static_cast<uint8_t>(text[i + 3])];
+        // Indices fit in 6 bits, so this also catches invalid_character.
+        if (((a | b | c | d) & 0xC0) != 0)
+        {
+            throw std::invalid_argument("Invalid character in base64 text");
+        }
+
+        uint32_t value = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+        *position++ = static_cast<uint8_t>(value >> 16);
+        if (padding < 2)
+        {
+            *position++ = static_cast<uint8_t>(value >> 8);
+        }
+        if (padding < 1)
+        {
+            *position++ = static_cast<uint8_t>(value);
+        }
+    }
+
+    return static_cast<size_t>(position - output);
+}
+
+#ifdef BASE64_X86
+
+// The vector paths follow Wojciech Muła's SIMD base64 algorithms: bytes are regrouped into
+// 6-bit indices with shuffles and multiplies, and characters are mapped to and from indices
+// with small per-nibble lookup tables instead of a 64-entry table.
+
+BASE64_TARGET("sse4.1")
+static __m128i encode_indices_sse(__m128i input)
+{
+    input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    __m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(high, low);
+}
+
+BASE64_TARGET("sse4.1")
+static __m128i encode_characters_sse(__m128i indices)
+{
+    // Ranges: 0-25 'A', 26-51 'a', 52-61 '0', 62 '+', 63 '/'. Each range gets an offset
+    // picked from shift_table.
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i uppercase = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(uppercase, _mm_set1_epi8(13)));
+
+    const __m128i shift_table = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift_table, range), indices);
+}
+
+// Returns false without writing anything if the 16 characters aren't all in the alphabet.
+BASE64_TARGET("sse4.1")
+static bool decode_block_sse(__m128i input, __m128i& output)
+{
+    const __m128i low_table = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i high_table = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i roll_table = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    __m128i high_nibbles = _mm_and_si128(_mm_srli_epi32(input, 4), _mm_set1_epi8(0x0F));
+    __m128i low_nibbles = _mm_and_si128(input, _mm_set1_epi8(0x0F));
+    if (!_mm_testz_si128(_mm_shuffle_epi8(low_table, low_nibbles), _mm_shuffle_epi8(high_table, high_nibbles)))
+    {
+        return false;
+    }
+
+    __m128i slashes = _mm_cmpeq_epi8(input, _mm_set1_epi8('/'));
+    __m128i values = _mm_add_epi8(input, _mm_shuffle_epi8(roll_table, _mm_add_epi8(slashes, high_nibbles)));
+
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    output = _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+BASE64_TARGET("sse4.1")
+static void store_12_bytes(uint8_t* output, __m128i bytes)
+{
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(output), bytes);
+    uint32_t tail = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(bytes, 8)));
+    std::memcpy(output + 8, &tail, sizeof(tail));
+}
+
+BASE64_TARGET("sse4.1")
+static size_t encode_sse41(const uint8_t* data, size_t size, char* output)
+{
+    // Each step reads 16 bytes and uses 12 of them.
+    size_t i = 0;
+    char* position = output;
+    for (; i + 16 <= size; i += 12)
+    {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(position), encode_characters_sse(encode_indices_sse(input)));
+        position += 16;
+    }
+
+    return static_cast<size_t>(position - output) + encode_scalar(data + i, size - i, position);
+}
+
+BASE64_TARGET("sse4.1")
+static size_t decode_sse41(const char* text, size_t size, uint8_t* output)
+{
+    // Padding fails the alphabet check, so the last group always goes to the scalar path.
+    size_t i = 0;
+    uint8_t* position = output;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i bytes;
+        if (!decode_block_sse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)), bytes))
+        {
+            break;
+        }
+
+        store_12_bytes(position, bytes);
+        position += 12;
+    }
+
+    return static_cast<size_t>(position - output) + decode_scalar(text + i, size - i, position);
+}
+
+BASE64_TARGET("avx2")
+static __m256i duplicate_lanes(__m128i value)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(value), value, 1);
+}
+
+BASE64_TARGET("avx2")
+static size_t encode_avx2(const uint8_t* data, size_t size, char* output)
+{
+    const __m256i shuffle = duplicate_lanes(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i shift_table = duplicate_lanes(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+
+    // Each step converts 24 bytes, 12 per 128-bit lane; the second lane reads 16 bytes from
+    // offset 12.
+    size_t i = 0;
+    char* position = output;
+    for (; i + 28 <= size; i += 24)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 12));
+        __m256i input = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), shuffle);
+
+        __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        __m256i low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(high, low);
+
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i uppercase = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        range = _mm256_or_si256(range, _mm256_and_si256(uppercase, _mm256_set1_epi8(13)));
+        __m256i characters = _mm256_add_epi8(_mm256_shuffle_epi8(shift_table, range), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(position), characters);
+        position += 32;
+    }
+
+    return static_cast<size_t>(position - output) + encode_sse41(data + i, size - i, position);
+}
+
+BASE64_TARGET("avx2")
+static size_t decode_avx2(const char* text, size_t size, uint8_t* output)
+{
+    const __m256i low_table = duplicate_lanes(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A));
+    const __m256i high_table = duplicate_lanes(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i roll_table = duplicate_lanes(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i pack = duplicate_lanes(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    size_t i = 0;
+    uint8_t* position = output;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi32(input, 4), _mm256_set1_epi8(0x0F));
+        __m256i low_nibbles = _mm256_and_si256(input, _mm256_set1_epi8(0x0F));
+        if (!_mm256_testz_si256(_mm256_shuffle_epi8(low_table, low_nibbles), _mm256_shuffle_epi8(high_table, high_nibbles)))
+        {
+            break;
+        }
+
+        __m256i slashes = _mm256_cmpeq_epi8(input, _mm256_set1_epi8('/'));
+        __m256i values = _mm256_add_epi8(input, _mm256_shuffle_epi8(roll_table, _mm256_add_epi8(slashes, high_nibbles)));
+
+        __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        __m256i bytes = _mm256_shuffle_epi8(words, pack);
+
+        store_12_bytes(position, _mm256_castsi256_si128(bytes));
+        store_12_bytes(position + 12, _mm256_extracti128_si256(bytes, 1));
+        position += 24;
+    }
+
+    return static_cast<size_t>(position - output) + decode_sse41(text + i, size - i, position);
+}
+
+static base64_implementation detect_implementation()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return base64_implementation::avx2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return base64_implementation::sse41;
+    }
+#else
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+
+    // AVX2 also needs the operating system to save the upper halves of the registers.
+    bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    if (max_leaf >= 7 && os_saves_avx)
+    {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0)
+        {
+            return base64_implementation::avx2;
+        }
+    }
+
+    if (sse41)
+    {
+        return base64_implementation::sse41;
+    }
+#endif
+
+    return base64_implementation::scalar;
+}
+
+#else
+
+static base64_implementation detect_implementation()
+{
+    return base64_implementation::scalar;
+}
+
+#endif
+
+size_t base64_codec::encoded_size(size_t size)
+{
+    return (size + 2) / 3 * 4;
+}
+
+size_t base64_codec::max_decoded_size(size_t size)
+{
+    return size / 4 * 3;
+}
+
+base64_implementation base64_codec::best_implementation()
+{
+    static const base64_implementation best = detect_implementation();
+    return best;
+}
+
+bool base64_codec::is_supported(base64_implementation implementation)
+{
+    return implementation <= best_implementation();
+}
+
+size_t base64_codec::encode(const uint8_t* data, size_t size, char* output)
+{
+    return encode(best_implementation(), data, size, output);
+}
+
+size_t base64_codec::encode(base64_implementation implementation, const uint8_t* data, size_t size, char* output)
+{
+    if (!is_supported(implementation))
+    {
+        throw std::invalid_argument("The base64 implementation is not supported on this CPU");
+    }
+
+    switch (implementation)
+    {
+#ifdef BASE64_X86
+    case base64_implementation::avx2:
+        return encode_avx2(data, size, output);
+    case base64_implementation::sse41:
+        return encode_sse41(data, size, output);
+#endif
+    default:
+        return encode_scalar(data, size, output);
+    }
+}
+
+size_t base64_codec::decode(const char* text, size_t size, uint8_t* output)
+{
+    return decode(best_implementation(), text, size, output);
+}
+
+size_t base64_codec::decode(base64_implementation implementation, const char* text, size_t size, uint8_t* output)
+{
+    if (!is_supported(implementation))
+    {
+        throw std::invalid_argument("The base64 implementation is not supported on this CPU");
+    }
+
+    switch (implementation)
+    {
+#ifdef BASE64_X86
+    case base64_implementation::avx2:
+        return decode_avx2(text, size, output);
+    case base64_implementation::sse41:
+        return decode_sse41(text, size, output);
+#endif
+    default:
+        return decode_scalar(text, size, output);
+    }
+}
+
+void base64_codec::set_content(cloud_queue_message& message, const uint8_t* data, size_t size, utility::string_t& buffer)
+{
+#ifdef _UTF16_STRINGS
+    thread_local std::string narrow;
+    narrow.resize(encoded_size(size));
+    encode(data, size, &narrow[0]);
+    buffer.assign(narrow.begin(), narrow.end());
+#else
+    buffer.resize(encoded_size(size));
+    encode(data, size, &buffer[0]);
+#endif
+
+    message.set_content(buffer);
+}
+
+size_t base64_codec::content(const cloud_queue_message& message, std::vector<uint8_t>& buffer)
+{
+    utility::string_t text = message.content_as_string();
+
+#ifdef _UTF16_STRINGS
+    thread_local std::string narrow;
+    narrow.resize(text.size());
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        // Anything outside ASCII would otherwise be truncated into a valid character.
+        narrow[i] = text[i] < 0x80 ? static_cast<char>(text[i]) : '\x80';
+    }
+    const char* characters = narrow.data();
+#else
+    const char* characters = text.data();
+#endif
+
+    buffer.resize(max_decoded_size(text.size()));
+    size_t size = decode(characters, text.size(), buffer.data());
+    buffer.resize(size);
+    return size;
+}
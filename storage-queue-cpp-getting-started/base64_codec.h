@@ -0,0 +1,70 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <vector>
+
+using namespace azure::storage;
+
+// Base64 code paths; the vector ones are only used on CPUs that support them.
+enum class base64_implementation
+{
+    scalar,
+    sse41,
+    avx2
+};
+
+///
+/// Base64 (RFC 4648, with padding) for binary message content, writing into buffers the
+/// caller provides and reuses. cloud_queue_message::set_content and content_as_binary
+/// base64-encode through freshly allocated strings a byte at a time; the SSE4.1 and AVX2
+/// paths here convert 12 or 24 bytes per step. The fastest path the CPU supports is chosen
+/// at run time.
+///
+/// Output is the same as the client library's, so messages set here can be read with
+/// content_as_binary and the other way round.
+///
+class base64_codec
+{
+public:
+    static size_t encoded_size(size_t size);
+
+    // Upper bound on the decoded size of size characters; padding makes the real size smaller.
+    static size_t max_decoded_size(size_t size);
+
+    // The fastest implementation this CPU supports.
+    static base64_implementation best_implementation();
+    static bool is_supported(base64_implementation implementation);
+
+    // Writes encoded_size(size) characters to output and returns that count.
+    static size_t encode(const uint8_t* data, size_t size, char* output);
+    static size_t encode(base64_implementation implementation, const uint8_t* data, size_t size, char* output);
+
+    ///
+    /// Writes at most max_decoded_size(size) bytes to output and returns the count written.
+    /// Throws std::invalid_argument if the text is not valid base64.
+    ///
+    static size_t decode(const char* text, size_t size, uint8_t* output);
+    static size_t decode(base64_implementation implementation, const char* text, size_t size, uint8_t* output);
+
+    // Encodes the data into buffer and sets it as the message content.
+    static void set_content(cloud_queue_message& message, const uint8_t* data, size_t size, utility::string_t& buffer);
+
+    // Decodes binary message content into buffer, resizing it, and returns the size.
+    static size_t content(const cloud_queue_message& message, std::vector<uint8_t>& buffer);
+};
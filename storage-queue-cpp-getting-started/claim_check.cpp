@@ -0,0 +1,224 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "claim_check.h"
+#include "queue_producer.h"
+#include "string_util.h"
+
+#include <deque>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+// Base64 message content never contains ':', so this prefix can't be mistaken for an inline payload.
+static const utility::string_t reference_prefix(U("claim-check:1;"));
+
+claim_check_options::claim_check_options()
+    : threshold(48 * 1024), block_size(4 * 1024 * 1024), max_parallel_uploads(8)
+{
+}
+
+claim_check::claim_check(cloud_queue queue, cloud_blob_container container)
+    : claim_check(queue, container, claim_check_options())
+{
+}
+
+claim_check::claim_check(cloud_queue queue, cloud_blob_container container, const claim_check_options& options)
+    : m_queue(queue), m_container(container), m_options(options), m_inline(0), m_references(0), m_uploaded_bytes(0), m_released(0)
+{
+}
+
+void claim_check::send(std::vector<uint8_t> payload)
+{
+    if (payload.size() <= m_options.threshold)
+    {
+        cloud_queue_message message(payload);
+        m_queue.add_message(message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options.queue_options, operation_context());
+        m_inline++;
+        return;
+    }
+
+    send(concurrency::streams::bytestream::open_istream(std::move(payload)));
+}
+
+void claim_check::send(concurrency::streams::istream payload)
+{
+    utility::string_t blob_name = U("claim-check-") + string_util::random_string();
+    cloud_block_blob blob = m_container.get_block_blob_reference(blob_name);
+
+    std::vector<block_list_item> blocks;
+    std::deque<pplx::task<void>> uploads;
+    uint64_t size = 0;
+    try
+    {
+        while (true)
+        {
+            concurrency::streams::container_buffer<std::vector<uint8_t>> block;
+            size_t read = payload.read(block, m_options.block_size).get();
+            if (read == 0)
+            {
+                break;
+            }
+
+            // Block ids must all have the same length; the base64 of a 64-bit index does.
+            utility::string_t block_id = utility::conversions::to_base64(static_cast<uint64_t>(blocks.size()));
+            blocks.push_back(block_list_item(block_id));
+            size += read;
+
+            if (uploads.size() >= m_options.max_parallel_uploads)
+            {
+                pplx::task<void> oldest = uploads.front();
+                uploads.pop_front();
+                oldest.get();
+            }
+
+            uploads.push_back(blob.upload_block_async(block_id, concurrency::streams::bytestream::open_istream(std::move(block.collection())),
+                utility::string_t(), access_condition(), m_options.blob_options, operation_context()));
+        }
+
+        while (!uploads.empty())
+        {
+            pplx::task<void> oldest = uploads.front();
+            uploads.pop_front();
+            oldest.get();
+        }
+
+        blob.upload_block_list_async(blocks, access_condition(), m_options.blob_options, operation_context()).get();
+    }
+    catch (...)
+    {
+        // Wait for the remaining uploads so none fails unobserved. The service discards
+        // uncommitted blocks on its own.
+        for (auto it = uploads.begin(); it != uploads.end(); ++it)
+        {
+            try
+            {
+                it->get();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        throw;
+    }
+
+    m_uploaded_bytes += size;
+
+    try
+    {
+        cloud_queue_message message(reference_prefix + blob_name + U(";") + utility::conversions::print_string(size));
+        m_queue.add_message(message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options.queue_options, operation_context());
+    }
+    catch (...)
+    {
+        try
+        {
+            blob.delete_blob_if_exists(delete_snapshots_option::none, access_condition(), m_options.blob_options, operation_context());
+        }
+        catch (...)
+        {
+        }
+
+        throw;
+    }
+
+    m_references++;
+}
+
+bool claim_check::is_reference(const cloud_queue_message& message)
+{
+    return message.content_as_string().compare(0, reference_prefix.size(), reference_prefix) == 0;
+}
+
+concurrency::streams::istream claim_check::open_payload(const cloud_queue_message& message) const
+{
+    utility::string_t blob_name;
+    uint64_t size;
+    if (!parse_reference(message, blob_name, size))
+    {
+        return concurrency::streams::bytestream::open_istream(message.content_as_binary());
+    }
+
+    return m_container.get_block_blob_reference(blob_name).open_read(access_condition(), m_options.blob_options, operation_context());
+}
+
+void claim_check::release_payload(const cloud_queue_message& message)
+{
+    utility::string_t blob_name;
+    uint64_t size;
+    if (!parse_reference(message, blob_name, size))
+    {
+        return;
+    }
+
+    cloud_block_blob blob = m_container.get_block_blob_reference(blob_name);
+    if (blob.delete_blob_if_exists(delete_snapshots_option::none, access_condition(), m_options.blob_options, operation_context()))
+    {
+        m_released++;
+    }
+}
+
+void claim_check::complete(cloud_queue_message& message)
+{
+    m_queue.delete_message(message, m_options.queue_options, operation_context());
+    release_payload(message);
+}
+
+uint64_t claim_check::inline_count() const
+{
+    return m_inline;
+}
+
+uint64_t claim_check::reference_count() const
+{
+    return m_references;
+}
+
+uint64_t claim_check::uploaded_bytes() const
+{
+    return m_uploaded_bytes;
+}
+
+uint64_t claim_check::released_count() const
+{
+    return m_released;
+}
+
+///
+/// Splits a reference message into its blob name and size. Returns false for inline messages
+/// and throws std::runtime_error for a reference that can't be parsed.
+///
+bool claim_check::parse_reference(const cloud_queue_message& message, utility::string_t& blob_name, uint64_t& size)
+{
+    if (!is_reference(message))
+    {
+        return false;
+    }
+
+    utility::string_t content = message.content_as_string();
+    utility::string_t::size_type separator = content.find(U(';'), reference_prefix.size());
+    if (separator == utility::string_t::npos || separator == reference_prefix.size())
+    {
+        throw std::runtime_error("Malformed claim-check reference");
+    }
+
+    blob_name = content.substr(reference_prefix.size(), separator - reference_prefix.size());
+    size = utility::conversions::scan_string<uint64_t>(content.substr(separator + 1));
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+using namespace azure::storage;
+
+struct claim_check_options
+{
+    claim_check_options();
+
+    // Payloads up to this size are sent inline; larger ones go through blob storage. Binary
+    // content is base64-encoded, so 48 KB is about the most a 64 KB message can hold.
+    size_t threshold;
+
+    // Size of each block uploaded with upload_block_async.
+    size_t block_size;
+
+    // Maximum number of block uploads outstanding at once.
+    size_t max_parallel_uploads;
+
+    blob_request_options blob_options;
+    queue_request_options queue_options;
+};
+
+///
+/// Sends payloads too large for a queue message through blob storage. The payload is uploaded
+/// as blocks of a new blob, in parallel, and a short reference message is enqueued instead:
+///
+///     claim-check:1;<blob name>;<size in bytes>
+///
+/// Consumers call open_payload to stream the payload from either kind of message, and delete
+/// the blob with release_payload once the message itself is deleted.
+///
+class claim_check
+{
+public:
+    claim_check(cloud_queue queue, cloud_blob_container container);
+    claim_check(cloud_queue queue, cloud_blob_container container, const claim_check_options& options);
+
+    // Sends the payload inline if it fits under the threshold, otherwise as a blob reference.
+    void send(std::vector<uint8_t> payload);
+
+    ///
+    /// Uploads the stream to a blob and enqueues a reference to it. The stream is read one
+    /// block at a time, so the payload never has to fit in memory. If the upload or the
+    /// enqueue fails, the exception is rethrown and no message is left behind.
+    ///
+    void send(concurrency::streams::istream payload);
+
+    static bool is_reference(const cloud_queue_message& message);
+
+    ///
+    /// Opens the payload of a received message. A reference is read straight from the blob
+    /// as the stream is consumed, without downloading the whole object first.
+    ///
+    concurrency::streams::istream open_payload(const cloud_queue_message& message) const;
+
+    // Deletes the blob a reference points to; does nothing for inline messages.
+    void release_payload(const cloud_queue_message& message);
+
+    // Deletes the message, then the blob it refers to.
+    void complete(cloud_queue_message& message);
+
+    uint64_t inline_count() const;
+    uint64_t reference_count() const;
+    uint64_t uploaded_bytes() const;
+    uint64_t released_count() const;
+
+private:
+    claim_check(const claim_check&);
+    claim_check& operator=(const claim_check&);
+
+    static bool parse_reference(const cloud_queue_message& message, utility::string_t& blob_name, uint64_t& size);
+
+    cloud_queue m_queue;
+    cloud_blob_container m_container;
+    claim_check_options m_options;
+
+    std::atomic<uint64_t> m_inline;
+    std::atomic<uint64_t> m_references;
+    std::atomic<uint64_t> m_uploaded_bytes;
+    std::atomic<uint64_t> m_released;
+};
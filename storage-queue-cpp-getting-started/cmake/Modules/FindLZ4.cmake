@@ -0,0 +1,41 @@
+# FindLZ4 package
+#
+# Tries to find the LZ4 compression library
+#
+
+find_package(PkgConfig)
+
+include(LibFindMacros)
+
+# Include dir
+find_path(LZ4_INCLUDE_DIR
+  NAMES
+    lz4.h
+  PATHS 
+    ${LZ4_PKGCONF_INCLUDE_DIRS}
+    ${LZ4_DIR}
+    $ENV{LZ4_DIR}
+    /usr/local/include
+    /usr/include
+  PATH_SUFFIXES 
+    include
+)
+
+# Library
+find_library(LZ4_LIBRARY
+  NAMES 
+    lz4
+  PATHS 
+    ${LZ4_PKGCONF_LIBRARY_DIRS}
+    ${LZ4_DIR}
+    $ENV{LZ4_DIR}
+    /usr/local
+    /usr
+  PATH_SUFFIXES
+    lib
+)
+
+set(LZ4_PROCESS_LIBS LZ4_LIBRARY)
+set(LZ4_PROCESS_INCLUDES LZ4_INCLUDE_DIR)
+
+libfind_process(LZ4)
@@ -0,0 +1,41 @@
+# FindZstd package
+#
+# Tries to find the Zstd compression library
+#
+
+find_package(PkgConfig)
+
+include(LibFindMacros)
+
+# Include dir
+find_path(ZSTD_INCLUDE_DIR
+  NAMES
+    zstd.h
+  PATHS 
+    ${ZSTD_PKGCONF_INCLUDE_DIRS}
+    ${ZSTD_DIR}
+    $ENV{ZSTD_DIR}
+    /usr/local/include
+    /usr/include
+  PATH_SUFFIXES 
+    include
+)
+
+# Library
+find_library(ZSTD_LIBRARY
+  NAMES 
+    zstd
+  PATHS 
+    ${ZSTD_PKGCONF_LIBRARY_DIRS}
+    ${ZSTD_DIR}
+    $ENV{ZSTD_DIR}
+    /usr/local
+    /usr
+  PATH_SUFFIXES
+    lib
+)
+
+set(ZSTD_PROCESS_LIBS ZSTD_LIBRARY)
+set(ZSTD_PROCESS_INCLUDES ZSTD_INCLUDE_DIR)
+
+libfind_process(ZSTD)
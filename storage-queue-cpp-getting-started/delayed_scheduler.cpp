@@ -0,0 +1,233 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "delayed_scheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+static const utility::string_t envelope_prefix(U("scheduled:1;"));
+
+// The longest time to live and initial visibility timeout the service accepts.
+static const std::chrono::seconds max_service_delay(604800);
+
+// A hop received this close to its due time is delivered rather than forwarded.
+static const std::chrono::seconds due_tolerance(1);
+
+scheduled_message::scheduled_message()
+{
+}
+
+scheduled_message::scheduled_message(const utility::string_t& payload, std::chrono::system_clock::time_point due)
+    : payload(payload), due(due)
+{
+}
+
+delayed_scheduler_options::delayed_scheduler_options()
+    : max_in_flight(64), max_hop_delay(6 * 86400), time_to_live_after_due(86400)
+{
+}
+
+delayed_scheduler::delayed_scheduler(cloud_queue queue, const delayed_scheduler_options& options)
+    : m_queue(queue), m_options(options), m_producer(queue, std::max<size_t>(options.max_in_flight, 1), options.request_options),
+    m_scheduled(0), m_failed(0), m_forwarded(0)
+{
+    m_options.time_to_live_after_due = std::min(std::max(m_options.time_to_live_after_due, std::chrono::seconds(1)), max_service_delay);
+    m_options.max_hop_delay = std::max(std::min(m_options.max_hop_delay, max_service_delay - m_options.time_to_live_after_due), std::chrono::seconds(1));
+}
+
+delayed_scheduler::~delayed_scheduler()
+{
+    m_producer.flush();
+}
+
+void delayed_scheduler::schedule(const utility::string_t& payload, std::chrono::system_clock::time_point due)
+{
+    std::vector<scheduled_message> batch(1, scheduled_message(payload, due));
+    if (!schedule(batch).empty())
+    {
+        throw std::runtime_error("Failed to schedule the message");
+    }
+}
+
+std::vector<size_t> delayed_scheduler::schedule(const std::vector<scheduled_message>& batch)
+{
+    // Completions arrive on pool threads, so the batch tracks its own outstanding adds rather
+    // than flushing the producer, which other batches may be sharing.
+    struct batch_state
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining;
+        std::vector<size_t> failed;
+    };
+
+    std::shared_ptr<batch_state> state = std::make_shared<batch_state>();
+    state->remaining = batch.size();
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        std::chrono::seconds visibility_timeout;
+        std::chrono::seconds time_to_live;
+        next_hop(batch[i].due, visibility_timeout, time_to_live);
+
+        // Blocks while max_in_flight adds are outstanding, which paces the batch.
+        m_producer.add_message(create(batch[i]), time_to_live, visibility_timeout, [this, state, i](const cloud_queue_message&, std::exception_ptr error)
+        {
+            if (error)
+            {
+                m_failed++;
+            }
+            else
+            {
+                m_scheduled++;
+            }
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (error)
+            {
+                state->failed.push_back(i);
+            }
+
+            if (--state->remaining == 0)
+            {
+                state->done.notify_all();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [state] { return state->remaining == 0; });
+
+    std::sort(state->failed.begin(), state->failed.end());
+    return state->failed;
+}
+
+std::function<void(const cloud_queue_message& message)> delayed_scheduler::handler(payload_handler handler)
+{
+    return [this, handler](const cloud_queue_message& message)
+    {
+        scheduled_message parsed;
+        if (!parse(message, parsed))
+        {
+            handler(message.content_as_string());
+            return;
+        }
+
+        if (parsed.due <= std::chrono::system_clock::now() + due_tolerance)
+        {
+            handler(parsed.payload);
+            return;
+        }
+
+        // Sent synchronously: if the add fails, the exception makes the consumer retry this hop
+        // instead of deleting it.
+        std::chrono::seconds visibility_timeout;
+        std::chrono::seconds time_to_live;
+        next_hop(parsed.due, visibility_timeout, time_to_live);
+
+        cloud_queue_message next = create(parsed);
+        m_queue.add_message(next, time_to_live, visibility_timeout, m_options.request_options, operation_context());
+        m_forwarded++;
+    };
+}
+
+bool delayed_scheduler::parse(const cloud_queue_message& message, scheduled_message& parsed)
+{
+    utility::string_t content = message.content_as_string();
+    if (content.compare(0, envelope_prefix.size(), envelope_prefix) != 0)
+    {
+        return false;
+    }
+
+    utility::string_t::size_type separator = content.find(U(';'), envelope_prefix.size());
+    if (separator == utility::string_t::npos || separator == envelope_prefix.size() || separator - envelope_prefix.size() > 18)
+    {
+        return false;
+    }
+
+    int64_t milliseconds = 0;
+    for (utility::string_t::size_type i = envelope_prefix.size(); i < separator; i++)
+    {
+        if (content[i] < U('0') || content[i] > U('9'))
+        {
+            return false;
+        }
+
+        milliseconds = milliseconds * 10 + static_cast<int64_t>(content[i] - U('0'));
+    }
+
+    parsed.due = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(milliseconds)));
+    parsed.payload = content.substr(separator + 1);
+    return true;
+}
+
+bool delayed_scheduler::is_due(const cloud_queue_message& message)
+{
+    scheduled_message parsed;
+    return !parse(message, parsed) || parsed.due <= std::chrono::system_clock::now() + due_tolerance;
+}
+
+uint64_t delayed_scheduler::scheduled_count() const
+{
+    return m_scheduled;
+}
+
+uint64_t delayed_scheduler::failed_count() const
+{
+    return m_failed;
+}
+
+uint64_t delayed_scheduler::forwarded_count() const
+{
+    return m_forwarded;
+}
+
+cloud_queue_message delayed_scheduler::create(const scheduled_message& message)
+{
+    // Due times before the epoch are already due, so they are stored as zero.
+    int64_t milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(message.due.time_since_epoch()).count();
+    utility::string_t content(envelope_prefix);
+    content += utility::conversions::print_string(std::max<int64_t>(milliseconds, 0));
+    content += U(";");
+    content += message.payload;
+    return cloud_queue_message(content);
+}
+
+void delayed_scheduler::next_hop(std::chrono::system_clock::time_point due, std::chrono::seconds& visibility_timeout, std::chrono::seconds& time_to_live) const
+{
+    // Rounded up, so a message never becomes visible before it is due.
+    std::chrono::system_clock::duration remaining = due - std::chrono::system_clock::now();
+    std::chrono::seconds delay(0);
+    if (remaining > std::chrono::system_clock::duration::zero())
+    {
+        delay = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+        if (delay < remaining)
+        {
+            delay += std::chrono::seconds(1);
+        }
+    }
+
+    visibility_timeout = std::min(delay, m_options.max_hop_delay);
+    time_to_live = visibility_timeout + m_options.time_to_live_after_due;
+}
@@ -0,0 +1,131 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+///
+/// A payload to deliver at a given time.
+///
+struct scheduled_message
+{
+    scheduled_message();
+    scheduled_message(const utility::string_t& payload, std::chrono::system_clock::time_point due);
+
+    utility::string_t payload;
+    std::chrono::system_clock::time_point due;
+};
+
+///
+/// Settings for delayed_scheduler.
+///
+struct delayed_scheduler_options
+{
+    delayed_scheduler_options();
+
+    // Maximum number of adds outstanding at once while scheduling a batch.
+    size_t max_in_flight;
+
+    // Longest delay covered by one message. The service allows an initial visibility timeout of
+    // at most seven days, and the time to live must cover it plus time_to_live_after_due.
+    std::chrono::seconds max_hop_delay;
+
+    // How long a message stays in the queue once it is due.
+    std::chrono::seconds time_to_live_after_due;
+
+    queue_request_options request_options;
+};
+
+///
+/// Schedules payloads for delivery at a future time, using the initial visibility timeout of
+/// add_message so the queue itself holds them until they are due. Each message carries its due
+/// time:
+///
+///     scheduled:1;<due, in milliseconds since the epoch>;<payload>
+///
+/// A due time further away than max_hop_delay is reached in hops: the message becomes visible
+/// after max_hop_delay, and the handler returned by handler() enqueues the next hop instead of
+/// delivering it. Hops are forwarded by whichever consumer receives them, so no separate
+/// scheduler process is needed.
+///
+/// Batches go through a queue_producer, so up to max_in_flight adds are in flight at once.
+///
+class delayed_scheduler
+{
+public:
+    typedef std::function<void(const utility::string_t& payload)> payload_handler;
+
+    explicit delayed_scheduler(cloud_queue queue, const delayed_scheduler_options& options = delayed_scheduler_options());
+
+    // Waits for adds still in flight.
+    ~delayed_scheduler();
+
+    // Schedules one payload and waits for the add.
+    void schedule(const utility::string_t& payload, std::chrono::system_clock::time_point due);
+
+    ///
+    /// Schedules every item, keeping up to max_in_flight adds outstanding, and waits for all of
+    /// them. Returns the positions of the items that could not be enqueued, so they can be
+    /// retried; the rest are scheduled.
+    ///
+    std::vector<size_t> schedule(const std::vector<scheduled_message>& batch);
+
+    ///
+    /// Wraps a payload handler for use with queue_consumer. Messages that are due are passed
+    /// to the handler; a hop that is not due yet is enqueued again for its next
+    /// leg, and returning normally lets the consumer delete the old one. Messages without a
+    /// schedule envelope are passed to the handler as they are.
+    ///
+    std::function<void(const cloud_queue_message& message)> handler(payload_handler handler);
+
+    // Returns false if the message has no schedule envelope.
+    static bool parse(const cloud_queue_message& message, scheduled_message& parsed);
+
+    // True if the message has no schedule envelope or its due time has been reached.
+    static bool is_due(const cloud_queue_message& message);
+
+    uint64_t scheduled_count() const;
+    uint64_t failed_count() const;
+
+    // Hops enqueued again because they were received before their due time.
+    uint64_t forwarded_count() const;
+
+private:
+    delayed_scheduler(const delayed_scheduler&);
+    delayed_scheduler& operator=(const delayed_scheduler&);
+
+    static cloud_queue_message create(const scheduled_message& message);
+
+    // The initial visibility timeout and time to live of the next hop towards due.
+    void next_hop(std::chrono::system_clock::time_point due, std::chrono::seconds& visibility_timeout, std::chrono::seconds& time_to_live) const;
+
+    cloud_queue m_queue;
+    delayed_scheduler_options m_options;
+    queue_producer m_producer;
+
+    std::atomic<uint64_t> m_scheduled;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_forwarded;
+};
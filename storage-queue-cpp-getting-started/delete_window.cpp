@@ -0,0 +1,113 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "delete_window.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace azure::storage;
+
+delete_window::delete_window(cloud_queue queue, size_t max_pending, const queue_request_options& options)
+    : m_queue(queue), m_max_pending(std::max<size_t>(max_pending, 1)), m_options(options), m_pending(0)
+{
+}
+
+void delete_window::start(const std::function<pplx::task<void>()>& operation, const std::function<void(bool succeeded)>& completed)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] { return m_pending < m_max_pending; });
+        ++m_pending;
+    }
+
+    pplx::task<void> task;
+    try
+    {
+        task = operation();
+    }
+    catch (...)
+    {
+        task = pplx::task_from_exception<void>(std::current_exception());
+    }
+
+    task.then([this, completed](pplx::task<void> previous)
+    {
+        bool succeeded = false;
+        try
+        {
+            previous.get();
+            succeeded = true;
+        }
+        catch (const std::exception&)
+        {
+            // The message reappears once its visibility timeout lapses.
+        }
+
+        if (completed)
+        {
+            try
+            {
+                completed(succeeded);
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_pending;
+        m_changed.notify_all();
+    });
+}
+
+void delete_window::remove(const cloud_queue_message& message, const std::function<void(const cloud_queue_message& message)>& deleted)
+{
+    // The async call takes the message by reference, so it lives in the continuations.
+    std::shared_ptr<cloud_queue_message> copy = std::make_shared<cloud_queue_message>(message);
+
+    start([this, copy]
+    {
+        return m_queue.delete_message_async(*copy, m_options, operation_context());
+    }, [copy, deleted](bool succeeded)
+    {
+        if (succeeded && deleted)
+        {
+            deleted(*copy);
+        }
+    });
+}
+
+void delete_window::release(const cloud_queue_message& message)
+{
+    cloud_queue_message copy(message);
+    try
+    {
+        m_queue.update_message(copy, std::chrono::seconds(0), false, m_options, operation_context());
+    }
+    catch (const std::exception&)
+    {
+        // The message reappears once its visibility timeout lapses.
+    }
+}
+
+void delete_window::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this] { return m_pending == 0; });
+}
@@ -0,0 +1,64 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+using namespace azure::storage;
+
+///
+/// The acknowledgements a consumer sends once it is done with a message: deletes, and other
+/// operations that end in one, run without blocking the caller unless max_pending are already
+/// outstanding, and abandoned messages are made visible again right away.
+///
+/// The owner must call wait() before it is destroyed, since completions refer to the window.
+///
+class delete_window
+{
+public:
+    delete_window(cloud_queue queue, size_t max_pending, const queue_request_options& options);
+
+    ///
+    /// Starts the operation once fewer than max_pending are outstanding, and counts it until
+    /// its task finishes. A synchronous throw counts as a failed operation. completed, if set,
+    /// is told whether the operation succeeded.
+    ///
+    void start(const std::function<pplx::task<void>()>& operation, const std::function<void(bool succeeded)>& completed = std::function<void(bool)>());
+
+    // Deletes the message through start(); deleted, if set, is called once the delete succeeds.
+    void remove(const cloud_queue_message& message, const std::function<void(const cloud_queue_message& message)>& deleted = std::function<void(const cloud_queue_message&)>());
+
+    // Makes a message visible again immediately instead of waiting for its lease to run out.
+    void release(const cloud_queue_message& message);
+
+    // Waits until no operation is outstanding.
+    void wait();
+
+private:
+    delete_window(const delete_window&);
+    delete_window& operator=(const delete_window&);
+
+    cloud_queue m_queue;
+    size_t m_max_pending;
+    queue_request_options m_options;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    size_t m_pending;
+};
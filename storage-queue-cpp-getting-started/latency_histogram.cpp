@@ -0,0 +1,147 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "latency_histogram.h"
+
+// Values below 2^sub_bucket_bits get a bucket each; every power of two above that is split
+// into 2^sub_bucket_bits buckets.
+static const unsigned int sub_bucket_bits = 4;
+static const uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+static const unsigned int max_exponent = 47;
+static const size_t bucket_count = static_cast<size_t>(sub_bucket_count + (max_exponent - sub_bucket_bits + 1) * sub_bucket_count);
+
+latency_histogram::latency_histogram()
+    : m_buckets(bucket_count, 0), m_count(0), m_sum(0), m_min(0), m_max(0)
+{
+}
+
+void latency_histogram::record(std::chrono::microseconds latency)
+{
+    uint64_t value = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+
+    m_buckets[bucket_index(value)]++;
+    m_min = m_count == 0 ? value : std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_sum += value;
+    m_count++;
+}
+
+void latency_histogram::merge(const latency_histogram& other)
+{
+    if (other.m_count == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_buckets.size(); i++)
+    {
+        m_buckets[i] += other.m_buckets[i];
+    }
+
+    m_min = m_count == 0 ? other.m_min : std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+void latency_histogram::reset()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), 0);
+    m_count = 0;
+    m_sum = 0;
+    m_min = 0;
+    m_max = 0;
+}
+
+uint64_t latency_histogram::count() const
+{
+    return m_count;
+}
+
+std::chrono::microseconds latency_histogram::minimum() const
+{
+    return std::chrono::microseconds(m_min);
+}
+
+std::chrono::microseconds latency_histogram::maximum() const
+{
+    return std::chrono::microseconds(m_max);
+}
+
+std::chrono::microseconds latency_histogram::mean() const
+{
+    return std::chrono::microseconds(m_count == 0 ? 0 : m_sum / m_count);
+}
+
+std::chrono::microseconds latency_histogram::percentile(double fraction) const
+{
+    if (m_count == 0)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    fraction = std::max(0.0, std::min(fraction, 1.0));
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(m_count) + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_buckets.size(); i++)
+    {
+        seen += m_buckets[i];
+        if (seen >= rank)
+        {
+            return std::chrono::microseconds(std::min(std::max(bucket_upper_bound(i), m_min), m_max));
+        }
+    }
+
+    return std::chrono::microseconds(m_max);
+}
+
+size_t latency_histogram::bucket_index(uint64_t value)
+{
+    if (value < sub_bucket_count)
+    {
+        return static_cast<size_t>(value);
+    }
+
+    unsigned int exponent = sub_bucket_bits;
+    while (exponent < max_exponent && (value >> (exponent + 1)) != 0)
+    {
+        exponent++;
+    }
+
+    if ((value >> (exponent + 1)) != 0)
+    {
+        return bucket_count - 1;
+    }
+
+    uint64_t sub_bucket = (value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+    return static_cast<size_t>(sub_bucket_count + (exponent - sub_bucket_bits) * sub_bucket_count + sub_bucket);
+}
+
+uint64_t latency_histogram::bucket_upper_bound(size_t index)
+{
+    if (index < sub_bucket_count)
+    {
+        return index;
+    }
+
+    unsigned int exponent = static_cast<unsigned int>((index - sub_bucket_count) / sub_bucket_count) + sub_bucket_bits;
+    uint64_t sub_bucket = (index - sub_bucket_count) % sub_bucket_count;
+    uint64_t width = uint64_t(1) << (exponent - sub_bucket_bits);
+    return (sub_bucket_count + sub_bucket) * width + width - 1;
+}
@@ -0,0 +1,53 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+///
+/// Records latencies in microseconds into log-linear buckets: each power of two is split
+/// into 16 equal buckets, so a reported percentile is within about 6% of the true value.
+/// Not thread-safe; keep one histogram per thread and merge them when reporting.
+///
+class latency_histogram
+{
+public:
+    latency_histogram();
+
+    void record(std::chrono::microseconds latency);
+    void merge(const latency_histogram& other);
+    void reset();
+
+    uint64_t count() const;
+    std::chrono::microseconds minimum() const;
+    std::chrono::microseconds maximum() const;
+    std::chrono::microseconds mean() const;
+
+    // Latency at or below which the given fraction (0 to 1) of samples fall.
+    std::chrono::microseconds percentile(double fraction) const;
+
+private:
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_upper_bound(size_t index);
+
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
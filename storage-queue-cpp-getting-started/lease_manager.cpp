@@ -0,0 +1,337 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "lease_manager.h"
+
+#include <algorithm>
+
+using namespace azure::storage;
+
+const unsigned int lease_manager::slot_bits;
+const unsigned int lease_manager::level_count;
+const uint64_t lease_manager::slot_count;
+
+lease_manager_options::lease_manager_options()
+    : visibility_timeout(30), renewal_margin(10), tick(100), max_pending_renewals(64)
+{
+}
+
+lease_manager::lease_manager(cloud_queue queue, const lease_manager_options& options)
+    : m_queue(queue), m_options(options), m_epoch(std::chrono::steady_clock::now()), m_wheel(level_count * slot_count),
+    m_tick(0), m_next_id(1), m_pending(0), m_stopping(false), m_renewed(0), m_lost(0)
+{
+    m_options.tick = std::max(m_options.tick, std::chrono::milliseconds(1));
+    m_options.max_pending_renewals = std::max<size_t>(m_options.max_pending_renewals, 1);
+    m_timer = std::thread(&lease_manager::timer_loop, this);
+}
+
+lease_manager::~lease_manager()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_changed.notify_all();
+    lock.unlock();
+
+    m_timer.join();
+
+    lock.lock();
+    m_changed.wait(lock, [this] { return m_pending == 0; });
+}
+
+lease_manager::lease_id lease_manager::track(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // The wheel stands still while there is nothing to renew, so catch it up first.
+    if (m_leases.empty())
+    {
+        m_tick = std::max(m_tick, tick_at(std::chrono::steady_clock::now()));
+    }
+
+    lease_id id = m_next_id++;
+    lease& entry = m_leases[id];
+    entry.message = message;
+    entry.renewing = false;
+    entry.lost = false;
+    schedule_locked(id, entry, tick_at(expires - m_options.renewal_margin));
+
+    m_changed.notify_all();
+    return id;
+}
+
+bool lease_manager::get(lease_id id, cloud_queue_message& message) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_leases.find(id);
+    if (found == m_leases.end() || found->second.lost)
+    {
+        return false;
+    }
+
+    message = found->second.message;
+    return true;
+}
+
+bool lease_manager::release(lease_id id, cloud_queue_message& message)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // A renewal in flight is about to replace the pop receipt.
+    m_changed.wait(lock, [this, id]
+    {
+        auto found = m_leases.find(id);
+        return found == m_leases.end() || !found->second.renewing;
+    });
+
+    auto found = m_leases.find(id);
+    if (found == m_leases.end())
+    {
+        return false;
+    }
+
+    // Its timer stays in the wheel and is skipped when it comes due.
+    bool held = !found->second.lost;
+    message = found->second.message;
+    m_leases.erase(found);
+    return held;
+}
+
+size_t lease_manager::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_leases.size();
+}
+
+uint64_t lease_manager::renewed_count() const
+{
+    return m_renewed;
+}
+
+uint64_t lease_manager::lost_count() const
+{
+    return m_lost;
+}
+
+uint64_t lease_manager::tick_at(std::chrono::steady_clock::time_point time) const
+{
+    if (time <= m_epoch)
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(time - m_epoch).count() / m_options.tick.count());
+}
+
+///
+/// Puts a timer in the lowest level whose span still reaches the due tick: level n holds
+/// timers that share all but the lowest 6 * (n + 1) bits with the current tick, in the slot
+/// given by their next 6 bits. Each time the current tick crosses into a new slot of a level,
+/// that slot's timers move down a level.
+///
+void lease_manager::schedule_locked(lease_id id, lease& entry, uint64_t due_tick)
+{
+    uint64_t horizon = (uint64_t(1) << (slot_bits * level_count)) - 1;
+    due_tick = std::min(std::max(due_tick, m_tick + 1), m_tick + horizon);
+    entry.due_tick = due_tick;
+
+    unsigned int level = 0;
+    while (level + 1 < level_count && (due_tick >> (slot_bits * (level + 1))) != (m_tick >> (slot_bits * (level + 1))))
+    {
+        level++;
+    }
+
+    uint64_t slot = (due_tick >> (slot_bits * level)) & (slot_count - 1);
+    timer scheduled = { id, due_tick };
+    m_wheel[static_cast<size_t>(level * slot_count + slot)].push_back(scheduled);
+}
+
+void lease_manager::cascade_locked(unsigned int level)
+{
+    uint64_t slot = (m_tick >> (slot_bits * level)) & (slot_count - 1);
+    std::vector<timer> timers;
+    timers.swap(m_wheel[static_cast<size_t>(level * slot_count + slot)]);
+
+    for (auto it = timers.begin(); it != timers.end(); ++it)
+    {
+        auto found = m_leases.find(it->id);
+        if (found != m_leases.end() && found->second.due_tick == it->due_tick)
+        {
+            schedule_locked(it->id, found->second, it->due_tick);
+        }
+    }
+}
+
+///
+/// Moves the wheel on by one tick and collects the leases that are due for renewal.
+///
+void lease_manager::advance_locked(std::vector<lease_id>& due)
+{
+    m_tick++;
+
+    // Higher levels go first, so timers they move into a lower level's current slot are
+    // moved on again in the same tick.
+    for (unsigned int level = level_count - 1; level > 0; level--)
+    {
+        if ((m_tick & ((uint64_t(1) << (slot_bits * level)) - 1)) == 0)
+        {
+            cascade_locked(level);
+        }
+    }
+
+    std::vector<timer> timers;
+    timers.swap(m_wheel[static_cast<size_t>(m_tick & (slot_count - 1))]);
+    for (auto it = timers.begin(); it != timers.end(); ++it)
+    {
+        auto found = m_leases.find(it->id);
+        if (found != m_leases.end() && found->second.due_tick == it->due_tick && !found->second.lost)
+        {
+            due.push_back(it->id);
+        }
+    }
+}
+
+///
+/// Starts a renewal for each due lease, waiting only while max_pending_renewals are already
+/// outstanding. Completions update the pop receipt and schedule the next renewal.
+///
+void lease_manager::renew(const std::vector<lease_id>& due)
+{
+    for (auto it = due.begin(); it != due.end(); ++it)
+    {
+        lease_id id = *it;
+        std::shared_ptr<cloud_queue_message> message;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_pending < m_options.max_pending_renewals; });
+
+            auto found = m_leases.find(id);
+            if (found == m_leases.end() || found->second.lost || found->second.renewing)
+            {
+                continue;
+            }
+
+            found->second.renewing = true;
+            message = std::make_shared<cloud_queue_message>(found->second.message);
+            m_pending++;
+        }
+
+        // update_message_async updates the pop receipt on the message it is given, so the
+        // message has to outlive the operation.
+        std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now();
+        pplx::task<void> operation;
+        try
+        {
+            operation = m_queue.update_message_async(*message, m_options.visibility_timeout, false, m_options.request_options, operation_context());
+        }
+        catch (...)
+        {
+            operation = pplx::task_from_exception<void>(std::current_exception());
+        }
+
+        operation.then([this, id, message, requested](pplx::task<void> previous)
+        {
+            bool renewed = false;
+            try
+            {
+                previous.get();
+                renewed = true;
+            }
+            catch (const std::exception&)
+            {
+            }
+
+            renewal_completed(id, message, requested, renewed);
+        });
+    }
+}
+
+void lease_manager::renewal_completed(lease_id id, std::shared_ptr<cloud_queue_message> message, std::chrono::steady_clock::time_point requested, bool renewed)
+{
+    bool lost = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_leases.find(id);
+        if (found != m_leases.end())
+        {
+            lease& entry = found->second;
+            entry.renewing = false;
+            if (renewed)
+            {
+                entry.message = *message;
+                schedule_locked(id, entry, tick_at(requested + m_options.visibility_timeout - m_options.renewal_margin));
+                ++m_renewed;
+            }
+            else
+            {
+                // The pop receipt is no longer valid (or the lease already ran out), so the
+                // message may be handed to another consumer.
+                entry.lost = true;
+                lost = true;
+                ++m_lost;
+            }
+        }
+
+        m_changed.notify_all();
+    }
+
+    if (lost && m_options.lost_handler)
+    {
+        try
+        {
+            m_options.lost_handler(*message);
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    // The destructor waits for this, so nothing touches the manager afterwards.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending--;
+    m_changed.notify_all();
+}
+
+void lease_manager::timer_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        if (m_leases.empty())
+        {
+            m_changed.wait(lock);
+            continue;
+        }
+
+        std::vector<lease_id> due;
+        uint64_t now = tick_at(std::chrono::steady_clock::now());
+        while (m_tick < now)
+        {
+            advance_locked(due);
+        }
+
+        if (!due.empty())
+        {
+            lock.unlock();
+            renew(due);
+            lock.lock();
+            continue;
+        }
+
+        m_changed.wait_until(lock, m_epoch + m_options.tick * static_cast<std::chrono::milliseconds::rep>(m_tick + 1));
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Settings for lease_manager.
+///
+struct lease_manager_options
+{
+    lease_manager_options();
+
+    // Visibility timeout requested on each renewal.
+    std::chrono::seconds visibility_timeout;
+
+    // A lease is renewed once less than this much of it is left.
+    std::chrono::seconds renewal_margin;
+
+    // Resolution of the timer wheel.
+    std::chrono::milliseconds tick;
+
+    // Maximum number of update_message_async calls outstanding at once.
+    size_t max_pending_renewals;
+
+    queue_request_options request_options;
+
+    // Called when a renewal fails, so the message can be abandoned before more work is spent
+    // on it. The message may already have been handed to another consumer. Exceptions it
+    // throws are ignored.
+    std::function<void(const cloud_queue_message& message)> lost_handler;
+};
+
+///
+/// Keeps received messages invisible for as long as they are being worked on. Each tracked
+/// message is renewed with update_message_async shortly before its visibility timeout runs
+/// out, and its pop receipt is kept up to date for the final delete or release.
+///
+/// Renewal times live in a hierarchical timer wheel: four levels of 64 slots, each level
+/// covering 64 times the span of the one below. Tracking, renewing and releasing a lease
+/// take constant time, so one thread keeps tens of thousands of leases alive. Renewals that
+/// fall due on the same tick are sent concurrently.
+///
+class lease_manager
+{
+public:
+    typedef uint64_t lease_id;
+
+    explicit lease_manager(cloud_queue queue, const lease_manager_options& options = lease_manager_options());
+
+    // Waits for renewals in flight. Leases still tracked are left to run out.
+    ~lease_manager();
+
+    // Starts renewing a message whose visibility timeout runs out at expires.
+    lease_id track(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires);
+
+    // Copies the message with its current pop receipt. Returns false if the lease was lost.
+    bool get(lease_id id, cloud_queue_message& message) const;
+
+    ///
+    /// Stops renewing the message and copies it with its current pop receipt, ready to be
+    /// deleted or released. Waits for a renewal in flight. Returns false if the lease was lost.
+    ///
+    bool release(lease_id id, cloud_queue_message& message);
+
+    // Leases currently tracked, including lost ones not yet released.
+    size_t size() const;
+
+    uint64_t renewed_count() const;
+    uint64_t lost_count() const;
+
+private:
+    struct lease
+    {
+        cloud_queue_message message;
+        uint64_t due_tick;
+        bool renewing;
+        bool lost;
+    };
+
+    struct timer
+    {
+        lease_id id;
+        uint64_t due_tick;
+    };
+
+    static const unsigned int slot_bits = 6;
+    static const unsigned int level_count = 4;
+    static const uint64_t slot_count = uint64_t(1) << slot_bits;
+
+    lease_manager(const lease_manager&);
+    lease_manager& operator=(const lease_manager&);
+
+    uint64_t tick_at(std::chrono::steady_clock::time_point time) const;
+    void schedule_locked(lease_id id, lease& entry, uint64_t due_tick);
+    void cascade_locked(unsigned int level);
+    void advance_locked(std::vector<lease_id>& due);
+    void renew(const std::vector<lease_id>& due);
+    void renewal_completed(lease_id id, std::shared_ptr<cloud_queue_message> message, std::chrono::steady_clock::time_point requested, bool renewed);
+    void timer_loop();
+
+    cloud_queue m_queue;
+    lease_manager_options m_options;
+    std::chrono::steady_clock::time_point m_epoch;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::unordered_map<lease_id, lease> m_leases;
+    std::vector<std::vector<timer>> m_wheel;
+    uint64_t m_tick;
+    lease_id m_next_id;
+    size_t m_pending;
+    bool m_stopping;
+    std::thread m_timer;
+
+    std::atomic<uint64_t> m_renewed;
+    std::atomic<uint64_t> m_lost;
+};
@@ -0,0 +1,858 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "local_queue_service.h"
+#include "cpprest/http_listener.h"
+
+#include <iterator>
+#include <thread>
+
+using namespace web::http;
+using namespace web::http::experimental::listener;
+
+// Well-known development storage account key; the service does not check signatures.
+static const utility::string_t development_account_key(U("Eby8vdM02xNOcqFlqUwJPLlmEtlCDXJ1OUzFT50uSRZ6IFsuFq2UVErCz4I6tq/K1SZFPTOtr/KBHBeksoGMGw=="));
+
+// Limits enforced by the Queue service.
+static const size_t max_message_text_length = 64 * 1024;
+static const int max_messages_per_get = 32;
+static const int max_visibility_timeout_seconds = 7 * 24 * 60 * 60;
+
+static const utility::string_t xml_declaration(U("<?xml version=\"1.0\" encoding=\"utf-8\"?>"));
+
+static const utility::string_t default_service_properties(U("<?xml version=\"1.0\" encoding=\"utf-8\"?><StorageServiceProperties>")
+    U("<Logging><Version>1.0</Version><Delete>false</Delete><Read>false</Read><Write>false</Write><RetentionPolicy><Enabled>false</Enabled></RetentionPolicy></Logging>")
+    U("<HourMetrics><Version>1.0</Version><Enabled>false</Enabled><RetentionPolicy><Enabled>false</Enabled></RetentionPolicy></HourMetrics>")
+    U("<MinuteMetrics><Version>1.0</Version><Enabled>false</Enabled><RetentionPolicy><Enabled>false</Enabled></RetentionPolicy></MinuteMetrics>")
+    U("<Cors /></StorageServiceProperties>"));
+
+static utility::string_t xml_escape(const utility::string_t& value)
+{
+    utility::string_t escaped;
+    escaped.reserve(value.size());
+    for (auto it = value.begin(); it != value.end(); ++it)
+    {
+        switch (*it)
+        {
+        case U('&'): escaped.append(U("&amp;")); break;
+        case U('<'): escaped.append(U("&lt;")); break;
+        case U('>'): escaped.append(U("&gt;")); break;
+        case U('"'): escaped.append(U("&quot;")); break;
+        case U('\''): escaped.append(U("&apos;")); break;
+        default: escaped.push_back(*it); break;
+        }
+    }
+
+    return escaped;
+}
+
+static void append_code_point(utility::string_t& output, unsigned long code_point)
+{
+#ifdef _UTF16_STRINGS
+    if (code_point >= 0x10000)
+    {
+        code_point -= 0x10000;
+        output.push_back(static_cast<utility::char_t>(0xD800 + (code_point >> 10)));
+        output.push_back(static_cast<utility::char_t>(0xDC00 + (code_point & 0x3FF)));
+    }
+    else
+    {
+        output.push_back(static_cast<utility::char_t>(code_point));
+    }
+#else
+    if (code_point < 0x80)
+    {
+        output.push_back(static_cast<char>(code_point));
+    }
+    else if (code_point < 0x800)
+    {
+        output.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+    else if (code_point < 0x10000)
+    {
+        output.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+    else
+    {
+        output.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+#endif
+}
+
+static utility::string_t xml_unescape(const utility::string_t& value)
+{
+    utility::string_t unescaped;
+    unescaped.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        size_t end;
+        if (value[i] != U('&') || (end = value.find(U(';'), i)) == utility::string_t::npos)
+        {
+            unescaped.push_back(value[i]);
+            continue;
+        }
+
+        utility::string_t entity = value.substr(i + 1, end - i - 1);
+        if (entity == U("amp")) unescaped.push_back(U('&'));
+        else if (entity == U("lt")) unescaped.push_back(U('<'));
+        else if (entity == U("gt")) unescaped.push_back(U('>'));
+        else if (entity == U("quot")) unescaped.push_back(U('"'));
+        else if (entity == U("apos")) unescaped.push_back(U('\''));
+        else if (entity.size() > 2 && entity[0] == U('#') && (entity[1] == U('x') || entity[1] == U('X')))
+            append_code_point(unescaped, std::stoul(entity.substr(2), nullptr, 16));
+        else if (entity.size() > 1 && entity[0] == U('#'))
+            append_code_point(unescaped, std::stoul(entity.substr(1), nullptr, 10));
+        else
+        {
+            unescaped.push_back(value[i]);
+            continue;
+        }
+
+        i = end;
+    }
+
+    return unescaped;
+}
+
+// Returns the text of the first <element> in an XML document, or an empty string.
+static utility::string_t xml_element_text(const utility::string_t& document, const utility::string_t& element)
+{
+    utility::string_t open = U("<") + element + U(">");
+    utility::string_t close = U("</") + element + U(">");
+
+    size_t begin = document.find(open);
+    if (begin == utility::string_t::npos)
+    {
+        return utility::string_t();
+    }
+
+    begin += open.size();
+    size_t end = document.find(close, begin);
+    if (end == utility::string_t::npos)
+    {
+        return utility::string_t();
+    }
+
+    return xml_unescape(document.substr(begin, end - begin));
+}
+
+static utility::string_t query_value(const std::map<utility::string_t, utility::string_t>& query, const utility::string_t& name)
+{
+    auto it = query.find(name);
+    return it == query.end() ? utility::string_t() : it->second;
+}
+
+static int query_int(const std::map<utility::string_t, utility::string_t>& query, const utility::string_t& name, int default_value)
+{
+    utility::string_t value = query_value(query, name);
+    return value.empty() ? default_value : std::stoi(value);
+}
+
+static utility::string_t to_lower(utility::string_t value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+template<typename T>
+static utility::string_t to_string_t(T value)
+{
+    utility::ostringstream_t stream;
+    stream << value;
+    return stream.str();
+}
+
+local_queue_service_options::local_queue_service_options()
+    : account_name(U("devstoreaccount1")), port(10101), latency(0), latency_jitter(0), throttle_rate(0.0), error_rate(0.0)
+{
+}
+
+local_queue_service::response_data::response_data()
+    : status(status_codes::OK)
+{
+}
+
+local_queue_service::local_queue_service()
+    : local_queue_service(local_queue_service_options())
+{
+}
+
+local_queue_service::local_queue_service(const local_queue_service_options& options)
+    : m_options(options), m_service_properties(default_service_properties), m_random(std::random_device()()), m_stopping(false),
+    m_latency_ms(options.latency.count()), m_latency_jitter_ms(options.latency_jitter.count()),
+    m_throttle_rate(options.throttle_rate), m_error_rate(options.error_rate), m_requests(0), m_throttled(0), m_failed(0)
+{
+}
+
+local_queue_service::~local_queue_service()
+{
+    stop();
+}
+
+void local_queue_service::start()
+{
+    if (m_listener)
+    {
+        return;
+    }
+
+    utility::string_t address = U("http://127.0.0.1:") + to_string_t(m_options.port) + U("/") + m_options.account_name;
+    m_stopping = false;
+    m_replier = std::thread(&local_queue_service::reply_loop, this);
+
+    m_listener.reset(new http_listener(web::uri(address)));
+    m_listener->support([this](http_request request) { handle(request); });
+    m_listener->open().wait();
+}
+
+void local_queue_service::stop()
+{
+    if (!m_listener)
+    {
+        return;
+    }
+
+    // Delayed replies go out straight away from here on, so closing does not wait for them.
+    {
+        std::lock_guard<std::mutex> lock(m_replies_mutex);
+        m_stopping = true;
+        m_replies_changed.notify_all();
+    }
+
+    m_listener->close().wait();
+    m_listener.reset();
+    m_replier.join();
+}
+
+utility::string_t local_queue_service::connection_string() const
+{
+    return U("DefaultEndpointsProtocol=http;AccountName=") + m_options.account_name
+        + U(";AccountKey=") + development_account_key
+        + U(";QueueEndpoint=http://127.0.0.1:") + to_string_t(m_options.port) + U("/") + m_options.account_name;
+}
+
+void local_queue_service::set_latency(std::chrono::milliseconds latency, std::chrono::milliseconds latency_jitter)
+{
+    m_latency_ms = latency.count();
+    m_latency_jitter_ms = latency_jitter.count();
+}
+
+void local_queue_service::set_throttle_rate(double rate)
+{
+    m_throttle_rate = rate;
+}
+
+void local_queue_service::set_error_rate(double rate)
+{
+    m_error_rate = rate;
+}
+
+uint64_t local_queue_service::request_count() const
+{
+    return m_requests;
+}
+
+uint64_t local_queue_service::throttled_count() const
+{
+    return m_throttled;
+}
+
+uint64_t local_queue_service::failed_count() const
+{
+    return m_failed;
+}
+
+///
+/// Applies the injected faults and answers the request. With injected latency the request is
+/// carried out at once and the reply is handed to reply_loop to send once the delay is up, so
+/// slow replies do not tie up listener threads and any number of requests can be in flight.
+///
+void local_queue_service::handle(http_request request)
+{
+    uint64_t request_number = ++m_requests;
+
+    long long delay = m_latency_ms;
+    long long jitter = m_latency_jitter_ms;
+    if (jitter > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_random_mutex);
+        delay += std::uniform_int_distribution<long long>(0, jitter)(m_random);
+    }
+
+    response_data data;
+    if (roll(m_throttle_rate))
+    {
+        ++m_throttled;
+        data = error(status_codes::ServiceUnavailable, U("ServerBusy"), U("The server is busy."));
+    }
+    else if (roll(m_error_rate))
+    {
+        ++m_failed;
+        data = error(status_codes::InternalError, U("InternalError"), U("The server encountered an internal error. Please retry the request."));
+    }
+    else
+    {
+        try
+        {
+            data = dispatch(request);
+        }
+        catch (const std::exception&)
+        {
+            data = error(status_codes::BadRequest, U("InvalidInput"), U("One of the request inputs is not valid."));
+        }
+    }
+
+    http_response response(data.status);
+    response.headers().add(U("x-ms-request-id"), to_string_t(request_number));
+    response.headers().add(U("x-ms-version"), U("2015-04-05"));
+    response.headers().add(header_names::date, utility::datetime::utc_now().to_string(utility::datetime::RFC_1123));
+    for (auto it = data.headers.begin(); it != data.headers.end(); ++it)
+    {
+        response.headers().add(it->first, it->second);
+    }
+
+    if (!data.body.empty())
+    {
+        response.set_body(data.body, U("application/xml"));
+    }
+
+    if (delay > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_replies_mutex);
+        if (!m_stopping)
+        {
+            m_replies.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), std::make_pair(request, response)));
+            m_replies_changed.notify_all();
+            return;
+        }
+    }
+
+    request.reply(response);
+}
+
+///
+/// Sends delayed replies as they fall due. reply() only starts the send, so one thread keeps
+/// up with many replies. Once stopping, the replies still waiting are sent straight away.
+///
+void local_queue_service::reply_loop()
+{
+    std::unique_lock<std::mutex> lock(m_replies_mutex);
+    while (true)
+    {
+        if (m_replies.empty())
+        {
+            if (m_stopping)
+            {
+                return;
+            }
+
+            m_replies_changed.wait(lock);
+            continue;
+        }
+
+        reply_schedule::iterator next = m_replies.begin();
+        if (!m_stopping && next->first > std::chrono::steady_clock::now())
+        {
+            m_replies_changed.wait_until(lock, next->first);
+            continue;
+        }
+
+        http_request request = next->second.first;
+        http_response response = next->second.second;
+        m_replies.erase(next);
+
+        lock.unlock();
+        request.reply(response).then([](pplx::task<void> previous)
+        {
+            try
+            {
+                previous.get();
+            }
+            catch (const std::exception&)
+            {
+                // The client has gone away.
+            }
+        });
+        lock.lock();
+    }
+}
+
+///
+/// Routes on the path below the account: "/" for service level operations, "/queue" for
+/// queue operations, and "/queue/messages[/id]" for message operations.
+///
+local_queue_service::response_data local_queue_service::dispatch(http_request& request)
+{
+    query_map query = web::uri::split_query(request.request_uri().query());
+    for (auto it = query.begin(); it != query.end(); ++it)
+    {
+        it->second = web::uri::decode(it->second);
+    }
+
+    std::vector<utility::string_t> segments = web::uri::split_path(web::uri::decode(request.relative_uri().path()));
+    utility::string_t comp = query_value(query, U("comp"));
+
+    if (segments.empty())
+    {
+        if (comp == U("list") && request.method() == methods::GET)
+        {
+            return list_queues(query);
+        }
+
+        if (comp == U("properties") && query_value(query, U("restype")) == U("service"))
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (request.method() == methods::GET)
+            {
+                response_data data;
+                data.body = m_service_properties;
+                return data;
+            }
+
+            if (request.method() == methods::PUT)
+            {
+                m_service_properties = request.extract_string(true).get();
+                response_data data;
+                data.status = status_codes::Accepted;
+                return data;
+            }
+        }
+
+        return error(status_codes::BadRequest, U("UnsupportedHttpVerb"), U("The resource doesn't support the specified HTTP verb."));
+    }
+
+    return queue_operation(request, segments, query);
+}
+
+local_queue_service::response_data local_queue_service::list_queues(const query_map& query)
+{
+    utility::string_t prefix = query_value(query, U("prefix"));
+    utility::string_t marker = query_value(query, U("marker"));
+    int max_results = std::max(1, std::min(query_int(query, U("maxresults"), 5000), 5000));
+    bool include_metadata = query_value(query, U("include")) == U("metadata");
+
+    utility::string_t body = xml_declaration;
+    body.append(U("<EnumerationResults ServiceEndpoint=\"http://127.0.0.1:") + to_string_t(m_options.port) + U("/") + xml_escape(m_options.account_name) + U("/\">"));
+    body.append(U("<Prefix>") + xml_escape(prefix) + U("</Prefix>"));
+    if (!marker.empty())
+    {
+        body.append(U("<Marker>") + xml_escape(marker) + U("</Marker>"));
+    }
+    body.append(U("<MaxResults>") + to_string_t(max_results) + U("</MaxResults><Queues>"));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_queues.lower_bound(std::max(prefix, marker));
+    for (int count = 0; it != m_queues.end() && it->first.compare(0, prefix.size(), prefix) == 0 && count < max_results; ++it, ++count)
+    {
+        body.append(U("<Queue><Name>") + xml_escape(it->first) + U("</Name>"));
+        if (include_metadata)
+        {
+            body.append(U("<Metadata>"));
+            for (auto entry = it->second.metadata.begin(); entry != it->second.metadata.end(); ++entry)
+            {
+                body.append(U("<") + entry->first + U(">") + xml_escape(entry->second) + U("</") + entry->first + U(">"));
+            }
+            body.append(U("</Metadata>"));
+        }
+        body.append(U("</Queue>"));
+    }
+
+    body.append(U("</Queues>"));
+    if (it != m_queues.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        body.append(U("<NextMarker>") + xml_escape(it->first) + U("</NextMarker>"));
+    }
+    else
+    {
+        body.append(U("<NextMarker />"));
+    }
+    body.append(U("</EnumerationResults>"));
+
+    response_data data;
+    data.body = body;
+    return data;
+}
+
+local_queue_service::response_data local_queue_service::queue_operation(http_request& request, const std::vector<utility::string_t>& segments, const query_map& query)
+{
+    const utility::string_t& queue_name = segments[0];
+    utility::string_t comp = query_value(query, U("comp"));
+    const method& verb = request.method();
+
+    // The body is read before taking the lock so a slow upload doesn't stall other requests.
+    utility::string_t body;
+    if (verb == methods::PUT || verb == methods::POST)
+    {
+        body = request.extract_string(true).get();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (segments.size() == 1 && verb == methods::PUT && comp.empty())
+    {
+        if (m_queues.find(queue_name) != m_queues.end())
+        {
+            response_data data;
+            data.status = status_codes::NoContent;
+            return data;
+        }
+
+        stored_queue& queue = m_queues[queue_name];
+        for (auto it = request.headers().begin(); it != request.headers().end(); ++it)
+        {
+            utility::string_t name = to_lower(it->first);
+            if (name.compare(0, 10, U("x-ms-meta-")) == 0)
+            {
+                queue.metadata[name.substr(10)] = it->second;
+            }
+        }
+
+        response_data data;
+        data.status = status_codes::Created;
+        return data;
+    }
+
+    auto found = m_queues.find(queue_name);
+    if (found == m_queues.end())
+    {
+        return error(status_codes::NotFound, U("QueueNotFound"), U("The specified queue does not exist."));
+    }
+
+    stored_queue& queue = found->second;
+    response_data data;
+
+    if (segments.size() == 1)
+    {
+        if (verb == methods::DEL && comp.empty())
+        {
+            m_queues.erase(found);
+            data.status = status_codes::NoContent;
+        }
+        else if ((verb == methods::GET || verb == methods::HEAD) && comp == U("metadata"))
+        {
+            remove_expired(queue, std::chrono::steady_clock::now());
+            data.headers[U("x-ms-approximate-messages-count")] = to_string_t(queue.messages.size());
+            for (auto it = queue.metadata.begin(); it != queue.metadata.end(); ++it)
+            {
+                data.headers[U("x-ms-meta-") + it->first] = it->second;
+            }
+        }
+        else if (verb == methods::PUT && comp == U("metadata"))
+        {
+            queue.metadata.clear();
+            for (auto it = request.headers().begin(); it != request.headers().end(); ++it)
+            {
+                utility::string_t name = to_lower(it->first);
+                if (name.compare(0, 10, U("x-ms-meta-")) == 0)
+                {
+                    queue.metadata[name.substr(10)] = it->second;
+                }
+            }
+            data.status = status_codes::NoContent;
+        }
+        else if (verb == methods::GET && comp == U("acl"))
+        {
+            data.body = queue.acl.empty() ? xml_declaration + U("<SignedIdentifiers />") : queue.acl;
+        }
+        else if (verb == methods::PUT && comp == U("acl"))
+        {
+            queue.acl = body;
+            data.status = status_codes::NoContent;
+        }
+        else
+        {
+            data = error(status_codes::BadRequest, U("UnsupportedHttpVerb"), U("The resource doesn't support the specified HTTP verb."));
+        }
+
+        return data;
+    }
+
+    if (segments[1] != U("messages") || segments.size() > 3)
+    {
+        return error(status_codes::BadRequest, U("InvalidUri"), U("The requested URI does not represent any resource on the server."));
+    }
+
+    if (segments.size() == 3)
+    {
+        if (verb == methods::PUT)
+        {
+            return update_message(queue, segments[2], body, query);
+        }
+
+        if (verb == methods::DEL)
+        {
+            return delete_message(queue, segments[2], query);
+        }
+    }
+    else if (verb == methods::POST)
+    {
+        return put_message(queue, body, query);
+    }
+    else if (verb == methods::GET)
+    {
+        return get_messages(queue, query, query_value(query, U("peekonly")) == U("true"));
+    }
+    else if (verb == methods::DEL)
+    {
+        queue.messages.clear();
+        queue.index.clear();
+        data.status = status_codes::NoContent;
+        return data;
+    }
+
+    return error(status_codes::BadRequest, U("UnsupportedHttpVerb"), U("The resource doesn't support the specified HTTP verb."));
+}
+
+local_queue_service::response_data local_queue_service::put_message(stored_queue& queue, const utility::string_t& body, const query_map& query)
+{
+    utility::string_t text = xml_element_text(body, U("MessageText"));
+    if (text.size() > max_message_text_length)
+    {
+        return error(status_codes::RequestEntityTooLarge, U("RequestBodyTooLarge"), U("The request body is too large and exceeds the maximum permissible limit."));
+    }
+
+    int visibility_timeout = query_int(query, U("visibilitytimeout"), 0);
+    int time_to_live = query_int(query, U("messagettl"), max_visibility_timeout_seconds);
+    if (visibility_timeout < 0 || visibility_timeout > max_visibility_timeout_seconds || time_to_live <= 0 || visibility_timeout >= time_to_live)
+    {
+        return error(status_codes::BadRequest, U("OutOfRangeQueryParameterValue"), U("One of the query parameters specified in the request URI is outside the permissible range."));
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    utility::datetime utc_now = utility::datetime::utc_now();
+
+    stored_message message;
+    message.id = new_message_id();
+    message.pop_receipt = new_pop_receipt();
+    message.text = text;
+    message.insertion_time = utc_now;
+    message.expiration_time = utc_now + utility::datetime::from_seconds(static_cast<unsigned int>(time_to_live));
+    message.next_visible_time = utc_now + utility::datetime::from_seconds(static_cast<unsigned int>(visibility_timeout));
+    message.expires = now + std::chrono::seconds(time_to_live);
+    message.visible = now + std::chrono::seconds(visibility_timeout);
+    message.dequeue_count = 0;
+
+    queue.messages.push_back(message);
+    queue.index[message.id] = std::prev(queue.messages.end());
+
+    response_data data;
+    data.status = status_codes::Created;
+    data.body = xml_declaration + U("<QueueMessagesList><QueueMessage>")
+        + U("<MessageId>") + message.id + U("</MessageId>")
+        + U("<InsertionTime>") + message.insertion_time.to_string(utility::datetime::RFC_1123) + U("</InsertionTime>")
+        + U("<ExpirationTime>") + message.expiration_time.to_string(utility::datetime::RFC_1123) + U("</ExpirationTime>")
+        + U("<PopReceipt>") + message.pop_receipt + U("</PopReceipt>")
+        + U("<TimeNextVisible>") + message.next_visible_time.to_string(utility::datetime::RFC_1123) + U("</TimeNextVisible>")
+        + U("</QueueMessage></QueueMessagesList>");
+    return data;
+}
+
+///
+/// Hands out the oldest visible messages. Received messages move to the back of the list so
+/// the visible ones stay near the front.
+///
+local_queue_service::response_data local_queue_service::get_messages(stored_queue& queue, const query_map& query, bool peek_only)
+{
+    int count = query_int(query, U("numofmessages"), 1);
+    int visibility_timeout = query_int(query, U("visibilitytimeout"), 30);
+    if (count < 1 || count > max_messages_per_get || visibility_timeout < 1 || visibility_timeout > max_visibility_timeout_seconds)
+    {
+        return error(status_codes::BadRequest, U("OutOfRangeQueryParameterValue"), U("One of the query parameters specified in the request URI is outside the permissible range."));
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    utility::datetime utc_now = utility::datetime::utc_now();
+    remove_expired(queue, now);
+
+    std::vector<message_list::iterator> selected;
+    for (auto it = queue.messages.begin(); it != queue.messages.end() && selected.size() < static_cast<size_t>(count); ++it)
+    {
+        if (it->visible <= now)
+        {
+            selected.push_back(it);
+        }
+    }
+
+    utility::string_t body = xml_declaration + U("<QueueMessagesList>");
+    for (auto selected_it = selected.begin(); selected_it != selected.end(); ++selected_it)
+    {
+        message_list::iterator it = *selected_it;
+        if (!peek_only)
+        {
+            it->pop_receipt = new_pop_receipt();
+            it->visible = now + std::chrono::seconds(visibility_timeout);
+            it->next_visible_time = utc_now + utility::datetime::from_seconds(static_cast<unsigned int>(visibility_timeout));
+            it->dequeue_count++;
+            queue.messages.splice(queue.messages.end(), queue.messages, it);
+        }
+
+        body.append(U("<QueueMessage><MessageId>") + it->id + U("</MessageId>"));
+        body.append(U("<InsertionTime>") + it->insertion_time.to_string(utility::datetime::RFC_1123) + U("</InsertionTime>"));
+        body.append(U("<ExpirationTime>") + it->expiration_time.to_string(utility::datetime::RFC_1123) + U("</ExpirationTime>"));
+        if (!peek_only)
+        {
+            body.append(U("<PopReceipt>") + it->pop_receipt + U("</PopReceipt>"));
+            body.append(U("<TimeNextVisible>") + it->next_visible_time.to_string(utility::datetime::RFC_1123) + U("</TimeNextVisible>"));
+        }
+        body.append(U("<DequeueCount>") + to_string_t(it->dequeue_count) + U("</DequeueCount>"));
+        body.append(U("<MessageText>") + xml_escape(it->text) + U("</MessageText></QueueMessage>"));
+    }
+    body.append(U("</QueueMessagesList>"));
+
+    response_data data;
+    data.body = body;
+    return data;
+}
+
+local_queue_service::response_data local_queue_service::update_message(stored_queue& queue, const utility::string_t& id, const utility::string_t& body, const query_map& query)
+{
+    auto found = queue.index.find(id);
+    if (found == queue.index.end())
+    {
+        return error(status_codes::NotFound, U("MessageNotFound"), U("The specified message does not exist."));
+    }
+
+    message_list::iterator it = found->second;
+    if (it->pop_receipt != query_value(query, U("popreceipt")))
+    {
+        return error(status_codes::BadRequest, U("PopReceiptMismatch"), U("The specified pop receipt did not match the pop receipt for a dequeued message."));
+    }
+
+    int visibility_timeout = query_int(query, U("visibilitytimeout"), -1);
+    if (visibility_timeout < 0 || visibility_timeout > max_visibility_timeout_seconds)
+    {
+        return error(status_codes::BadRequest, U("OutOfRangeQueryParameterValue"), U("One of the query parameters specified in the request URI is outside the permissible range."));
+    }
+
+    if (body.find(U("<MessageText>")) != utility::string_t::npos)
+    {
+        utility::string_t text = xml_element_text(body, U("MessageText"));
+        if (text.size() > max_message_text_length)
+        {
+            return error(status_codes::RequestEntityTooLarge, U("RequestBodyTooLarge"), U("The request body is too large and exceeds the maximum permissible limit."));
+        }
+
+        it->text = text;
+    }
+
+    it->pop_receipt = new_pop_receipt();
+    it->visible = std::chrono::steady_clock::now() + std::chrono::seconds(visibility_timeout);
+    it->next_visible_time = utility::datetime::utc_now() + utility::datetime::from_seconds(static_cast<unsigned int>(visibility_timeout));
+
+    response_data data;
+    data.status = status_codes::NoContent;
+    data.headers[U("x-ms-popreceipt")] = it->pop_receipt;
+    data.headers[U("x-ms-time-next-visible")] = it->next_visible_time.to_string(utility::datetime::RFC_1123);
+    return data;
+}
+
+local_queue_service::response_data local_queue_service::delete_message(stored_queue& queue, const utility::string_t& id, const query_map& query)
+{
+    auto found = queue.index.find(id);
+    if (found == queue.index.end())
+    {
+        return error(status_codes::NotFound, U("MessageNotFound"), U("The specified message does not exist."));
+    }
+
+    if (found->second->pop_receipt != query_value(query, U("popreceipt")))
+    {
+        return error(status_codes::BadRequest, U("PopReceiptMismatch"), U("The specified pop receipt did not match the pop receipt for a dequeued message."));
+    }
+
+    queue.messages.erase(found->second);
+    queue.index.erase(found);
+
+    response_data data;
+    data.status = status_codes::NoContent;
+    return data;
+}
+
+void local_queue_service::remove_expired(stored_queue& queue, std::chrono::steady_clock::time_point now)
+{
+    for (auto it = queue.messages.begin(); it != queue.messages.end();)
+    {
+        if (it->expires <= now)
+        {
+            queue.index.erase(it->id);
+            it = queue.messages.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+utility::string_t local_queue_service::new_message_id()
+{
+    std::lock_guard<std::mutex> lock(m_random_mutex);
+    std::uniform_int_distribution<int> digit(0, 15);
+    const utility::char_t* hex = U("0123456789abcdef");
+
+    utility::string_t id;
+    for (int i = 0; i < 32; i++)
+    {
+        if (i == 8 || i == 12 || i == 16 || i == 20)
+        {
+            id.push_back(U('-'));
+        }
+        id.push_back(hex[digit(m_random)]);
+    }
+
+    return id;
+}
+
+utility::string_t local_queue_service::new_pop_receipt()
+{
+    std::lock_guard<std::mutex> lock(m_random_mutex);
+    std::uniform_int_distribution<int> digit(0, 61);
+    const utility::char_t* alphabet = U("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+
+    utility::string_t receipt;
+    for (int i = 0; i < 16; i++)
+    {
+        receipt.push_back(alphabet[digit(m_random)]);
+    }
+
+    return receipt;
+}
+
+bool local_queue_service::roll(double rate)
+{
+    if (rate <= 0.0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_random_mutex);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(m_random) < rate;
+}
+
+local_queue_service::response_data local_queue_service::error(unsigned short status, const utility::string_t& code, const utility::string_t& message)
+{
+    response_data data;
+    data.status = status;
+    data.headers[U("x-ms-error-code")] = code;
+    data.body = xml_declaration + U("<Error><Code>") + code + U("</Code><Message>") + xml_escape(message) + U("</Message></Error>");
+    return data;
+}
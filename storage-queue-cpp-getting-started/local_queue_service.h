@@ -0,0 +1,170 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace web { namespace http { namespace experimental { namespace listener { class http_listener; } } } }
+
+///
+/// Settings for local_queue_service.
+///
+struct local_queue_service_options
+{
+    local_queue_service_options();
+
+    // Account name used in the endpoint path and in the connection string.
+    utility::string_t account_name;
+
+    // Loopback port the service listens on.
+    int port;
+
+    // Fixed delay added before every response, plus a uniformly distributed extra delay of
+    // up to latency_jitter.
+    std::chrono::milliseconds latency;
+    std::chrono::milliseconds latency_jitter;
+
+    // Fraction of requests (0 to 1) answered with 503 Server Busy.
+    double throttle_rate;
+
+    // Fraction of requests (0 to 1) answered with 500 Internal Error.
+    double error_rate;
+};
+
+///
+/// An in-process stand-in for the Queue service, for running the samples and benchmarks
+/// without the Windows-only Storage Emulator or network access. It speaks the subset of the
+/// Queue REST API the samples use: create/delete queue, metadata, ACLs, service properties,
+/// list queues with prefix and continuation, and put/get/peek/update/delete/clear messages.
+///
+/// Requests are not authenticated, and state lives in memory only. Latency, throttling and
+/// failures can be injected to see how clients behave under load.
+///
+class local_queue_service
+{
+public:
+    local_queue_service();
+    explicit local_queue_service(const local_queue_service_options& options);
+    ~local_queue_service();
+
+    void start();
+    void stop();
+
+    // A connection string pointing the storage client library at this service.
+    utility::string_t connection_string() const;
+
+    // Fault injection can be changed while the service is running.
+    void set_latency(std::chrono::milliseconds latency, std::chrono::milliseconds latency_jitter);
+    void set_throttle_rate(double rate);
+    void set_error_rate(double rate);
+
+    uint64_t request_count() const;
+    uint64_t throttled_count() const;
+    uint64_t failed_count() const;
+
+private:
+    struct stored_message
+    {
+        utility::string_t id;
+        utility::string_t pop_receipt;
+        utility::string_t text;
+        utility::datetime insertion_time;
+        utility::datetime expiration_time;
+        utility::datetime next_visible_time;
+        std::chrono::steady_clock::time_point expires;
+        std::chrono::steady_clock::time_point visible;
+        int dequeue_count;
+    };
+
+    typedef std::list<stored_message> message_list;
+
+    struct stored_queue
+    {
+        std::map<utility::string_t, utility::string_t> metadata;
+        utility::string_t acl;
+        message_list messages;
+        std::unordered_map<utility::string_t, message_list::iterator> index;
+    };
+
+    struct response_data
+    {
+        response_data();
+
+        unsigned short status;
+        std::map<utility::string_t, utility::string_t> headers;
+        utility::string_t body;
+    };
+
+    typedef std::map<utility::string_t, utility::string_t> query_map;
+
+    typedef std::multimap<std::chrono::steady_clock::time_point, std::pair<web::http::http_request, web::http::http_response>> reply_schedule;
+
+    local_queue_service(const local_queue_service&);
+    local_queue_service& operator=(const local_queue_service&);
+
+    void handle(web::http::http_request request);
+    void reply_loop();
+    response_data dispatch(web::http::http_request& request);
+
+    response_data list_queues(const query_map& query);
+    response_data queue_operation(web::http::http_request& request, const std::vector<utility::string_t>& segments, const query_map& query);
+    response_data put_message(stored_queue& queue, const utility::string_t& body, const query_map& query);
+    response_data get_messages(stored_queue& queue, const query_map& query, bool peek_only);
+    response_data update_message(stored_queue& queue, const utility::string_t& id, const utility::string_t& body, const query_map& query);
+    response_data delete_message(stored_queue& queue, const utility::string_t& id, const query_map& query);
+
+    void remove_expired(stored_queue& queue, std::chrono::steady_clock::time_point now);
+    utility::string_t new_message_id();
+    utility::string_t new_pop_receipt();
+    bool roll(double rate);
+
+    static response_data error(unsigned short status, const utility::string_t& code, const utility::string_t& message);
+
+    local_queue_service_options m_options;
+    std::unique_ptr<web::http::experimental::listener::http_listener> m_listener;
+
+    std::mutex m_mutex;
+    std::map<utility::string_t, stored_queue> m_queues;
+    utility::string_t m_service_properties;
+
+    std::mutex m_random_mutex;
+    std::mt19937 m_random;
+
+    std::mutex m_replies_mutex;
+    std::condition_variable m_replies_changed;
+    reply_schedule m_replies;
+    bool m_stopping;
+    std::thread m_replier;
+
+    std::atomic<long long> m_latency_ms;
+    std::atomic<long long> m_latency_jitter_ms;
+    std::atomic<double> m_throttle_rate;
+    std::atomic<double> m_error_rate;
+
+    std::atomic<uint64_t> m_requests;
+    std::atomic<uint64_t> m_throttled;
+    std::atomic<uint64_t> m_failed;
+};
@@ -0,0 +1,248 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file()
+    : m_data(nullptr), m_size(0),
+#ifdef _WIN32
+    m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr)
+#else
+    m_file(-1)
+#endif
+{
+}
+
+mapped_file::mapped_file(const std::string& path, size_t size)
+    : mapped_file()
+{
+    m_path = path;
+    m_size = size;
+
+#ifdef _WIN32
+    m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    if (size == 0)
+    {
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart <= 0)
+        {
+            close();
+            throw std::runtime_error("Could not size " + path);
+        }
+
+        size = static_cast<size_t>(file_size.QuadPart);
+        m_size = size;
+    }
+
+    // Mapping a range larger than the file extends it with zeros.
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+    if (m_mapping == nullptr)
+    {
+        close();
+        throw std::runtime_error("Could not map " + path);
+    }
+
+    m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (m_data == nullptr)
+    {
+        close();
+        throw std::runtime_error("Could not map " + path);
+    }
+#else
+    m_file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_file < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    struct stat status;
+    if (fstat(m_file, &status) != 0 || (size == 0 && status.st_size <= 0))
+    {
+        close();
+        throw std::runtime_error("Could not size " + path);
+    }
+
+    if (size == 0)
+    {
+        size = static_cast<size_t>(status.st_size);
+        m_size = size;
+    }
+    else if (static_cast<size_t>(status.st_size) < size && ftruncate(m_file, static_cast<off_t>(size)) != 0)
+    {
+        close();
+        throw std::runtime_error("Could not size " + path);
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close();
+        throw std::runtime_error("Could not map " + path);
+    }
+
+    m_data = static_cast<uint8_t*>(mapping);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+uint8_t* mapped_file::data() const
+{
+    return m_data;
+}
+
+size_t mapped_file::size() const
+{
+    return m_size;
+}
+
+const std::string& mapped_file::path() const
+{
+    return m_path;
+}
+
+void mapped_file::flush()
+{
+    if (m_data == nullptr)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    FlushViewOfFile(m_data, m_size);
+    FlushFileBuffers(m_file);
+#else
+    msync(m_data, m_size, MS_SYNC);
+#endif
+}
+
+void mapped_file::close()
+{
+#ifdef _WIN32
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+    }
+
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+    }
+
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_data != nullptr)
+    {
+        munmap(m_data, m_size);
+    }
+
+    if (m_file >= 0)
+    {
+        ::close(m_file);
+    }
+
+    m_file = -1;
+#endif
+
+    m_data = nullptr;
+}
+
+void mapped_file::remove()
+{
+    close();
+    if (!m_path.empty())
+    {
+        std::remove(m_path.c_str());
+    }
+}
+
+std::vector<std::string> mapped_file::list(const std::string& directory, const std::string& prefix)
+{
+    std::vector<std::string> paths;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE search = FindFirstFileA((directory + "\\" + prefix + "*").c_str(), &entry);
+    if (search != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            paths.push_back(directory + "\\" + entry.cFileName);
+        } while (FindNextFileA(search, &entry));
+
+        FindClose(search);
+    }
+#else
+    DIR* handle = opendir(directory.c_str());
+    if (handle != nullptr)
+    {
+        while (struct dirent* entry = readdir(handle))
+        {
+            std::string name(entry->d_name);
+            if (name.compare(0, prefix.size(), prefix) == 0)
+            {
+                paths.push_back(directory + "/" + name);
+            }
+        }
+
+        closedir(handle);
+    }
+#endif
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+void mapped_file::create_directory(const std::string& directory)
+{
+#ifdef _WIN32
+    if (!CreateDirectoryA(directory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+#else
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+#endif
+    {
+        throw std::runtime_error("Could not create " + directory);
+    }
+}
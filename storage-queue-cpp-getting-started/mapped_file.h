@@ -0,0 +1,76 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+///
+/// A file mapped read-write into memory. Opening a file that is shorter than the requested
+/// size extends it with zeros. Changes reach the file when the operating system writes the
+/// pages back, which survives the process crashing; flush() forces them to disk.
+///
+class mapped_file
+{
+public:
+    mapped_file();
+
+    ///
+    /// Throws std::runtime_error if the file can't be created or mapped. A size of zero maps an
+    /// existing file at its current size.
+    ///
+    mapped_file(const std::string& path, size_t size);
+
+    ~mapped_file();
+
+    uint8_t* data() const;
+    size_t size() const;
+    const std::string& path() const;
+
+    void flush();
+
+    // Unmaps and closes the file.
+    void close();
+
+    // Closes the file if it is open and deletes it.
+    void remove();
+
+    // Paths of the files in a directory whose names start with the prefix, sorted by name.
+    static std::vector<std::string> list(const std::string& directory, const std::string& prefix);
+
+    static void create_directory(const std::string& directory);
+
+private:
+    mapped_file(const mapped_file&);
+    mapped_file& operator=(const mapped_file&);
+
+    std::string m_path;
+    uint8_t* m_data;
+    size_t m_size;
+
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#else
+    int m_file;
+#endif
+};
@@ -0,0 +1,141 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "message_batch.h"
+#include "base64_codec.h"
+
+#include <stdexcept>
+
+using namespace azure::storage;
+
+utility::string_t message_batch::text_view::to_string() const
+{
+    return utility::string_t(data, size);
+}
+
+message_batch::message_batch()
+{
+}
+
+void message_batch::receive(cloud_queue& queue, size_t count, std::chrono::seconds visibility_timeout, queue_request_options& options, operation_context context)
+{
+    clear();
+
+    std::vector<cloud_queue_message> messages = queue.get_messages(count, visibility_timeout, options, context);
+    for (auto it = messages.begin(); it != messages.end(); ++it)
+    {
+        append(*it);
+    }
+}
+
+void message_batch::append(const cloud_queue_message& message)
+{
+    m_ids.push_back(store(message.id()));
+    m_pop_receipts.push_back(store(message.pop_receipt()));
+    m_contents.push_back(message.content_as_string());
+    m_dequeue_counts.push_back(message.dequeue_count());
+}
+
+void message_batch::clear()
+{
+    m_text.clear();
+    m_ids.clear();
+    m_pop_receipts.clear();
+    m_contents.clear();
+    m_dequeue_counts.clear();
+}
+
+size_t message_batch::size() const
+{
+    return m_ids.size();
+}
+
+bool message_batch::empty() const
+{
+    return m_ids.empty();
+}
+
+message_batch::text_view message_batch::id(size_t index) const
+{
+    return view(m_ids.at(index));
+}
+
+message_batch::text_view message_batch::pop_receipt(size_t index) const
+{
+    return view(m_pop_receipts.at(index));
+}
+
+message_batch::text_view message_batch::content(size_t index) const
+{
+    const utility::string_t& text = m_contents.at(index);
+    text_view result = { text.data(), text.size() };
+    return result;
+}
+
+int message_batch::dequeue_count(size_t index) const
+{
+    return m_dequeue_counts.at(index);
+}
+
+size_t message_batch::binary_content(size_t index, std::vector<uint8_t>& buffer) const
+{
+    text_view text = content(index);
+
+#ifdef _UTF16_STRINGS
+    m_narrow.resize(text.size);
+    for (size_t i = 0; i < text.size; i++)
+    {
+        // Anything outside ASCII would otherwise be truncated into a valid character.
+        m_narrow[i] = text.data[i] < 0x80 ? static_cast<char>(text.data[i]) : '\x80';
+    }
+    const char* characters = m_narrow.data();
+#else
+    const char* characters = text.data;
+#endif
+
+    buffer.resize(base64_codec::max_decoded_size(text.size));
+    size_t size = base64_codec::decode(characters, text.size, buffer.data());
+    buffer.resize(size);
+    return size;
+}
+
+cloud_queue_message message_batch::message(size_t index) const
+{
+    return cloud_queue_message(id(index).to_string(), pop_receipt(index).to_string());
+}
+
+size_t message_batch::capacity_bytes() const
+{
+    return m_text.capacity() * sizeof(utility::char_t)
+        + (m_ids.capacity() + m_pop_receipts.capacity()) * sizeof(range)
+        + m_contents.capacity() * sizeof(utility::string_t)
+        + m_dequeue_counts.capacity() * sizeof(int);
+}
+
+message_batch::range message_batch::store(const utility::string_t& value)
+{
+    range stored = { m_text.size(), value.size() };
+    m_text.insert(m_text.end(), value.begin(), value.end());
+    return stored;
+}
+
+message_batch::text_view message_batch::view(const range& value) const
+{
+    text_view result = { m_text.data() + value.offset, value.size };
+    return result;
+}
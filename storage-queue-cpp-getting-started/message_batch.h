@@ -0,0 +1,101 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// A batch of received messages stored column by column: ids and pop receipts are packed
+/// into one character arena and addressed by offset, with one small array per field.
+/// receive() resets the batch and refills the same storage, so once the arena has grown to
+/// the largest batch seen, storing them allocates nothing.
+///
+/// Contents are not copied into the arena. content_as_string() already returns a freshly
+/// allocated string, which the client library gives no way to avoid, so the batch keeps that
+/// string by moving it in. Receiving therefore still allocates inside the client library,
+/// for the message objects get_messages builds and for each content string; what the batch
+/// saves is the per-message copies a handler would otherwise make, and binary content is
+/// decoded into a buffer the caller reuses instead of a new vector per content_as_binary().
+///
+class message_batch
+{
+public:
+    // A run of characters inside the batch, valid until the next receive() or clear().
+    struct text_view
+    {
+        const utility::char_t* data;
+        size_t size;
+
+        utility::string_t to_string() const;
+    };
+
+    message_batch();
+
+    // Receives up to count messages (at most 32) into the batch, replacing its contents.
+    void receive(cloud_queue& queue, size_t count, std::chrono::seconds visibility_timeout, queue_request_options& options, operation_context context);
+
+    // Adds one message; receive() calls this for each message it gets.
+    void append(const cloud_queue_message& message);
+
+    // Empties the batch but keeps its storage.
+    void clear();
+
+    size_t size() const;
+    bool empty() const;
+
+    text_view id(size_t index) const;
+    text_view pop_receipt(size_t index) const;
+    text_view content(size_t index) const;
+    int dequeue_count(size_t index) const;
+
+    ///
+    /// Decodes base64 binary content into buffer, resizing it, and returns the size. Reusing
+    /// the buffer across messages avoids allocating once it is large enough.
+    ///
+    size_t binary_content(size_t index, std::vector<uint8_t>& buffer) const;
+
+    // A message with the id and pop receipt of the entry, for delete_message or update_message.
+    cloud_queue_message message(size_t index) const;
+
+    // Bytes of storage currently reserved by the batch, not counting the content strings.
+    size_t capacity_bytes() const;
+
+private:
+    struct range
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    range store(const utility::string_t& value);
+    text_view view(const range& value) const;
+
+    std::vector<utility::char_t> m_text;
+    std::vector<range> m_ids;
+    std::vector<range> m_pop_receipts;
+    std::vector<utility::string_t> m_contents;
+    std::vector<int> m_dequeue_counts;
+
+#ifdef _UTF16_STRINGS
+    mutable std::string m_narrow;
+#endif
+};
@@ -0,0 +1,300 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "message_codec.h"
+#include "base64_codec.h"
+#include "message_packing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef AZURESTORAGESAMPLES_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef AZURESTORAGESAMPLES_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace azure::storage;
+
+static const uint8_t codec_magic_0 = 'Q';
+static const uint8_t codec_magic_1 = 'Z';
+
+const size_t message_codec::header_size;
+const size_t message_codec::max_decoded_size;
+
+///
+/// CPU time the calling thread has used, so the codec counters don't include time the thread
+/// spent descheduled.
+///
+static uint64_t thread_cpu_microseconds()
+{
+#ifdef _WIN32
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time))
+    {
+        return 0;
+    }
+
+    // FILETIME counts 100 nanosecond intervals.
+    uint64_t kernel = (static_cast<uint64_t>(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+    uint64_t user = (static_cast<uint64_t>(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+    return (kernel + user) / 10;
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0)
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+#endif
+}
+
+message_codec_options::message_codec_options()
+    : min_compress_size(256), zstd_threshold(8 * 1024), zstd_level(3)
+{
+}
+
+double message_codec_stats::compression_ratio() const
+{
+    return encoded_bytes == 0 ? 1.0 : static_cast<double>(raw_bytes) / static_cast<double>(encoded_bytes);
+}
+
+message_codec::message_codec(const message_codec_options& options)
+    : m_options(options), m_encoded_messages(0), m_compressed_messages(0), m_raw_bytes(0), m_encoded_bytes(0),
+    m_encode_microseconds(0), m_decoded_messages(0), m_decode_microseconds(0)
+{
+}
+
+bool message_codec::is_available(message_codec_type type)
+{
+    switch (type)
+    {
+    case message_codec_type::identity:
+        return true;
+#ifdef AZURESTORAGESAMPLES_HAVE_LZ4
+    case message_codec_type::lz4:
+        return true;
+#endif
+#ifdef AZURESTORAGESAMPLES_HAVE_ZSTD
+    case message_codec_type::zstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool message_codec::is_encoded(const std::vector<uint8_t>& buffer)
+{
+    return buffer.size() > header_size && buffer[0] == codec_magic_0 && buffer[1] == codec_magic_1 &&
+        buffer[2] <= static_cast<uint8_t>(message_codec_type::zstd);
+}
+
+message_codec_type message_codec::select(size_t size) const
+{
+    if (size < m_options.min_compress_size)
+    {
+        return message_codec_type::identity;
+    }
+
+    // Prefer the codec for the size class, then whichever one this build has.
+    message_codec_type preferred = size < m_options.zstd_threshold ? message_codec_type::lz4 : message_codec_type::zstd;
+    message_codec_type fallback = preferred == message_codec_type::lz4 ? message_codec_type::zstd : message_codec_type::lz4;
+    if (is_available(preferred))
+    {
+        return preferred;
+    }
+
+    return is_available(fallback) ? fallback : message_codec_type::identity;
+}
+
+std::vector<uint8_t> message_codec::encode(const uint8_t* data, size_t size)
+{
+    uint64_t start = thread_cpu_microseconds();
+
+    std::vector<uint8_t> output;
+    output.push_back(codec_magic_0);
+    output.push_back(codec_magic_1);
+    output.push_back(static_cast<uint8_t>(message_codec_type::identity));
+    message_packing::append_varint(output, size);
+    size_t payload_offset = output.size();
+
+    message_codec_type type = select(size);
+    if (type != message_codec_type::identity && compress(type, data, size, output) && output.size() - payload_offset < size)
+    {
+        output[2] = static_cast<uint8_t>(type);
+        m_compressed_messages++;
+    }
+    else
+    {
+        output.resize(payload_offset);
+        output.insert(output.end(), data, data + size);
+    }
+
+    m_encoded_messages++;
+    m_raw_bytes += size;
+    m_encoded_bytes += output.size();
+    m_encode_microseconds += thread_cpu_microseconds() - start;
+    return output;
+}
+
+std::vector<uint8_t> message_codec::encode(const std::vector<uint8_t>& data)
+{
+    return encode(data.data(), data.size());
+}
+
+std::vector<uint8_t> message_codec::decode(std::vector<uint8_t> content)
+{
+    if (!is_encoded(content))
+    {
+        throw std::runtime_error("Message content has no codec header");
+    }
+
+    uint64_t start = thread_cpu_microseconds();
+
+    message_codec_type type = static_cast<message_codec_type>(content[2]);
+    size_t position = header_size;
+    uint64_t original_size = message_packing::read_varint(content.data(), content.size(), position);
+    if (original_size > max_decoded_size)
+    {
+        throw std::runtime_error("Malformed compressed message: original size too large");
+    }
+
+    const uint8_t* payload = content.data() + position;
+    size_t payload_size = content.size() - position;
+    std::vector<uint8_t> output(static_cast<size_t>(original_size));
+
+    switch (type)
+    {
+    case message_codec_type::identity:
+        if (payload_size != original_size)
+        {
+            throw std::runtime_error("Malformed compressed message: size mismatch");
+        }
+
+        std::copy(payload, payload + payload_size, output.begin());
+        break;
+#ifdef AZURESTORAGESAMPLES_HAVE_LZ4
+    case message_codec_type::lz4:
+    {
+        int result = LZ4_decompress_safe(reinterpret_cast<const char*>(payload), reinterpret_cast<char*>(output.data()),
+            static_cast<int>(payload_size), static_cast<int>(output.size()));
+        if (result < 0 || static_cast<size_t>(result) != output.size())
+        {
+            throw std::runtime_error("Malformed compressed message: LZ4 decompression failed");
+        }
+        break;
+    }
+#endif
+#ifdef AZURESTORAGESAMPLES_HAVE_ZSTD
+    case message_codec_type::zstd:
+    {
+        size_t result = ZSTD_decompress(output.data(), output.size(), payload, payload_size);
+        if (ZSTD_isError(result) || result != output.size())
+        {
+            throw std::runtime_error("Malformed compressed message: zstd decompression failed");
+        }
+        break;
+    }
+#endif
+    default:
+        throw std::runtime_error("Compressed message uses a codec this build does not include");
+    }
+
+    m_decoded_messages++;
+    m_decode_microseconds += thread_cpu_microseconds() - start;
+    return output;
+}
+
+std::vector<uint8_t> message_codec::decode_message(const cloud_queue_message& message)
+{
+    std::vector<uint8_t> content;
+    base64_codec::content(message, content);
+    return decode(content);
+}
+
+message_codec_stats message_codec::stats() const
+{
+    message_codec_stats stats;
+    stats.encoded_messages = m_encoded_messages;
+    stats.compressed_messages = m_compressed_messages;
+    stats.raw_bytes = m_raw_bytes;
+    stats.encoded_bytes = m_encoded_bytes;
+    stats.encode_time = std::chrono::microseconds(m_encode_microseconds);
+    stats.decoded_messages = m_decoded_messages;
+    stats.decode_time = std::chrono::microseconds(m_decode_microseconds);
+    return stats;
+}
+
+///
+/// Appends the compressed payload to output. Returns false if the codec is not compiled in or
+/// fails, in which case the caller falls back to the identity codec.
+///
+bool message_codec::compress(message_codec_type type, const uint8_t* data, size_t size, std::vector<uint8_t>& output) const
+{
+    switch (type)
+    {
+#ifdef AZURESTORAGESAMPLES_HAVE_LZ4
+    case message_codec_type::lz4:
+    {
+        size_t offset = output.size();
+        if (size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+        {
+            return false;
+        }
+
+        output.resize(offset + static_cast<size_t>(LZ4_compressBound(static_cast<int>(size))));
+        int result = LZ4_compress_default(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(output.data() + offset),
+            static_cast<int>(size), static_cast<int>(output.size() - offset));
+        if (result <= 0)
+        {
+            return false;
+        }
+
+        output.resize(offset + static_cast<size_t>(result));
+        return true;
+    }
+#endif
+#ifdef AZURESTORAGESAMPLES_HAVE_ZSTD
+    case message_codec_type::zstd:
+    {
+        size_t offset = output.size();
+        output.resize(offset + ZSTD_compressBound(size));
+        size_t result = ZSTD_compress(output.data() + offset, output.size() - offset, data, size, m_options.zstd_level);
+        if (ZSTD_isError(result))
+        {
+            return false;
+        }
+
+        output.resize(offset + result);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
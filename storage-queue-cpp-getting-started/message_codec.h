@@ -0,0 +1,117 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace azure::storage;
+
+enum class message_codec_type : uint8_t
+{
+    identity = 0,
+    lz4 = 1,
+    zstd = 2
+};
+
+struct message_codec_options
+{
+    message_codec_options();
+
+    // Payloads smaller than this are stored as is; compressing them rarely pays for the header.
+    size_t min_compress_size;
+
+    // Payloads from min_compress_size up to this size use LZ4; larger ones use zstd.
+    size_t zstd_threshold;
+
+    int zstd_level;
+};
+
+struct message_codec_stats
+{
+    uint64_t encoded_messages;
+    uint64_t compressed_messages;
+    uint64_t raw_bytes;
+    uint64_t encoded_bytes;
+    // CPU time the encoding and decoding threads spent in the codec.
+    std::chrono::microseconds encode_time;
+    uint64_t decoded_messages;
+    std::chrono::microseconds decode_time;
+
+    // Raw bytes per encoded byte; 1.0 when nothing has been encoded.
+    double compression_ratio() const;
+};
+
+///
+/// Compresses message payloads behind a small header:
+///
+///     'Q' 'Z' codec(1) original_size(varint) payload
+///
+/// Every encoded payload carries the header, including ones stored uncompressed under the
+/// identity codec, so decode never has to guess whether content is raw.
+/// The codec is picked per payload from its size. LZ4 and zstd are only compiled in when
+/// CMake finds the libraries (AZURESTORAGESAMPLES_HAVE_LZ4, AZURESTORAGESAMPLES_HAVE_ZSTD);
+/// without them, or when compression does not shrink the payload, the identity codec is used.
+/// Counters are updated atomically, so one codec can be shared between threads.
+///
+class message_codec
+{
+public:
+    static const size_t header_size = 3;
+
+    // Upper bound on the original size a header may claim, so a corrupt message can't make
+    // decode allocate arbitrarily much.
+    static const size_t max_decoded_size = 16 * 1024 * 1024;
+
+    explicit message_codec(const message_codec_options& options = message_codec_options());
+
+    static bool is_available(message_codec_type type);
+
+    // True if the buffer starts with a codec header naming a known codec.
+    static bool is_encoded(const std::vector<uint8_t>& buffer);
+
+    // The codec encode would try for a payload of this size.
+    message_codec_type select(size_t size) const;
+
+    std::vector<uint8_t> encode(const uint8_t* data, size_t size);
+    std::vector<uint8_t> encode(const std::vector<uint8_t>& data);
+
+    // Throws std::runtime_error on content without a codec header, corrupt content or a codec
+    // this build doesn't include.
+    std::vector<uint8_t> decode(std::vector<uint8_t> content);
+    std::vector<uint8_t> decode_message(const cloud_queue_message& message);
+
+    message_codec_stats stats() const;
+
+private:
+    message_codec(const message_codec&);
+    message_codec& operator=(const message_codec&);
+
+    bool compress(message_codec_type type, const uint8_t* data, size_t size, std::vector<uint8_t>& output) const;
+
+    message_codec_options m_options;
+
+    std::atomic<uint64_t> m_encoded_messages;
+    std::atomic<uint64_t> m_compressed_messages;
+    std::atomic<uint64_t> m_raw_bytes;
+    std::atomic<uint64_t> m_encoded_bytes;
+    std::atomic<uint64_t> m_encode_microseconds;
+    std::atomic<uint64_t> m_decoded_messages;
+    std::atomic<uint64_t> m_decode_microseconds;
+};
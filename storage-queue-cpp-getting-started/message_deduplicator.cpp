@@ -0,0 +1,239 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "message_deduplicator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+static const uint64_t fnv_offset_basis = 14695981039346656037ull;
+static const uint64_t fnv_prime = 1099511628211ull;
+
+static uint64_t fnv1a(uint64_t hash, const std::string& data)
+{
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * fnv_prime;
+    }
+
+    return hash;
+}
+
+// Finalizer from MurmurHash3, used to derive the second Bloom filter hash from the key.
+static uint64_t mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+message_deduplicator_options::message_deduplicator_options()
+    : capacity(65536), shard_count(16), filter_capacity(0), false_positive_rate(0.001)
+{
+}
+
+message_deduplicator::message_deduplicator()
+    : message_deduplicator(message_deduplicator_options())
+{
+}
+
+message_deduplicator::message_deduplicator(const message_deduplicator_options& options)
+    : m_options(options), m_filter_count(0), m_lookups(0), m_cache_hits(0), m_filter_hits(0)
+{
+    if (m_options.filter_capacity > 0 && (m_options.false_positive_rate <= 0.0 || m_options.false_positive_rate >= 1.0))
+    {
+        throw std::invalid_argument("The false positive rate must be between 0 and 1");
+    }
+
+    m_options.shard_count = std::max<size_t>(m_options.shard_count, 1);
+    m_shard_capacity = std::max<size_t>(m_options.capacity / m_options.shard_count, 1);
+    for (size_t i = 0; i < m_options.shard_count; i++)
+    {
+        m_shards.push_back(std::unique_ptr<shard>(new shard()));
+    }
+
+    if (m_options.filter_capacity == 0)
+    {
+        m_filter_hashes = 0;
+        return;
+    }
+
+    // Standard sizing for n entries at false positive rate p: m = -n ln p / (ln 2)^2 bits and
+    // k = (m / n) ln 2 hashes. Lookups check both generations, so each gets half the rate.
+    double ln2 = std::log(2.0);
+    double rate = m_options.false_positive_rate / 2.0;
+    double bits = -static_cast<double>(m_options.filter_capacity) * std::log(rate) / (ln2 * ln2);
+    size_t words = static_cast<size_t>(std::ceil(bits / 64.0));
+    m_filter_current.assign(words, 0);
+    m_filter_previous.assign(words, 0);
+    m_filter_hashes = std::max(1u, static_cast<unsigned int>(std::lround(bits / static_cast<double>(m_options.filter_capacity) * ln2)));
+}
+
+bool message_deduplicator::is_duplicate(const cloud_queue_message& message)
+{
+    if (message.dequeue_count() <= 1)
+    {
+        return false;
+    }
+
+    ++m_lookups;
+    uint64_t id = key(message);
+    {
+        shard& entries = shard_for(id);
+        std::lock_guard<std::mutex> lock(entries.mutex);
+        auto found = entries.index.find(id);
+        if (found != entries.index.end())
+        {
+            entries.order.splice(entries.order.begin(), entries.order, found->second);
+            ++m_cache_hits;
+            return true;
+        }
+    }
+
+    // The filter can report messages it has never seen, so a hit there is only counted.
+    if (m_options.filter_capacity > 0 && filter_contains(id))
+    {
+        ++m_filter_hits;
+    }
+
+    return false;
+}
+
+void message_deduplicator::record(const cloud_queue_message& message)
+{
+    uint64_t id = key(message);
+    uint64_t evicted = 0;
+    bool has_evicted = false;
+    {
+        shard& entries = shard_for(id);
+        std::lock_guard<std::mutex> lock(entries.mutex);
+        auto found = entries.index.find(id);
+        if (found != entries.index.end())
+        {
+            entries.order.splice(entries.order.begin(), entries.order, found->second);
+            return;
+        }
+
+        entries.order.push_front(id);
+        entries.index[id] = entries.order.begin();
+        if (entries.order.size() > m_shard_capacity)
+        {
+            evicted = entries.order.back();
+            has_evicted = true;
+            entries.index.erase(evicted);
+            entries.order.pop_back();
+        }
+    }
+
+    if (has_evicted && m_options.filter_capacity > 0)
+    {
+        add_to_filter(evicted);
+    }
+}
+
+uint64_t message_deduplicator::lookup_count() const
+{
+    return m_lookups;
+}
+
+uint64_t message_deduplicator::cache_hit_count() const
+{
+    return m_cache_hits;
+}
+
+uint64_t message_deduplicator::filter_hit_count() const
+{
+    return m_filter_hits;
+}
+
+double message_deduplicator::hit_rate() const
+{
+    uint64_t lookups = m_lookups;
+    if (lookups == 0)
+    {
+        return 0.0;
+    }
+
+    return static_cast<double>(m_cache_hits) / static_cast<double>(lookups);
+}
+
+uint64_t message_deduplicator::key(const cloud_queue_message& message)
+{
+    // The separator keeps an id/content split from colliding with a different split of the
+    // same bytes.
+    uint64_t hash = fnv1a(fnv_offset_basis, utility::conversions::to_utf8string(message.id()));
+    hash = (hash ^ 0xff) * fnv_prime;
+    return fnv1a(hash, utility::conversions::to_utf8string(message.content_as_string()));
+}
+
+message_deduplicator::shard& message_deduplicator::shard_for(uint64_t key)
+{
+    return *m_shards[static_cast<size_t>(mix(key) % m_shards.size())];
+}
+
+void message_deduplicator::add_to_filter(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_filter_mutex);
+    if (m_filter_count >= m_options.filter_capacity)
+    {
+        m_filter_previous.swap(m_filter_current);
+        std::fill(m_filter_current.begin(), m_filter_current.end(), 0);
+        m_filter_count = 0;
+    }
+
+    uint64_t bit_count = static_cast<uint64_t>(m_filter_current.size()) * 64;
+    uint64_t step = mix(key) | 1;
+    for (unsigned int i = 0; i < m_filter_hashes; i++)
+    {
+        uint64_t bit = (key + i * step) % bit_count;
+        m_filter_current[static_cast<size_t>(bit / 64)] |= uint64_t(1) << (bit % 64);
+    }
+
+    m_filter_count++;
+}
+
+bool message_deduplicator::filter_contains(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_filter_mutex);
+    return test_bits(m_filter_current, key, m_filter_hashes) || test_bits(m_filter_previous, key, m_filter_hashes);
+}
+
+///
+/// Double hashing: the i-th probe is key + i * step, with an odd step derived from the key.
+///
+bool message_deduplicator::test_bits(const std::vector<uint64_t>& bits, uint64_t key, unsigned int hash_count)
+{
+    uint64_t bit_count = static_cast<uint64_t>(bits.size()) * 64;
+    uint64_t step = mix(key) | 1;
+    for (unsigned int i = 0; i < hash_count; i++)
+    {
+        uint64_t bit = (key + i * step) % bit_count;
+        if ((bits[static_cast<size_t>(bit / 64)] & (uint64_t(1) << (bit % 64))) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
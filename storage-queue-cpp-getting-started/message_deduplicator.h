@@ -0,0 +1,122 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Settings for message_deduplicator.
+///
+struct message_deduplicator_options
+{
+    message_deduplicator_options();
+
+    // Handled messages remembered exactly, across all shards.
+    size_t capacity;
+
+    // Independently locked parts of the exact cache; more shards mean less contention.
+    size_t shard_count;
+
+    // Messages evicted from the exact cache that the Bloom filter holds before it starts
+    // forgetting the oldest of them. 0, the default, leaves the filter out. The filter never
+    // changes a decision; it only counts redeliveries the cache has already forgotten, which
+    // helps size capacity.
+    size_t filter_capacity;
+
+    // Chance that the Bloom filter reports a message it has never seen.
+    double false_positive_rate;
+};
+
+///
+/// Remembers which messages have been handled, so a message that comes back because its
+/// visibility timeout lapsed before it was deleted isn't handled twice. Messages are keyed on
+/// their id and a hash of their content.
+///
+/// Recent messages are kept in a sharded LRU cache, which alone decides that a message is a
+/// duplicate. Only messages with a dequeue count above one are looked up.
+///
+/// With filter_capacity set, messages evicted from the cache go into a Bloom filter, which
+/// remembers many more in little memory but can mistake a new message for a handled one. A
+/// filter hit is counted but the message is handled anyway, since a false positive would
+/// otherwise drop a retry whose handler never succeeded. The filter is split into two
+/// generations that are cleared in turn, so it forgets the oldest messages instead of
+/// filling up.
+///
+/// Thread-safe. One instance can be shared between consumers of the same queue.
+///
+class message_deduplicator
+{
+public:
+    message_deduplicator();
+    explicit message_deduplicator(const message_deduplicator_options& options);
+
+    // True if the message was redelivered after being handled, according to the exact cache.
+    bool is_duplicate(const cloud_queue_message& message);
+
+    // Records that the message was handled.
+    void record(const cloud_queue_message& message);
+
+    // Redelivered messages looked up, and how many of them were found in the cache, or only in
+    // the filter. Filter-only hits are probable duplicates that are handled again; they stay
+    // at zero without a filter.
+    uint64_t lookup_count() const;
+    uint64_t cache_hit_count() const;
+    uint64_t filter_hit_count() const;
+
+    // Share of lookups the cache confirmed as duplicates.
+    double hit_rate() const;
+
+    static uint64_t key(const cloud_queue_message& message);
+
+private:
+    struct shard
+    {
+        std::mutex mutex;
+        std::list<uint64_t> order;
+        std::unordered_map<uint64_t, std::list<uint64_t>::iterator> index;
+    };
+
+    message_deduplicator(const message_deduplicator&);
+    message_deduplicator& operator=(const message_deduplicator&);
+
+    shard& shard_for(uint64_t key);
+    void add_to_filter(uint64_t key);
+    bool filter_contains(uint64_t key);
+    static bool test_bits(const std::vector<uint64_t>& bits, uint64_t key, unsigned int hash_count);
+
+    message_deduplicator_options m_options;
+    size_t m_shard_capacity;
+    std::vector<std::unique_ptr<shard>> m_shards;
+
+    std::mutex m_filter_mutex;
+    std::vector<uint64_t> m_filter_current;
+    std::vector<uint64_t> m_filter_previous;
+    size_t m_filter_count;
+    unsigned int m_filter_hashes;
+
+    std::atomic<uint64_t> m_lookups;
+    std::atomic<uint64_t> m_cache_hits;
+    std::atomic<uint64_t> m_filter_hits;
+};
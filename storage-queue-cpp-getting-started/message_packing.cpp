@@ -0,0 +1,491 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "message_packing.h"
+#include "base64_codec.h"
+
+#include <stdexcept>
+
+using namespace azure::storage;
+
+static const uint8_t frame_magic_0 = 'Q';
+static const uint8_t frame_magic_1 = 'P';
+static const uint8_t frame_version = 1;
+
+const size_t message_packing::max_frame_size;
+const size_t message_packing::header_size;
+
+bool message_packing::is_packed(const std::vector<uint8_t>& buffer)
+{
+    return buffer.size() > header_size && buffer[0] == frame_magic_0 && buffer[1] == frame_magic_1 && buffer[2] == frame_version;
+}
+
+size_t message_packing::varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+void message_packing::append_varint(std::vector<uint8_t>& buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t message_packing::read_varint(const uint8_t* data, size_t size, size_t& position)
+{
+    uint64_t value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        if (position >= size)
+        {
+            throw std::runtime_error("Malformed packed message: truncated length");
+        }
+
+        uint8_t byte = data[position++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+
+    throw std::runtime_error("Malformed packed message: length too long");
+}
+
+std::string packed_message_view::record::to_string() const
+{
+    return std::string(reinterpret_cast<const char*>(data), size);
+}
+
+packed_message_view::const_iterator::const_iterator()
+    : m_data(nullptr), m_size(0), m_position(0), m_remaining(0)
+{
+    m_current.data = nullptr;
+    m_current.size = 0;
+}
+
+packed_message_view::const_iterator::const_iterator(const uint8_t* data, size_t size, size_t position, size_t remaining)
+    : m_data(data), m_size(size), m_position(position), m_remaining(remaining)
+{
+    m_current.data = nullptr;
+    m_current.size = 0;
+    parse();
+}
+
+void packed_message_view::const_iterator::parse()
+{
+    if (m_remaining == 0)
+    {
+        m_data = nullptr;
+        m_position = 0;
+        return;
+    }
+
+    uint64_t length = message_packing::read_varint(m_data, m_size, m_position);
+    if (length > m_size - m_position)
+    {
+        throw std::runtime_error("Malformed packed message: record exceeds frame");
+    }
+
+    m_current.data = m_data + m_position;
+    m_current.size = static_cast<size_t>(length);
+    m_position += m_current.size;
+    m_remaining--;
+}
+
+const packed_message_view::record& packed_message_view::const_iterator::operator*() const
+{
+    return m_current;
+}
+
+const packed_message_view::record* packed_message_view::const_iterator::operator->() const
+{
+    return &m_current;
+}
+
+packed_message_view::const_iterator& packed_message_view::const_iterator::operator++()
+{
+    // The end iterator has a null data pointer; the last record moves there on increment.
+    if (m_remaining == 0)
+    {
+        m_data = nullptr;
+        m_position = 0;
+        m_current.data = nullptr;
+        m_current.size = 0;
+    }
+    else
+    {
+        parse();
+    }
+
+    return *this;
+}
+
+packed_message_view::const_iterator packed_message_view::const_iterator::operator++(int)
+{
+    const_iterator previous(*this);
+    ++(*this);
+    return previous;
+}
+
+bool packed_message_view::const_iterator::operator==(const const_iterator& other) const
+{
+    return m_data == other.m_data && m_current.data == other.m_current.data;
+}
+
+bool packed_message_view::const_iterator::operator!=(const const_iterator& other) const
+{
+    return !(*this == other);
+}
+
+packed_message_view::packed_message_view()
+    : m_frame(nullptr), m_records_offset(0), m_count(0)
+{
+}
+
+packed_message_view::packed_message_view(std::vector<uint8_t> buffer)
+    : m_frame(nullptr), m_records_offset(0), m_count(0)
+{
+    m_buffer.swap(buffer);
+    parse();
+}
+
+packed_message_view::packed_message_view(const std::vector<uint8_t>* frame)
+    : m_frame(frame), m_records_offset(0), m_count(0)
+{
+    parse();
+}
+
+packed_message_view packed_message_view::from_message(const cloud_queue_message& message)
+{
+    std::vector<uint8_t> content;
+    base64_codec::content(message, content);
+    return packed_message_view(std::move(content));
+}
+
+packed_message_view packed_message_view::from_message(const cloud_queue_message& message, std::vector<uint8_t>& buffer)
+{
+    base64_codec::content(message, buffer);
+    return packed_message_view(&buffer);
+}
+
+packed_message_view packed_message_view::from_message(const cloud_queue_message& message, message_codec& codec)
+{
+    return packed_message_view(codec.decode_message(message));
+}
+
+size_t packed_message_view::size() const
+{
+    return m_count;
+}
+
+bool packed_message_view::empty() const
+{
+    return m_count == 0;
+}
+
+packed_message_view::const_iterator packed_message_view::begin() const
+{
+    if (m_count == 0)
+    {
+        return end();
+    }
+
+    const std::vector<uint8_t>& data = frame();
+    return const_iterator(data.data(), data.size(), m_records_offset, m_count);
+}
+
+packed_message_view::const_iterator packed_message_view::end() const
+{
+    return const_iterator();
+}
+
+void packed_message_view::parse()
+{
+    const std::vector<uint8_t>& data = frame();
+    if (!message_packing::is_packed(data))
+    {
+        throw std::runtime_error("Message content is not a packed frame");
+    }
+
+    size_t position = message_packing::header_size;
+    m_count = static_cast<size_t>(message_packing::read_varint(data.data(), data.size(), position));
+    m_records_offset = position;
+
+    // A record takes at least one byte, which bounds the count a well-formed frame can claim.
+    if (m_count > data.size() - m_records_offset)
+    {
+        throw std::runtime_error("Malformed packed message: record count exceeds frame");
+    }
+}
+
+const std::vector<uint8_t>& packed_message_view::frame() const
+{
+    return m_frame != nullptr ? *m_frame : m_buffer;
+}
+
+queue_message_packer::queue_message_packer(queue_producer& producer, size_t max_frame_size, std::chrono::milliseconds max_delay, std::shared_ptr<message_codec> codec)
+    : m_producer(producer), m_max_frame_size(std::min(max_frame_size == 0 ? message_codec::max_decoded_size : max_frame_size, codec ? message_codec::max_decoded_size : message_packing::max_frame_size)),
+    m_codec(codec), m_max_delay(max_delay), m_count(0), m_sending(0), m_stopping(false), m_records_added(0), m_messages_sent(0), m_messages_failed(0)
+{
+    m_timer = std::thread(&queue_message_packer::timer_loop, this);
+}
+
+queue_message_packer::~queue_message_packer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_condition.notify_all();
+    }
+    m_timer.join();
+
+    flush();
+}
+
+void queue_message_packer::add(const uint8_t* data, size_t size)
+{
+    // A record must fit in a frame on its own even if it does not compress.
+    size_t encoded_size = message_packing::varint_size(size) + size;
+    if (message_packing::header_size + message_packing::varint_size(1) + encoded_size > std::min(m_max_frame_size, message_packing::max_frame_size))
+    {
+        throw std::invalid_argument("Record is larger than the maximum packed message size");
+    }
+
+    std::vector<uint8_t> full;
+    size_t full_count = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t frame_size = message_packing::header_size + message_packing::varint_size(m_count + 1) + m_records.size() + encoded_size;
+        if (frame_size > m_max_frame_size)
+        {
+            take_locked(full, full_count);
+        }
+
+        if (m_count == 0)
+        {
+            m_oldest = std::chrono::steady_clock::now();
+            m_condition.notify_all();
+        }
+
+        message_packing::append_varint(m_records, size);
+        m_records.insert(m_records.end(), data, data + size);
+        m_count++;
+        m_records_added++;
+    }
+
+    // Sent outside the lock, so a full producer window only holds back this caller.
+    if (full_count != 0)
+    {
+        send_taken(full, full_count);
+    }
+}
+
+void queue_message_packer::add(const std::string& record)
+{
+    add(reinterpret_cast<const uint8_t*>(record.data()), record.size());
+}
+
+void queue_message_packer::flush()
+{
+    std::vector<uint8_t> records;
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        take_locked(records, count);
+    }
+
+    if (count != 0)
+    {
+        send_taken(records, count);
+    }
+
+    // Frames other threads have taken must reach the producer before it is flushed.
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_sending == 0; });
+    }
+
+    m_producer.flush();
+}
+
+uint64_t queue_message_packer::records_added() const
+{
+    return m_records_added;
+}
+
+uint64_t queue_message_packer::messages_sent() const
+{
+    return m_messages_sent;
+}
+
+uint64_t queue_message_packer::messages_failed() const
+{
+    return m_messages_failed;
+}
+
+///
+/// Moves the buffered records out so they can be sent without holding m_mutex. Returns false
+/// if nothing is buffered. Each successful call must be followed by send_taken.
+///
+bool queue_message_packer::take_locked(std::vector<uint8_t>& records, size_t& count)
+{
+    if (m_count == 0)
+    {
+        return false;
+    }
+
+    records.swap(m_records);
+    m_records.clear();
+    m_records.reserve(records.capacity());
+    count = m_count;
+    m_count = 0;
+    m_sending++;
+    return true;
+}
+
+///
+/// Frames taken records and hands them to the producer, which blocks while its window is
+/// full. Only the thread that filled the frame waits; other callers keep adding records.
+///
+void queue_message_packer::send_taken(const std::vector<uint8_t>& records, size_t count)
+{
+    try
+    {
+        send_records(records.data(), records.size(), count);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sending--;
+        m_condition.notify_all();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sending--;
+    m_condition.notify_all();
+}
+
+void queue_message_packer::send_records(const uint8_t* records, size_t size, size_t count)
+{
+    std::vector<uint8_t> frame;
+    frame.reserve(message_packing::header_size + message_packing::varint_size(count) + size);
+    frame.push_back(frame_magic_0);
+    frame.push_back(frame_magic_1);
+    frame.push_back(frame_version);
+    message_packing::append_varint(frame, count);
+    frame.insert(frame.end(), records, records + size);
+
+    if (!m_codec)
+    {
+        send_frame(std::move(frame));
+        return;
+    }
+
+    std::vector<uint8_t> content = m_codec->encode(frame);
+    if (content.size() <= message_packing::max_frame_size)
+    {
+        send_frame(std::move(content));
+        return;
+    }
+
+    // A single record always fits uncompressed, and readers accept frames without a codec header.
+    if (count == 1)
+    {
+        send_frame(std::move(frame));
+        return;
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < count / 2; i++)
+    {
+        uint64_t length = message_packing::read_varint(records, size, position);
+        position += static_cast<size_t>(length);
+    }
+
+    send_records(records, position, count / 2);
+    send_records(records + position, size - position, count - count / 2);
+}
+
+void queue_message_packer::send_frame(std::vector<uint8_t> content)
+{
+    cloud_queue_message message;
+    utility::string_t encoded;
+    base64_codec::set_content(message, content.data(), content.size(), encoded);
+
+    m_producer.add_message(message, [this](const cloud_queue_message&, std::exception_ptr error)
+    {
+        if (error)
+        {
+            m_messages_failed++;
+        }
+        else
+        {
+            m_messages_sent++;
+        }
+    });
+}
+
+void queue_message_packer::timer_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        if (m_count == 0)
+        {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point due = m_oldest + m_max_delay;
+        if (std::chrono::steady_clock::now() >= due)
+        {
+            std::vector<uint8_t> records;
+            size_t count = 0;
+            take_locked(records, count);
+
+            lock.unlock();
+            try
+            {
+                send_taken(records, count);
+            }
+            catch (const std::exception&)
+            {
+                // The frame could not be encoded; its records are lost, as a failed add would be.
+                m_messages_failed++;
+            }
+            lock.lock();
+        }
+        else
+        {
+            m_condition.wait_until(lock, due);
+        }
+    }
+}
@@ -0,0 +1,200 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message_codec.h"
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+///
+/// Framing for many small records in one queue message:
+///
+///     'Q' 'P' version(1) record_count(varint) { length(varint) bytes }*
+///
+/// Varints are unsigned LEB128. The frame is sent as binary message content, which the
+/// client library base64-encodes, so a 64 KB message holds max_frame_size raw bytes.
+///
+class message_packing
+{
+public:
+    static const size_t max_frame_size = 48 * 1024;
+    static const size_t header_size = 3;
+
+    // True if the buffer starts with a packed frame header.
+    static bool is_packed(const std::vector<uint8_t>& buffer);
+
+    static size_t varint_size(uint64_t value);
+    static void append_varint(std::vector<uint8_t>& buffer, uint64_t value);
+
+    // Reads a varint at position and advances it; throws std::runtime_error on truncation.
+    static uint64_t read_varint(const uint8_t* data, size_t size, size_t& position);
+};
+
+///
+/// A read-only view over the records of one packed frame. Records point into the frame, so
+/// nothing is copied while iterating. Message content is base64, so reading a message always
+/// decodes it into a byte buffer first: either one the view allocates and owns, or one the
+/// caller passes in and reuses across messages.
+///
+class packed_message_view
+{
+public:
+    struct record
+    {
+        const uint8_t* data;
+        size_t size;
+
+        std::string to_string() const;
+    };
+
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef record value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const record* pointer;
+        typedef const record& reference;
+
+        const_iterator();
+
+        const record& operator*() const;
+        const record* operator->() const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        bool operator==(const const_iterator& other) const;
+        bool operator!=(const const_iterator& other) const;
+
+    private:
+        friend class packed_message_view;
+
+        const_iterator(const uint8_t* data, size_t size, size_t position, size_t remaining);
+        void parse();
+
+        const uint8_t* m_data;
+        size_t m_size;
+        size_t m_position;
+        size_t m_remaining;
+        record m_current;
+    };
+
+    packed_message_view();
+
+    // Takes ownership of the buffer; throws std::runtime_error if it is not a packed frame.
+    explicit packed_message_view(std::vector<uint8_t> buffer);
+
+    // Unpacks the content of a received message into a buffer the view owns.
+    static packed_message_view from_message(const cloud_queue_message& message);
+
+    // Decodes the content into buffer, resizing it, and returns a view that reads from it, so
+    // the view is only valid until buffer is changed or destroyed.
+    static packed_message_view from_message(const cloud_queue_message& message, std::vector<uint8_t>& buffer);
+
+    // Decodes the content with the codec first, so the message must have been sent through one.
+    static packed_message_view from_message(const cloud_queue_message& message, message_codec& codec);
+
+    size_t size() const;
+    bool empty() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    explicit packed_message_view(const std::vector<uint8_t>* frame);
+
+    void parse();
+    const std::vector<uint8_t>& frame() const;
+
+    std::vector<uint8_t> m_buffer;
+
+    // The caller's buffer the view reads from, or null if it reads from m_buffer.
+    const std::vector<uint8_t>* m_frame;
+    size_t m_records_offset;
+    size_t m_count;
+};
+
+///
+/// Coalesces small records into packed queue messages. A message is sent once the next record
+/// would not fit in max_frame_size bytes, or once the oldest unsent record has waited
+/// max_delay, whichever comes first. Messages are sent through a queue_producer so several
+/// can be in flight.
+///
+/// With a codec, frames are compressed before sending and max_frame_size bounds the
+/// uncompressed frame, so it may exceed message_packing::max_frame_size. A frame that still
+/// does not fit once compressed is split in half until it does.
+///
+/// A max_frame_size of zero picks the default: message_packing::max_frame_size without a
+/// codec, and message_codec::max_decoded_size with one, so records are added until the
+/// compressed frame overflows.
+///
+class queue_message_packer
+{
+public:
+    queue_message_packer(queue_producer& producer, size_t max_frame_size = 0,
+        std::chrono::milliseconds max_delay = std::chrono::milliseconds(100), std::shared_ptr<message_codec> codec = nullptr);
+
+    // Sends any buffered records and waits for outstanding adds.
+    ~queue_message_packer();
+
+    // Throws std::invalid_argument if the record can never fit in a frame.
+    void add(const uint8_t* data, size_t size);
+    void add(const std::string& record);
+
+    // Sends buffered records now and waits for the producer to drain.
+    void flush();
+
+    uint64_t records_added() const;
+    uint64_t messages_sent() const;
+    uint64_t messages_failed() const;
+
+private:
+    queue_message_packer(const queue_message_packer&);
+    queue_message_packer& operator=(const queue_message_packer&);
+
+    bool take_locked(std::vector<uint8_t>& records, size_t& count);
+    void send_taken(const std::vector<uint8_t>& records, size_t count);
+    void send_records(const uint8_t* records, size_t size, size_t count);
+    void send_frame(std::vector<uint8_t> content);
+    void timer_loop();
+
+    queue_producer& m_producer;
+    size_t m_max_frame_size;
+    std::shared_ptr<message_codec> m_codec;
+    std::chrono::milliseconds m_max_delay;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<uint8_t> m_records;
+    size_t m_count;
+    size_t m_sending;
+    std::chrono::steady_clock::time_point m_oldest;
+    bool m_stopping;
+    std::thread m_timer;
+
+    std::atomic<uint64_t> m_records_added;
+    std::atomic<uint64_t> m_messages_sent;
+    std::atomic<uint64_t> m_messages_failed;
+};
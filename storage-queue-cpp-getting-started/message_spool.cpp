@@ -0,0 +1,481 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "message_spool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "queue_poller.h"
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+static const char segment_prefix[] = "spool-";
+static const uint8_t segment_magic[4] = { 'Q', 'S', 'P', 'L' };
+static const uint32_t segment_version = 1;
+static const size_t segment_header_size = 64;
+static const size_t sent_offset_position = 16;
+static const size_t record_header_size = 12;
+
+static const uint8_t record_end = 0;
+static const uint8_t record_text = 1;
+static const uint8_t record_binary = 2;
+
+static const size_t max_text_size = 64 * 1024;
+static const size_t max_binary_size = 48 * 1024;
+static const size_t min_segment_size = 1024 * 1024;
+
+template <typename T>
+static T load(const uint8_t* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+template <typename T>
+static void store(uint8_t* data, T value)
+{
+    std::memcpy(data, &value, sizeof(value));
+}
+
+static size_t padded_size(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// FNV-1a over the kind byte and the payload.
+static uint32_t checksum(uint8_t kind, const uint8_t* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ kind) * 16777619u;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static std::string segment_path(const std::string& directory, uint64_t sequence)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%020llu.log", segment_prefix, static_cast<unsigned long long>(sequence));
+    return directory + "/" + name;
+}
+
+message_spool_options::message_spool_options()
+    : directory("queue-spool"), segment_size(16 * 1024 * 1024), batch_size(64), sync_on_append(false),
+    min_retry_delay(100), max_retry_delay(30000)
+{
+}
+
+message_spool::message_spool(cloud_queue queue, const message_spool_options& options)
+    : m_queue(queue), m_options(options), m_stopping(false), m_appended(0), m_sent(0), m_retries(0), m_replayed(0)
+{
+    if (m_options.segment_size < min_segment_size)
+    {
+        throw std::invalid_argument("Spool segments must be at least 1 MB");
+    }
+
+    if (m_options.batch_size == 0)
+    {
+        throw std::invalid_argument("Spool batch size must be at least 1");
+    }
+
+    mapped_file::create_directory(m_options.directory);
+    recover();
+
+    m_drainer = std::thread(&message_spool::drain_loop, this);
+}
+
+message_spool::~message_spool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_changed.notify_all();
+    }
+    m_drainer.join();
+
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        m_segments[i]->file->flush();
+    }
+}
+
+void message_spool::append(const utility::string_t& content)
+{
+    std::string text = utility::conversions::to_utf8string(content);
+    if (text.size() > max_text_size)
+    {
+        throw std::invalid_argument("Message text is larger than 64 KB");
+    }
+
+    append_record(record_text, reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+void message_spool::append(const std::vector<uint8_t>& content)
+{
+    if (content.size() > max_binary_size)
+    {
+        throw std::invalid_argument("Binary message content is larger than 48 KB");
+    }
+
+    append_record(record_binary, content.data(), content.size());
+}
+
+void message_spool::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this] { return m_stopping || !has_unsent_locked(); });
+}
+
+uint64_t message_spool::appended_count() const
+{
+    return m_appended;
+}
+
+uint64_t message_spool::sent_count() const
+{
+    return m_sent;
+}
+
+uint64_t message_spool::retry_count() const
+{
+    return m_retries;
+}
+
+uint64_t message_spool::replayed_count() const
+{
+    return m_replayed;
+}
+
+///
+/// Returns the end of the valid records from offset on, counting them. A record that is cut
+/// short or fails its checksum was being written when the process stopped, and ends the scan.
+///
+size_t message_spool::scan(const uint8_t* data, size_t size, size_t offset, uint64_t* records)
+{
+    while (offset + record_header_size <= size)
+    {
+        uint32_t length = load<uint32_t>(data + offset);
+        uint8_t kind = data[offset + 8];
+        if (kind != record_text && kind != record_binary)
+        {
+            break;
+        }
+
+        if (length > size - offset - record_header_size)
+        {
+            break;
+        }
+
+        const uint8_t* payload = data + offset + record_header_size;
+        if (load<uint32_t>(data + offset + 4) != checksum(kind, payload, length))
+        {
+            break;
+        }
+
+        offset += padded_size(record_header_size + length);
+        (*records)++;
+    }
+
+    return std::min(offset, size);
+}
+
+///
+/// Reopens the segments left by a previous run. Segments whose records have all been sent are
+/// deleted; the others are queued for the drainer from their recorded sent offset.
+///
+void message_spool::recover()
+{
+    std::vector<std::string> paths = mapped_file::list(m_options.directory, segment_prefix);
+    uint64_t next_sequence = 0;
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        // Mapped at its size on disk, which an earlier run may have set differently.
+        std::unique_ptr<mapped_file> file(new mapped_file(paths[i], 0));
+        uint8_t* data = file->data();
+        if (file->size() < segment_header_size || std::memcmp(data, segment_magic, sizeof(segment_magic)) != 0 || load<uint32_t>(data + 4) != segment_version)
+        {
+            throw std::runtime_error("Not a spool segment: " + paths[i]);
+        }
+
+        size_t size = file->size();
+        uint64_t sent_offset = load<uint64_t>(data + sent_offset_position);
+        if (sent_offset < segment_header_size || sent_offset > size)
+        {
+            throw std::runtime_error("Corrupt spool segment header: " + paths[i]);
+        }
+
+        uint64_t sent_records = 0;
+        uint64_t all_records = 0;
+        size_t sent_end = scan(data, static_cast<size_t>(sent_offset), segment_header_size, &sent_records);
+        size_t write_offset = scan(data, size, segment_header_size, &all_records);
+        if (sent_end != sent_offset || write_offset < sent_offset)
+        {
+            throw std::runtime_error("Corrupt spool segment: " + paths[i]);
+        }
+
+        // Clear whatever follows the last complete record so new appends start from clean space.
+        std::memset(data + write_offset, 0, size - write_offset);
+
+        std::unique_ptr<segment> current(new segment());
+        current->sequence = load<uint64_t>(data + 8);
+        current->file = std::move(file);
+        current->write_offset = write_offset;
+        current->sealed = true;
+        next_sequence = std::max(next_sequence, current->sequence + 1);
+
+        if (write_offset == sent_offset)
+        {
+            current->file->remove();
+            continue;
+        }
+
+        m_replayed += all_records - sent_records;
+        m_segments.push_back(std::move(current));
+    }
+
+    // Appends always start in a fresh segment, which keeps a partly sent segment read-only.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    open_segment_locked(next_sequence);
+}
+
+void message_spool::open_segment_locked(uint64_t sequence)
+{
+    std::unique_ptr<segment> current(new segment());
+    current->sequence = sequence;
+    current->file.reset(new mapped_file(segment_path(m_options.directory, sequence), m_options.segment_size));
+    current->write_offset = segment_header_size;
+    current->sealed = false;
+
+    uint8_t* data = current->file->data();
+    std::memset(data, 0, segment_header_size);
+    std::memcpy(data, segment_magic, sizeof(segment_magic));
+    store<uint32_t>(data + 4, segment_version);
+    store<uint64_t>(data + 8, sequence);
+    store<uint64_t>(data + sent_offset_position, segment_header_size);
+    current->file->flush();
+
+    if (!m_segments.empty())
+    {
+        m_segments.back()->sealed = true;
+    }
+
+    m_segments.push_back(std::move(current));
+}
+
+void message_spool::append_record(uint8_t kind, const uint8_t* data, size_t size)
+{
+    size_t record_size = padded_size(record_header_size + size);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    segment* current = m_segments.back().get();
+    if (current->write_offset + record_size > current->file->size())
+    {
+        open_segment_locked(current->sequence + 1);
+        current = m_segments.back().get();
+    }
+
+    // The checksum lets recovery tell a record cut short by a crash from a complete one.
+    uint8_t* position = current->file->data() + current->write_offset;
+    store<uint32_t>(position, static_cast<uint32_t>(size));
+    store<uint32_t>(position + 4, checksum(kind, data, size));
+    if (size > 0)
+    {
+        std::memcpy(position + record_header_size, data, size);
+    }
+    position[8] = kind;
+
+    if (m_options.sync_on_append)
+    {
+        current->file->flush();
+    }
+
+    current->write_offset += record_size;
+    m_appended++;
+    m_changed.notify_all();
+}
+
+bool message_spool::has_unsent_locked() const
+{
+    if (m_segments.empty())
+    {
+        return false;
+    }
+
+    const segment& front = *m_segments.front();
+    return load<uint64_t>(front.file->data() + sent_offset_position) < front.write_offset || front.sealed;
+}
+
+///
+/// Adds the messages of the batch that have not been sent yet, concurrently, and waits for all
+/// of them. Each record is marked as it succeeds, so a retry only sends the ones that failed.
+/// Returns true once every record has been sent.
+///
+bool message_spool::send_batch(std::vector<record>& batch)
+{
+    std::vector<std::shared_ptr<cloud_queue_message>> messages;
+    std::vector<size_t> indexes;
+    std::vector<pplx::task<void>> operations;
+    messages.reserve(batch.size());
+    indexes.reserve(batch.size());
+    operations.reserve(batch.size());
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (batch[i].sent)
+        {
+            continue;
+        }
+
+        // add_message_async takes the message by reference, so it has to outlive the operation.
+        std::shared_ptr<cloud_queue_message> message;
+        if (batch[i].kind == record_text)
+        {
+            std::string text(batch[i].payload.begin(), batch[i].payload.end());
+            message = std::make_shared<cloud_queue_message>(utility::conversions::to_string_t(text));
+        }
+        else
+        {
+            message = std::make_shared<cloud_queue_message>(batch[i].payload);
+        }
+        messages.push_back(message);
+        indexes.push_back(i);
+
+        try
+        {
+            operations.push_back(m_queue.add_message_async(*message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options.request_options, operation_context()));
+        }
+        catch (...)
+        {
+            operations.push_back(pplx::task_from_exception<void>(std::current_exception()));
+        }
+    }
+
+    bool succeeded = true;
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        try
+        {
+            operations[i].get();
+            batch[indexes[i]].sent = true;
+        }
+        catch (const std::exception&)
+        {
+            succeeded = false;
+        }
+    }
+
+    return succeeded;
+}
+
+void message_spool::drain_loop()
+{
+    polling_backoff backoff(m_options.min_retry_delay, m_options.max_retry_delay);
+    std::vector<record> batch;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_changed.wait(lock, [this] { return m_stopping || has_unsent_locked(); });
+        if (m_stopping)
+        {
+            return;
+        }
+
+        // Only this thread removes segments, so the front stays put while the lock is released.
+        segment* front = m_segments.front().get();
+        uint8_t* data = front->file->data();
+        size_t sent_offset = static_cast<size_t>(load<uint64_t>(data + sent_offset_position));
+        if (sent_offset == front->write_offset)
+        {
+            // Sealed and fully sent, and appends have moved on to a later segment.
+            front->file->remove();
+            m_segments.pop_front();
+
+            // flush() may be waiting on exactly this segment, for example one replayed at startup.
+            m_changed.notify_all();
+            continue;
+        }
+
+        batch.clear();
+        size_t batch_end = sent_offset;
+        while (batch.size() < m_options.batch_size && batch_end < front->write_offset)
+        {
+            record next;
+            uint32_t length = load<uint32_t>(data + batch_end);
+            next.kind = data[batch_end + 8];
+            next.payload.assign(data + batch_end + record_header_size, data + batch_end + record_header_size + length);
+            batch_end += padded_size(record_header_size + length);
+            next.end_offset = batch_end;
+            next.sent = false;
+            batch.push_back(std::move(next));
+        }
+
+        lock.unlock();
+        size_t acknowledged = 0;
+        while (true)
+        {
+            bool complete = send_batch(batch);
+
+            // The sent offset moves past the records sent so far, so neither a retry nor a
+            // restart sends them again. Records sent after a failed one wait for it.
+            size_t prefix = acknowledged;
+            while (prefix < batch.size() && batch[prefix].sent)
+            {
+                prefix++;
+            }
+
+            if (prefix > acknowledged)
+            {
+                lock.lock();
+                store<uint64_t>(data + sent_offset_position, batch[prefix - 1].end_offset);
+                m_sent += prefix - acknowledged;
+                m_changed.notify_all();
+                lock.unlock();
+                acknowledged = prefix;
+            }
+
+            if (complete || m_stopping)
+            {
+                break;
+            }
+
+            m_retries++;
+            std::chrono::milliseconds delay = backoff.next(false);
+
+            lock.lock();
+            m_changed.wait_for(lock, delay, [this] { return m_stopping.load(); });
+            lock.unlock();
+        }
+        backoff.reset();
+        lock.lock();
+
+        if (acknowledged < batch.size())
+        {
+            return;
+        }
+    }
+}
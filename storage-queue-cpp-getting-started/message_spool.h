@@ -0,0 +1,147 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+
+using namespace azure::storage;
+
+///
+/// Settings for message_spool.
+///
+struct message_spool_options
+{
+    message_spool_options();
+
+    // Directory holding the segment files; created if it doesn't exist.
+    std::string directory;
+
+    // Size of each segment file.
+    size_t segment_size;
+
+    // Messages sent concurrently per drain batch.
+    size_t batch_size;
+
+    // Flush each append to disk before returning. Without this an append survives the process
+    // crashing but not the machine losing power.
+    bool sync_on_append;
+
+    // Bounds of the backoff between attempts to send a batch while the service is unreachable.
+    std::chrono::milliseconds min_retry_delay;
+    std::chrono::milliseconds max_retry_delay;
+
+    queue_request_options request_options;
+};
+
+///
+/// A write-ahead spool in front of a queue. append() copies the message into a memory-mapped
+/// segment file and returns without waiting for the service; a background thread sends the
+/// spooled messages in batches with add_message_async and deletes each segment once all of
+/// its messages have been added. Failed adds are retried with backoff until they succeed,
+/// so an outage only delays delivery; the messages of a batch that did get through are not
+/// sent again.
+///
+/// Segments start with a header recording how far their messages have been sent, so messages
+/// left over from a previous run are sent when the spool is opened again. A message is sent
+/// at least once: one whose add succeeded just before a crash, or while an earlier message of
+/// its batch was still failing, is sent again after a restart.
+///
+/// Segment layout, with integers in native byte order:
+///
+///     header (64 bytes):  'Q' 'S' 'P' 'L' version(u32) sequence(u64) sent_offset(u64)
+///     record:             size(u32) checksum(u32) kind(u8) padding(3) payload, padded to 8 bytes
+///
+/// A kind of zero marks the end of the records.
+///
+class message_spool
+{
+public:
+    explicit message_spool(cloud_queue queue, const message_spool_options& options = message_spool_options());
+
+    // Stops the drainer. Messages not yet sent stay in the spool for the next run.
+    ~message_spool();
+
+    // Throws std::invalid_argument if the content can't fit in a queue message.
+    void append(const utility::string_t& content);
+    void append(const std::vector<uint8_t>& content);
+
+    // Waits until every message appended so far has been added to the queue.
+    void flush();
+
+    uint64_t appended_count() const;
+    uint64_t sent_count() const;
+    uint64_t retry_count() const;
+
+    // Messages found unsent when the spool was opened.
+    uint64_t replayed_count() const;
+
+private:
+    struct segment
+    {
+        uint64_t sequence;
+        std::unique_ptr<mapped_file> file;
+        size_t write_offset;
+        bool sealed;
+    };
+
+    struct record
+    {
+        uint8_t kind;
+        std::vector<uint8_t> payload;
+
+        // Segment offset just past the record, and whether its add has succeeded.
+        size_t end_offset;
+        bool sent;
+    };
+
+    message_spool(const message_spool&);
+    message_spool& operator=(const message_spool&);
+
+    void recover();
+    void open_segment_locked(uint64_t sequence);
+    void append_record(uint8_t kind, const uint8_t* data, size_t size);
+    bool has_unsent_locked() const;
+    bool send_batch(std::vector<record>& batch);
+    void drain_loop();
+
+    static size_t scan(const uint8_t* data, size_t size, size_t offset, uint64_t* records);
+
+    cloud_queue m_queue;
+    message_spool_options m_options;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<segment>> m_segments;
+    std::atomic<bool> m_stopping;
+    std::thread m_drainer;
+
+    std::atomic<uint64_t> m_appended;
+    std::atomic<uint64_t> m_sent;
+    std::atomic<uint64_t> m_retries;
+    uint64_t m_replayed;
+};
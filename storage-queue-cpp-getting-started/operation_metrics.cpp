@@ -0,0 +1,463 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "operation_metrics.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace azure::storage;
+
+const size_t operation_metrics::operation_type_count;
+const size_t operation_metrics::latency_bucket_count;
+const size_t operation_metrics::max_status;
+const size_t operation_metrics::max_recent_failures;
+
+// Upper bounds of the latency buckets in seconds; the last bucket is unbounded.
+static const double latency_bounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+
+static const char* const operation_names[] =
+{
+    "list_queues", "service_properties", "create_queue", "delete_queue", "queue_metadata", "queue_acl",
+    "add_message", "get_messages", "peek_messages", "clear_messages", "update_message", "delete_message", "other"
+};
+
+// Identifies the registry a thread's cached shard belongs to, even if a registry is freed and
+// another one is allocated at the same address.
+static std::atomic<uint64_t> next_registry_id(1);
+
+struct cached_shard
+{
+    uint64_t registry_id;
+    void* shard;
+};
+
+static thread_local cached_shard thread_shard = { 0, nullptr };
+
+operation_metrics::operation_counters::operation_counters()
+    : requests(0), responses(0), errors(0), retries(0), request_bytes(0), response_bytes(0), latency_microseconds(0)
+{
+    for (size_t i = 0; i < latency_bucket_count; i++)
+    {
+        latency_buckets[i] = 0;
+    }
+}
+
+operation_metrics::shard::shard()
+{
+    for (size_t i = 0; i < max_status; i++)
+    {
+        statuses[i] = 0;
+    }
+}
+
+operation_metrics::totals::totals()
+{
+    std::fill(&requests[0], &requests[0] + operation_type_count, 0);
+    std::fill(&responses[0], &responses[0] + operation_type_count, 0);
+    std::fill(&errors[0], &errors[0] + operation_type_count, 0);
+    std::fill(&retries[0], &retries[0] + operation_type_count, 0);
+    std::fill(&request_bytes[0], &request_bytes[0] + operation_type_count, 0);
+    std::fill(&response_bytes[0], &response_bytes[0] + operation_type_count, 0);
+    std::fill(&latency_microseconds[0], &latency_microseconds[0] + operation_type_count, 0);
+    std::fill(&latency_buckets[0][0], &latency_buckets[0][0] + operation_type_count * latency_bucket_count, 0);
+    std::fill(&statuses[0], &statuses[0] + max_status, 0);
+}
+
+operation_metrics::attempt::attempt()
+    : count(0), retryable(false)
+{
+}
+
+operation_metrics::operation_metrics(std::chrono::milliseconds slow_threshold)
+    : m_slow_threshold(std::chrono::duration_cast<std::chrono::microseconds>(slow_threshold)), m_id(next_registry_id++)
+{
+}
+
+void operation_metrics::instrument(operation_context& context)
+{
+    std::shared_ptr<attempt> state = std::make_shared<attempt>();
+
+    context.set_sending_request([this, state](web::http::http_request& request, operation_context)
+    {
+        on_sending_request(request, *state);
+    });
+
+    context.set_response_received([this, state](web::http::http_request& request, const web::http::http_response& response, operation_context)
+    {
+        on_response_received(request, response, *state);
+    });
+}
+
+///
+/// Works out the operation from the request. Only the last path segments are looked at, so
+/// both account-in-host and account-in-path endpoints are recognized.
+///
+queue_operation_type operation_metrics::classify(const web::http::http_request& request)
+{
+    const web::http::method& method = request.method();
+    std::vector<utility::string_t> segments = web::uri::split_path(request.request_uri().path());
+    std::map<utility::string_t, utility::string_t> query = web::uri::split_query(request.request_uri().query());
+
+    auto comp = query.find(U("comp"));
+    if (comp != query.end())
+    {
+        if (comp->second == U("list"))
+        {
+            return queue_operation_type::list_queues;
+        }
+        else if (comp->second == U("properties") || comp->second == U("stats"))
+        {
+            return queue_operation_type::service_properties;
+        }
+        else if (comp->second == U("metadata"))
+        {
+            return queue_operation_type::queue_metadata;
+        }
+        else if (comp->second == U("acl"))
+        {
+            return queue_operation_type::queue_acl;
+        }
+
+        return queue_operation_type::other;
+    }
+
+    if (!segments.empty() && segments.back() == U("messages"))
+    {
+        if (method == web::http::methods::POST)
+        {
+            return queue_operation_type::add_message;
+        }
+        else if (method == web::http::methods::DEL)
+        {
+            return queue_operation_type::clear_messages;
+        }
+
+        auto peek = query.find(U("peekonly"));
+        return peek != query.end() && peek->second == U("true") ? queue_operation_type::peek_messages : queue_operation_type::get_messages;
+    }
+
+    if (segments.size() >= 2 && segments[segments.size() - 2] == U("messages"))
+    {
+        return method == web::http::methods::DEL ? queue_operation_type::delete_message : queue_operation_type::update_message;
+    }
+
+    if (method == web::http::methods::PUT)
+    {
+        return queue_operation_type::create_queue;
+    }
+    else if (method == web::http::methods::DEL)
+    {
+        return queue_operation_type::delete_queue;
+    }
+
+    return queue_operation_type::other;
+}
+
+const char* operation_metrics::operation_name(queue_operation_type type)
+{
+    return operation_names[static_cast<size_t>(type)];
+}
+
+uint64_t operation_metrics::request_count(queue_operation_type type) const
+{
+    return sum().requests[static_cast<size_t>(type)];
+}
+
+uint64_t operation_metrics::retry_count(queue_operation_type type) const
+{
+    return sum().retries[static_cast<size_t>(type)];
+}
+
+std::vector<operation_metrics::failure> operation_metrics::recent_failures() const
+{
+    std::lock_guard<std::mutex> lock(m_failures_mutex);
+    return std::vector<failure>(m_failures.begin(), m_failures.end());
+}
+
+utility::string_t operation_metrics::to_prometheus() const
+{
+    totals all = sum();
+    utility::ostringstream_t output;
+
+    struct counter
+    {
+        const char* name;
+        const char* help;
+        const uint64_t* values;
+    };
+
+    const counter counters[] =
+    {
+        { "azure_queue_requests_total", "Requests sent, including retries.", all.requests },
+        { "azure_queue_request_errors_total", "Responses with a status of 400 or above.", all.errors },
+        { "azure_queue_retries_total", "Requests sent after the first attempt of an operation.", all.retries },
+        { "azure_queue_request_bytes_total", "Request body bytes sent.", all.request_bytes },
+        { "azure_queue_response_bytes_total", "Response body bytes received.", all.response_bytes }
+    };
+
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++)
+    {
+        output << U("# HELP ") << counters[c].name << U(" ") << counters[c].help << U("\n");
+        output << U("# TYPE ") << counters[c].name << U(" counter\n");
+        for (size_t i = 0; i < operation_type_count; i++)
+        {
+            output << counters[c].name << U("{operation=\"") << operation_names[i] << U("\"} ") << counters[c].values[i] << U("\n");
+        }
+    }
+
+    output << U("# HELP azure_queue_request_duration_seconds Time from sending a request to receiving its response.\n");
+    output << U("# TYPE azure_queue_request_duration_seconds histogram\n");
+    for (size_t i = 0; i < operation_type_count; i++)
+    {
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < latency_bucket_count; b++)
+        {
+            cumulative += all.latency_buckets[i][b];
+            output << U("azure_queue_request_duration_seconds_bucket{operation=\"") << operation_names[i] << U("\",le=\"");
+            if (b + 1 < latency_bucket_count)
+            {
+                output << latency_bucket_bound(b);
+            }
+            else
+            {
+                output << U("+Inf");
+            }
+
+            output << U("\"} ") << cumulative << U("\n");
+        }
+
+        output << U("azure_queue_request_duration_seconds_sum{operation=\"") << operation_names[i] << U("\"} ")
+            << static_cast<double>(all.latency_microseconds[i]) / 1000000.0 << U("\n");
+        output << U("azure_queue_request_duration_seconds_count{operation=\"") << operation_names[i] << U("\"} ") << all.responses[i] << U("\n");
+    }
+
+    output << U("# HELP azure_queue_responses_total Responses by HTTP status code.\n");
+    output << U("# TYPE azure_queue_responses_total counter\n");
+    for (size_t status = 0; status < max_status; status++)
+    {
+        if (all.statuses[status] != 0)
+        {
+            output << U("azure_queue_responses_total{status=\"") << status << U("\"} ") << all.statuses[status] << U("\n");
+        }
+    }
+
+    return output.str();
+}
+
+utility::string_t operation_metrics::to_json() const
+{
+    totals all = sum();
+    utility::ostringstream_t output;
+
+    output << U("{\"operations\":{");
+    bool first = true;
+    for (size_t i = 0; i < operation_type_count; i++)
+    {
+        if (all.requests[i] == 0)
+        {
+            continue;
+        }
+
+        output << (first ? U("") : U(",")) << U("\"") << operation_names[i] << U("\":{")
+            << U("\"requests\":") << all.requests[i]
+            << U(",\"responses\":") << all.responses[i]
+            << U(",\"errors\":") << all.errors[i]
+            << U(",\"retries\":") << all.retries[i]
+            << U(",\"request_bytes\":") << all.request_bytes[i]
+            << U(",\"response_bytes\":") << all.response_bytes[i]
+            << U(",\"latency_us_sum\":") << all.latency_microseconds[i]
+            << U(",\"latency_buckets\":[");
+        for (size_t b = 0; b < latency_bucket_count; b++)
+        {
+            output << (b == 0 ? U("") : U(",")) << all.latency_buckets[i][b];
+        }
+
+        output << U("]}");
+        first = false;
+    }
+
+    output << U("},\"statuses\":{");
+    first = true;
+    for (size_t status = 0; status < max_status; status++)
+    {
+        if (all.statuses[status] != 0)
+        {
+            output << (first ? U("") : U(",")) << U("\"") << status << U("\":") << all.statuses[status];
+            first = false;
+        }
+    }
+
+    output << U("},\"recent_failures\":[");
+    std::vector<failure> failures = recent_failures();
+    for (size_t i = 0; i < failures.size(); i++)
+    {
+        output << (i == 0 ? U("") : U(",")) << U("{\"operation\":\"") << operation_names[static_cast<size_t>(failures[i].operation)]
+            << U("\",\"status\":") << failures[i].status
+            << U(",\"request_id\":\"") << failures[i].service_request_id
+            << U("\",\"latency_us\":") << failures[i].latency.count() << U("}");
+    }
+
+    output << U("]}");
+    return output.str();
+}
+
+// Only the owning thread writes a shard, so a plain load and store is enough and cheaper than
+// an atomic increment.
+void operation_metrics::add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+size_t operation_metrics::latency_bucket(std::chrono::microseconds latency)
+{
+    double seconds = static_cast<double>(latency.count()) / 1000000.0;
+    size_t index = 0;
+    while (index + 1 < latency_bucket_count && seconds > latency_bounds[index])
+    {
+        index++;
+    }
+
+    return index;
+}
+
+double operation_metrics::latency_bucket_bound(size_t index)
+{
+    return latency_bounds[index];
+}
+
+operation_metrics::shard& operation_metrics::local_shard()
+{
+    if (thread_shard.registry_id == m_id)
+    {
+        return *static_cast<shard*>(thread_shard.shard);
+    }
+
+    // First use on this thread, or the thread last recorded into another registry.
+    std::lock_guard<std::mutex> lock(m_shards_mutex);
+    std::unique_ptr<shard>& entry = m_shards[std::this_thread::get_id()];
+    if (!entry)
+    {
+        entry.reset(new shard());
+    }
+
+    thread_shard.registry_id = m_id;
+    thread_shard.shard = entry.get();
+    return *entry;
+}
+
+operation_metrics::totals operation_metrics::sum() const
+{
+    totals all;
+
+    std::lock_guard<std::mutex> lock(m_shards_mutex);
+    for (auto it = m_shards.begin(); it != m_shards.end(); ++it)
+    {
+        const shard& local = *it->second;
+        for (size_t i = 0; i < operation_type_count; i++)
+        {
+            const operation_counters& counters = local.operations[i];
+            all.requests[i] += counters.requests.load(std::memory_order_relaxed);
+            all.responses[i] += counters.responses.load(std::memory_order_relaxed);
+            all.errors[i] += counters.errors.load(std::memory_order_relaxed);
+            all.retries[i] += counters.retries.load(std::memory_order_relaxed);
+            all.request_bytes[i] += counters.request_bytes.load(std::memory_order_relaxed);
+            all.response_bytes[i] += counters.response_bytes.load(std::memory_order_relaxed);
+            all.latency_microseconds[i] += counters.latency_microseconds.load(std::memory_order_relaxed);
+            for (size_t b = 0; b < latency_bucket_count; b++)
+            {
+                all.latency_buckets[i][b] += counters.latency_buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+
+        for (size_t status = 0; status < max_status; status++)
+        {
+            all.statuses[status] += local.statuses[status].load(std::memory_order_relaxed);
+        }
+    }
+
+    return all;
+}
+
+void operation_metrics::on_sending_request(web::http::http_request& request, attempt& state)
+{
+    operation_counters& counters = local_shard().operations[static_cast<size_t>(classify(request))];
+
+    add(counters.requests, 1);
+
+    // The client request id stays the same for every operation on a context, so retries are
+    // told apart by what came before: a retry follows a failed attempt at the same resource.
+    utility::string_t path = request.request_uri().path();
+    bool retry = state.count > 0 && state.retryable && state.method == request.method() && state.path == path;
+    if (retry)
+    {
+        add(counters.retries, 1);
+    }
+
+    state.count = retry ? state.count + 1 : 1;
+    state.method = request.method();
+    state.path.swap(path);
+
+    // Stays set if no response arrives, since a network failure is retried too.
+    state.retryable = true;
+
+    add(counters.request_bytes, request.headers().content_length());
+    state.started = std::chrono::steady_clock::now();
+}
+
+void operation_metrics::on_response_received(web::http::http_request& request, const web::http::http_response& response, attempt& state)
+{
+    std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state.started);
+    queue_operation_type type = classify(request);
+    unsigned short status = response.status_code();
+
+    shard& local = local_shard();
+    operation_counters& counters = local.operations[static_cast<size_t>(type)];
+    add(counters.responses, 1);
+    add(counters.response_bytes, response.headers().content_length());
+    add(counters.latency_microseconds, static_cast<uint64_t>(latency.count()));
+    add(counters.latency_buckets[latency_bucket(latency)], 1);
+    add(local.statuses[status < max_status ? status : 0], 1);
+    state.retryable = status == 408 || status >= 500;
+
+    if (status >= 400)
+    {
+        add(counters.errors, 1);
+    }
+
+    if (status >= 400 || latency >= m_slow_threshold)
+    {
+        failure entry;
+        entry.operation = type;
+        entry.status = status;
+        entry.latency = latency;
+
+        auto request_id = response.headers().find(U("x-ms-request-id"));
+        if (request_id != response.headers().end())
+        {
+            entry.service_request_id = request_id->second;
+        }
+
+        std::lock_guard<std::mutex> lock(m_failures_mutex);
+        m_failures.push_back(entry);
+        if (m_failures.size() > max_recent_failures)
+        {
+            m_failures.pop_front();
+        }
+    }
+}
@@ -0,0 +1,179 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// The Queue service operations operation_metrics tells apart, derived from the method and
+/// URI of each request.
+///
+enum class queue_operation_type
+{
+    list_queues,
+    service_properties,
+    create_queue,
+    delete_queue,
+    queue_metadata,
+    queue_acl,
+    add_message,
+    get_messages,
+    peek_messages,
+    clear_messages,
+    update_message,
+    delete_message,
+    other
+};
+
+///
+/// Collects per-operation request metrics through the sending-request and response-received
+/// callbacks of operation_context: request and retry counts, latency, request and response
+/// bytes, and HTTP status codes. The request IDs of recent failed or slow requests are kept so
+/// they can be looked up in the service logs.
+///
+/// Each thread records into its own set of counters, so recording takes no lock and doesn't
+/// contend with other threads. Dumps add up the counters of every thread.
+///
+class operation_metrics
+{
+public:
+    static const size_t operation_type_count = static_cast<size_t>(queue_operation_type::other) + 1;
+
+    struct failure
+    {
+        queue_operation_type operation;
+        unsigned short status;
+        utility::string_t service_request_id;
+        std::chrono::microseconds latency;
+    };
+
+    // Requests at or above slow_threshold are kept with the recent failures.
+    explicit operation_metrics(std::chrono::milliseconds slow_threshold = std::chrono::milliseconds(1000));
+
+    ///
+    /// Starts recording the requests made with this context. A context should be used for one
+    /// operation at a time, since an attempt is timed from its request to its response; it can
+    /// be reused for operation after operation. The metrics object must outlive the context.
+    ///
+    /// A request counts as a retry when it repeats the method and path of the previous request
+    /// on the context and that request got no response or a retryable one (408 or 5xx). Every
+    /// other request starts a new operation.
+    ///
+    void instrument(operation_context& context);
+
+    static queue_operation_type classify(const web::http::http_request& request);
+    static const char* operation_name(queue_operation_type type);
+
+    uint64_t request_count(queue_operation_type type) const;
+    uint64_t retry_count(queue_operation_type type) const;
+    std::vector<failure> recent_failures() const;
+
+    // Prometheus text exposition format.
+    utility::string_t to_prometheus() const;
+    utility::string_t to_json() const;
+
+private:
+    static const size_t latency_bucket_count = 14;
+    static const size_t max_status = 600;
+    static const size_t max_recent_failures = 32;
+
+    struct operation_counters
+    {
+        operation_counters();
+
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> responses;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> retries;
+        std::atomic<uint64_t> request_bytes;
+        std::atomic<uint64_t> response_bytes;
+        std::atomic<uint64_t> latency_microseconds;
+
+        // Responses per latency bucket; the last bucket has no upper bound.
+        std::atomic<uint64_t> latency_buckets[latency_bucket_count];
+    };
+
+    // The counters written by one thread. Only the owning thread writes them; dumps read them.
+    struct shard
+    {
+        shard();
+
+        operation_counters operations[operation_type_count];
+        std::atomic<uint64_t> statuses[max_status];
+    };
+
+    // Totals added up across shards.
+    struct totals
+    {
+        totals();
+
+        uint64_t requests[operation_type_count];
+        uint64_t responses[operation_type_count];
+        uint64_t errors[operation_type_count];
+        uint64_t retries[operation_type_count];
+        uint64_t request_bytes[operation_type_count];
+        uint64_t response_bytes[operation_type_count];
+        uint64_t latency_microseconds[operation_type_count];
+        uint64_t latency_buckets[operation_type_count][latency_bucket_count];
+        uint64_t statuses[max_status];
+    };
+
+    // Per-context state shared by the two callbacks.
+    struct attempt
+    {
+        attempt();
+
+        unsigned int count;
+        std::chrono::steady_clock::time_point started;
+
+        // The previous request, and whether its outcome could have led to a retry.
+        web::http::method method;
+        utility::string_t path;
+        bool retryable;
+    };
+
+    operation_metrics(const operation_metrics&);
+    operation_metrics& operator=(const operation_metrics&);
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value);
+    static size_t latency_bucket(std::chrono::microseconds latency);
+    static double latency_bucket_bound(size_t index);
+
+    shard& local_shard();
+    totals sum() const;
+    void on_sending_request(web::http::http_request& request, attempt& state);
+    void on_response_received(web::http::http_request& request, const web::http::http_response& response, attempt& state);
+
+    std::chrono::microseconds m_slow_threshold;
+    uint64_t m_id;
+
+    mutable std::mutex m_shards_mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<shard>> m_shards;
+
+    mutable std::mutex m_failures_mutex;
+    std::deque<failure> m_failures;
+};
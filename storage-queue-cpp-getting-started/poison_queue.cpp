@@ -0,0 +1,167 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "poison_queue.h"
+#include "queue_producer.h"
+
+#include <stdexcept>
+
+using namespace azure::storage;
+
+// Queue names are limited to 63 characters.
+static const size_t max_queue_name_length = 63;
+
+poison_queue_options::poison_queue_options()
+    : max_dequeue_count(5), suffix(U("-poison")), time_to_live(604800), replay_visibility_timeout(60)
+{
+}
+
+poison_queue::poison_queue(cloud_queue source, const poison_queue_options& options)
+    : m_source(source), m_options(options), m_moved(0), m_replayed(0)
+{
+    m_options.max_dequeue_count = std::max(m_options.max_dequeue_count, 1);
+
+    utility::string_t name = m_source.name() + m_options.suffix;
+    if (m_options.suffix.empty() || name.size() > max_queue_name_length)
+    {
+        throw std::invalid_argument("Poison queue name must differ from the source and be at most 63 characters");
+    }
+
+    m_queue = m_source.service_client().get_queue_reference(name);
+}
+
+cloud_queue& poison_queue::source()
+{
+    return m_source;
+}
+
+cloud_queue& poison_queue::queue()
+{
+    return m_queue;
+}
+
+void poison_queue::create_if_not_exists()
+{
+    m_queue.create_if_not_exists(m_options.request_options, operation_context());
+}
+
+bool poison_queue::is_poison(const cloud_queue_message& message) const
+{
+    return message.dequeue_count() > m_options.max_dequeue_count;
+}
+
+pplx::task<void> poison_queue::move_async(const cloud_queue_message& message)
+{
+    // The async calls take messages by reference, so both copies live in the continuations.
+    std::shared_ptr<cloud_queue_message> copy = std::make_shared<cloud_queue_message>(message.content_as_string());
+    std::shared_ptr<cloud_queue_message> original = std::make_shared<cloud_queue_message>(message);
+
+    pplx::task<void> add;
+    try
+    {
+        add = m_queue.add_message_async(*copy, m_options.time_to_live, std::chrono::seconds(0), m_options.request_options, operation_context());
+    }
+    catch (...)
+    {
+        return pplx::task_from_exception<void>(std::current_exception());
+    }
+
+    return add.then([this, copy, original]()
+    {
+        return m_source.delete_message_async(*original, m_options.request_options, operation_context());
+    }).then([this, original](pplx::task<void> previous)
+    {
+        previous.get();
+        m_moved++;
+    });
+}
+
+void poison_queue::move(const cloud_queue_message& message)
+{
+    move_async(message).get();
+}
+
+size_t poison_queue::replay(size_t max_messages)
+{
+    size_t replayed = 0;
+    while (replayed < max_messages)
+    {
+        size_t count = std::min<size_t>(max_messages - replayed, 32);
+        std::vector<cloud_queue_message> batch = m_queue.get_messages(count, m_options.replay_visibility_timeout, m_options.request_options, operation_context());
+        if (batch.empty())
+        {
+            break;
+        }
+
+        std::vector<pplx::task<void>> operations;
+        operations.reserve(batch.size());
+        for (auto it = batch.begin(); it != batch.end(); ++it)
+        {
+            std::shared_ptr<cloud_queue_message> copy = std::make_shared<cloud_queue_message>(it->content_as_string());
+            std::shared_ptr<cloud_queue_message> original = std::make_shared<cloud_queue_message>(*it);
+
+            try
+            {
+                operations.push_back(m_source.add_message_async(*copy, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options.request_options, operation_context())
+                    .then([this, copy, original]()
+                {
+                    return m_queue.delete_message_async(*original, m_options.request_options, operation_context());
+                }));
+            }
+            catch (...)
+            {
+                operations.push_back(pplx::task_from_exception<void>(std::current_exception()));
+            }
+        }
+
+        std::exception_ptr error;
+        for (auto it = operations.begin(); it != operations.end(); ++it)
+        {
+            try
+            {
+                it->get();
+                replayed++;
+                m_replayed++;
+            }
+            catch (...)
+            {
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    return replayed;
+}
+
+uint64_t poison_queue::moved_count() const
+{
+    return m_moved;
+}
+
+uint64_t poison_queue::replayed_count() const
+{
+    return m_replayed;
+}
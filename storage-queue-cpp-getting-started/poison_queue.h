@@ -0,0 +1,104 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+using namespace azure::storage;
+
+///
+/// Settings for poison_queue.
+///
+struct poison_queue_options
+{
+    poison_queue_options();
+
+    // A message received more than this many times is treated as poison.
+    int max_dequeue_count;
+
+    // Appended to the source queue's name to name the poison queue.
+    utility::string_t suffix;
+
+    // Time to live of the copies added to the poison queue. Defaults to 7 days, the longest
+    // the service accepts from this client library; a poison message not replayed or
+    // inspected by then expires.
+    std::chrono::seconds time_to_live;
+
+    // How long messages being replayed stay invisible in the poison queue. A message whose
+    // replay fails becomes visible there again once this lapses.
+    std::chrono::seconds replay_visibility_timeout;
+
+    queue_request_options request_options;
+};
+
+///
+/// Moves messages that keep failing out of a queue into a companion queue named after it,
+/// "orders" to "orders-poison" by default, so they stop using up receives and holding back
+/// other work. Once the cause is fixed, replay() puts them back.
+///
+/// A move adds a copy to the poison queue and only then deletes the original, so a message
+/// is not lost in the move. If the delete fails, for example because the lease ran out, the
+/// original comes back and is moved again, leaving a duplicate in the poison queue. Copies
+/// still expire after time_to_live, so replay or drain the poison queue before then.
+///
+class poison_queue
+{
+public:
+    explicit poison_queue(cloud_queue source, const poison_queue_options& options = poison_queue_options());
+
+    cloud_queue& source();
+    cloud_queue& queue();
+
+    void create_if_not_exists();
+
+    // True once the message has been received more than max_dequeue_count times.
+    bool is_poison(const cloud_queue_message& message) const;
+
+    ///
+    /// Moves a received message to the poison queue. The message needs a current pop receipt;
+    /// content is copied as is, so binary messages stay binary. The poison_queue must outlive
+    /// the returned task.
+    ///
+    pplx::task<void> move_async(const cloud_queue_message& message);
+    void move(const cloud_queue_message& message);
+
+    ///
+    /// Adds messages from the poison queue back to the source queue as new messages, with
+    /// their dequeue count starting over, and deletes them from the poison queue. Each batch
+    /// is added concurrently, and each message is deleted as soon as its add succeeds. Stops
+    /// when the poison queue has nothing visible or max_messages have been replayed; returns
+    /// how many were. If a message fails, the rest of its batch still finishes, then the
+    /// failure is rethrown and the message stays in the poison queue.
+    ///
+    size_t replay(size_t max_messages = std::numeric_limits<size_t>::max());
+
+    uint64_t moved_count() const;
+    uint64_t replayed_count() const;
+
+private:
+    poison_queue(const poison_queue&);
+    poison_queue& operator=(const poison_queue&);
+
+    cloud_queue m_source;
+    cloud_queue m_queue;
+    poison_queue_options m_options;
+
+    std::atomic<uint64_t> m_moved;
+    std::atomic<uint64_t> m_replayed;
+};
@@ -0,0 +1,374 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "prioritized_queue.h"
+#include "queue_group.h"
+#include "queue_poller.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+prioritized_queue::prioritized_queue(std::vector<cloud_queue> tiers, std::vector<unsigned int> weights)
+    : m_tiers(std::move(tiers)), m_weights(std::move(weights))
+{
+    if (m_tiers.empty() || m_tiers.size() != m_weights.size())
+    {
+        throw std::invalid_argument("A prioritized queue needs one weight for each of at least one tier");
+    }
+
+    if (std::find(m_weights.begin(), m_weights.end(), 0u) != m_weights.end())
+    {
+        throw std::invalid_argument("Tier weights must be greater than zero");
+    }
+}
+
+prioritized_queue prioritized_queue::create(cloud_queue_client queue_client, const utility::string_t& prefix, std::vector<unsigned int> weights)
+{
+    std::vector<cloud_queue> tiers;
+    std::vector<pplx::task<bool>> creates;
+    for (size_t i = 0; i < weights.size(); i++)
+    {
+        tiers.push_back(queue_client.get_queue_reference(prefix + U("-") + utility::conversions::print_string(i)));
+        creates.push_back(tiers.back().create_if_not_exists_async());
+    }
+
+    pplx::when_all(creates.begin(), creates.end()).wait();
+
+    return prioritized_queue(std::move(tiers), std::move(weights));
+}
+
+size_t prioritized_queue::tier_count() const
+{
+    return m_tiers.size();
+}
+
+cloud_queue& prioritized_queue::tier(size_t index)
+{
+    return m_tiers.at(index);
+}
+
+unsigned int prioritized_queue::weight(size_t index) const
+{
+    return m_weights.at(index);
+}
+
+void prioritized_queue::add_message(cloud_queue_message& message, size_t tier)
+{
+    m_tiers.at(tier).add_message(message);
+}
+
+pplx::task<void> prioritized_queue::add_message_async(cloud_queue_message& message, size_t tier)
+{
+    return m_tiers.at(tier).add_message_async(message);
+}
+
+std::vector<int> prioritized_queue::approximate_message_counts()
+{
+    return queue_group::approximate_message_counts(m_tiers, queue_request_options());
+}
+
+void prioritized_queue::delete_tiers_if_exist()
+{
+    for (auto it = m_tiers.begin(); it != m_tiers.end(); ++it)
+    {
+        it->delete_queue_if_exists();
+    }
+}
+
+prioritized_queue_consumer_options::prioritized_queue_consumer_options()
+    : scheduling(priority_scheduling::weighted), worker_count(4), max_batch_size(32), visibility_timeout(30), backlog_refresh_interval(1000),
+    empty_poll_delay(50), max_empty_poll_delay(10000)
+{
+}
+
+prioritized_queue_consumer::prioritized_queue_consumer(prioritized_queue queue, message_handler handler)
+    : prioritized_queue_consumer(queue, handler, prioritized_queue_consumer_options())
+{
+}
+
+prioritized_queue_consumer::prioritized_queue_consumer(prioritized_queue queue, message_handler handler, const prioritized_queue_consumer_options& options)
+    : m_queue(queue), m_handler(handler), m_options(options), m_running(false), m_backlog(queue.tier_count(), 0), m_charged(queue.tier_count(), 0.0),
+    m_received(queue.tier_count()), m_processed(0), m_failed(0)
+{
+    m_options.worker_count = std::max<size_t>(m_options.worker_count, 1);
+    m_options.max_batch_size = std::min<size_t>(std::max<size_t>(m_options.max_batch_size, 1), 32);
+}
+
+prioritized_queue_consumer::~prioritized_queue_consumer()
+{
+    stop();
+}
+
+void prioritized_queue_consumer::start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    // Read the backlogs once up front so the first receives are already scheduled.
+    refresh(m_queue);
+
+    m_refresher = std::thread(&prioritized_queue_consumer::refresh_loop, this);
+    for (size_t i = 0; i < m_options.worker_count; i++)
+    {
+        m_workers.push_back(std::thread(&prioritized_queue_consumer::worker_loop, this));
+    }
+}
+
+void prioritized_queue_consumer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running.exchange(false))
+        {
+            return;
+        }
+
+        m_stopping.notify_all();
+    }
+
+    m_refresher.join();
+    for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        it->join();
+    }
+
+    m_workers.clear();
+}
+
+uint64_t prioritized_queue_consumer::processed_count() const
+{
+    return m_processed;
+}
+
+uint64_t prioritized_queue_consumer::failed_count() const
+{
+    return m_failed;
+}
+
+uint64_t prioritized_queue_consumer::received_count(size_t tier) const
+{
+    return m_received.at(tier);
+}
+
+void prioritized_queue_consumer::worker_loop()
+{
+    polling_backoff backoff(m_options.empty_poll_delay, m_options.max_empty_poll_delay);
+    while (m_running)
+    {
+        size_t tier;
+        size_t batch_size;
+        if (next_tier(tier, batch_size))
+        {
+            size_t received = drain(tier, batch_size);
+            record_receive(tier, batch_size, received);
+            if (received > 0)
+            {
+                backoff.reset();
+            }
+
+            continue;
+        }
+
+        // Every tier looks empty, but messages may have arrived since the last refresh.
+        bool found = false;
+        for (size_t i = 0; i < m_queue.tier_count() && !found && m_running; i++)
+        {
+            size_t received = drain(i, m_options.max_batch_size);
+            record_probe(i, m_options.max_batch_size, received);
+            found = received > 0;
+        }
+
+        std::chrono::milliseconds delay = backoff.next(found);
+        if (!found)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_stopping.wait_for(lock, delay, [this] { return !m_running; });
+        }
+    }
+}
+
+void prioritized_queue_consumer::refresh_loop()
+{
+    // A copy of its own, so fetching attributes doesn't touch the queues the workers use.
+    prioritized_queue queue = m_queue;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_stopping.wait_for(lock, m_options.backlog_refresh_interval, [this] { return !m_running; }))
+            {
+                return;
+            }
+        }
+
+        refresh(queue);
+    }
+}
+
+void prioritized_queue_consumer::refresh(prioritized_queue& queue)
+{
+    std::vector<int> counts;
+    try
+    {
+        counts = queue.approximate_message_counts();
+    }
+    catch (const std::exception&)
+    {
+        // Keep the current estimates until the next refresh.
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] > 0)
+        {
+            activate_locked(i);
+        }
+
+        m_backlog[i] = counts[i];
+    }
+}
+
+///
+/// Picks the tier for the next receive and reserves a batch of its backlog, so that workers
+/// choosing at the same time spread over the tiers instead of all picking the same one.
+/// Returns false if no tier is thought to have messages.
+///
+bool prioritized_queue_consumer::next_tier(size_t& tier, size_t& batch_size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t chosen = m_backlog.size();
+    for (size_t i = 0; i < m_backlog.size(); i++)
+    {
+        if (m_backlog[i] <= 0)
+        {
+            continue;
+        }
+
+        if (m_options.scheduling == priority_scheduling::strict)
+        {
+            chosen = i;
+            break;
+        }
+
+        if (chosen == m_backlog.size() || m_charged[i] < m_charged[chosen])
+        {
+            chosen = i;
+        }
+    }
+
+    if (chosen == m_backlog.size())
+    {
+        return false;
+    }
+
+    int64_t workers = static_cast<int64_t>(m_options.worker_count);
+    int64_t share = (m_backlog[chosen] + workers - 1) / workers;
+    batch_size = static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(share, 1), static_cast<int64_t>(m_options.max_batch_size)));
+    tier = chosen;
+
+    m_backlog[chosen] -= static_cast<int64_t>(batch_size);
+    m_charged[chosen] += static_cast<double>(batch_size) / m_queue.weight(chosen);
+    return true;
+}
+
+void prioritized_queue_consumer::record_receive(size_t tier, size_t requested, size_t received)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // next_tier charged for the whole batch; refund what didn't come back.
+    m_charged[tier] -= static_cast<double>(requested - received) / m_queue.weight(tier);
+
+    if (received < requested)
+    {
+        m_backlog[tier] = 0;
+    }
+    else if (m_backlog[tier] <= 0)
+    {
+        // A full batch suggests there are more than the estimate said.
+        m_backlog[tier] = static_cast<int64_t>(requested);
+    }
+}
+
+void prioritized_queue_consumer::record_probe(size_t tier, size_t requested, size_t received)
+{
+    if (received == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    activate_locked(tier);
+    m_charged[tier] += static_cast<double>(received) / m_queue.weight(tier);
+
+    if (received == requested)
+    {
+        m_backlog[tier] = std::max(m_backlog[tier], static_cast<int64_t>(requested));
+    }
+}
+
+///
+/// Levels the charge of a tier that is about to have messages again with the least charged
+/// tier that already has some. If none has, every tier starts again from zero.
+///
+void prioritized_queue_consumer::activate_locked(size_t tier)
+{
+    if (m_backlog[tier] > 0)
+    {
+        return;
+    }
+
+    bool any_active = false;
+    double least = 0;
+    for (size_t i = 0; i < m_backlog.size(); i++)
+    {
+        if (i != tier && m_backlog[i] > 0 && (!any_active || m_charged[i] < least))
+        {
+            least = m_charged[i];
+            any_active = true;
+        }
+    }
+
+    if (any_active)
+    {
+        m_charged[tier] = least;
+    }
+    else
+    {
+        std::fill(m_charged.begin(), m_charged.end(), 0.0);
+    }
+}
+
+///
+/// Receives and handles one batch from the tier. Returns the number received.
+///
+size_t prioritized_queue_consumer::drain(size_t tier, size_t batch_size)
+{
+    queue_group::batch_result batch = queue_group::receive_and_handle(m_queue.tier(tier), batch_size, m_options.visibility_timeout, m_options.request_options, m_handler);
+
+    m_received[tier] += batch.received;
+    m_processed += batch.processed;
+    m_failed += batch.failed;
+    return batch.received;
+}
@@ -0,0 +1,168 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// One logical queue with priorities, kept as a physical queue per tier. Tier 0 is the highest
+/// priority. Producers choose a tier for each message; the weights tell a
+/// prioritized_queue_consumer how to share receives between tiers.
+///
+class prioritized_queue
+{
+public:
+    // Throws std::invalid_argument unless there is one non-zero weight per tier.
+    prioritized_queue(std::vector<cloud_queue> tiers, std::vector<unsigned int> weights);
+
+    // Creates the queues prefix-0 .. prefix-<n - 1>, one per weight, if they don't already exist.
+    static prioritized_queue create(cloud_queue_client queue_client, const utility::string_t& prefix, std::vector<unsigned int> weights);
+
+    size_t tier_count() const;
+    cloud_queue& tier(size_t index);
+    unsigned int weight(size_t index) const;
+
+    void add_message(cloud_queue_message& message, size_t tier);
+    // The message is updated when the add completes, so it must outlive the task.
+    pplx::task<void> add_message_async(cloud_queue_message& message, size_t tier);
+
+    // Approximate message count of each tier; fetches the attributes of all tiers concurrently.
+    std::vector<int> approximate_message_counts();
+
+    void delete_tiers_if_exist();
+
+private:
+    std::vector<cloud_queue> m_tiers;
+    std::vector<unsigned int> m_weights;
+};
+
+///
+/// How prioritized_queue_consumer chooses the tier to receive from next.
+///
+enum class priority_scheduling
+{
+    // Always the highest priority tier with messages; lower tiers wait while it has any.
+    strict,
+
+    // Tiers with messages share receives in proportion to their weights, counted in messages.
+    weighted
+};
+
+///
+/// Settings for prioritized_queue_consumer.
+///
+struct prioritized_queue_consumer_options
+{
+    prioritized_queue_consumer_options();
+
+    priority_scheduling scheduling;
+
+    size_t worker_count;
+
+    // Largest batch requested per get_messages call (the service allows at most 32).
+    size_t max_batch_size;
+
+    // Visibility timeout requested on receive; handlers are expected to finish within it.
+    std::chrono::seconds visibility_timeout;
+
+    // How often the backlog of every tier is read with approximate_message_count. Messages
+    // added to a tier thought to be empty can wait this long if other tiers keep workers busy.
+    std::chrono::milliseconds backlog_refresh_interval;
+
+    // How long a worker waits after first finding every tier empty. The wait doubles each
+    // time the tiers are all empty again, up to max_empty_poll_delay.
+    std::chrono::milliseconds empty_poll_delay;
+    std::chrono::milliseconds max_empty_poll_delay;
+
+    queue_request_options request_options;
+};
+
+///
+/// Consumes a prioritized_queue with a pool of workers. The consumer keeps an estimate of each
+/// tier's backlog, read periodically from the service and updated after every receive, and
+/// only schedules tiers that have messages. A worker's batch is the tier's backlog split
+/// across the workers, between 1 and max_batch_size, so a short tier isn't claimed whole by
+/// one worker and a long one is drained in full batches.
+///
+/// Under weighted scheduling each tier is charged for the messages it delivers, divided by its
+/// weight, and the tier charged least so far goes next. A tier that comes back after being
+/// empty starts level with the least charged tier that has messages, rather than catching up
+/// on the time it was empty.
+///
+/// When every tier is thought to be empty, workers probe the tiers in priority order.
+/// A message whose handler throws is made visible again right away so it can be retried.
+///
+class prioritized_queue_consumer
+{
+public:
+    typedef std::function<void(const cloud_queue_message& message)> message_handler;
+
+    prioritized_queue_consumer(prioritized_queue queue, message_handler handler);
+    prioritized_queue_consumer(prioritized_queue queue, message_handler handler, const prioritized_queue_consumer_options& options);
+
+    // Stops the consumer if it is still running.
+    ~prioritized_queue_consumer();
+
+    void start();
+
+    // Stops receiving and waits for in-progress batches to finish.
+    void stop();
+
+    uint64_t processed_count() const;
+    uint64_t failed_count() const;
+    uint64_t received_count(size_t tier) const;
+
+private:
+    prioritized_queue_consumer(const prioritized_queue_consumer&);
+    prioritized_queue_consumer& operator=(const prioritized_queue_consumer&);
+
+    void worker_loop();
+    void refresh_loop();
+    void refresh(prioritized_queue& queue);
+
+    bool next_tier(size_t& tier, size_t& batch_size);
+    void record_receive(size_t tier, size_t requested, size_t received);
+    void record_probe(size_t tier, size_t requested, size_t received);
+    void activate_locked(size_t tier);
+    size_t drain(size_t tier, size_t batch_size);
+
+    prioritized_queue m_queue;
+    message_handler m_handler;
+    prioritized_queue_consumer_options m_options;
+
+    std::atomic<bool> m_running;
+    std::vector<std::thread> m_workers;
+    std::thread m_refresher;
+    std::mutex m_mutex;
+    std::condition_variable m_stopping;
+
+    // Guarded by m_mutex. A backlog at or below zero means the tier is thought to be empty.
+    std::vector<int64_t> m_backlog;
+    std::vector<double> m_charged;
+
+    std::vector<std::atomic<uint64_t>> m_received;
+    std::atomic<uint64_t> m_processed;
+    std::atomic<uint64_t> m_failed;
+};
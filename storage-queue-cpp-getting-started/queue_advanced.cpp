@@ -17,6 +17,26 @@
 #include "stdafx.h"
 #include "string_util.h"
 #include "queue_advanced.h"
+#include "backlog_monitor.h"
+#include "base64_codec.h"
+#include "delayed_scheduler.h"
+#include "queue_bulk_operations.h"
+#include "claim_check.h"
+#include "lease_manager.h"
+#include "queue_consumer.h"
+#include "message_batch.h"
+#include "message_codec.h"
+#include "message_packing.h"
+#include "message_spool.h"
+#include "poison_queue.h"
+#include "prioritized_queue.h"
+#include "queue_poller.h"
+#include "queue_producer.h"
+#include "sas_token_cache.h"
+#include "session_queue.h"
+#include "sharded_queue.h"
+#include "striped_queue.h"
+#include "throttling_retry_policy.h"
 
 using namespace azure::storage;
 
@@ -31,33 +51,29 @@ void queue_advanced::list_queues(cloud_queue_client queue_client)
 
         utility::string_t queue_prefix = U("my-sample-queue-");
 
+        // Issues the creates and deletes concurrently instead of one at a time.
+        queue_bulk_operations bulk(queue_client);
+
         // Try to generate 5 queues with random name using the prefix
+        std::vector<utility::string_t> names;
         for (int i = 0; i < 5; i++)
         {
-            // Retrieve a reference to a queue.
-            cloud_queue queue = queue_client.get_queue_reference(queue_prefix + string_util::random_string());
-
-            // Create the queue if it doesn't already exist.
-            queue.create_if_not_exists();
+            names.push_back(queue_prefix + string_util::random_string());
         }
 
+        // Create the queues if they don't already exist.
+        bulk.create_queues(names);
+
         ucout << U("Listing all the available queues") << std::endl;
-        queue_result_iterator end_of_results;
-        for (auto it = queue_client.list_queues(queue_prefix); it != end_of_results; ++it)
+        bulk.for_each_queue(queue_prefix, [](const cloud_queue& queue)
         {
-            ucout << U("Queue ") << it->name() << ", URI = " << it->uri().primary_uri().to_string() << std::endl;
-        }
+            ucout << U("Queue ") << queue.name() << ", URI = " << queue.uri().primary_uri().to_string() << std::endl;
+        });
 
         ucout << U("Deleting queues") << std::endl;
 
-        for (auto it = queue_client.list_queues(queue_prefix); it != end_of_results; ++it)
-        {
-            // Retrieve a reference to a queue.
-            cloud_queue queue = queue_client.get_queue_reference(it->name());
-
-            // Delete the queue if it exists.
-            queue.delete_queue_if_exists();
-        }
+        // Delete the queues that exist, listing and deleting at the same time.
+        bulk.delete_queues_with_prefix(queue_prefix);
     }
     catch (const azure::storage::storage_exception& e)
     {
@@ -265,3 +281,1165 @@ void queue_advanced::set_queue_acl(cloud_queue_client queue_client)
         ucout << U("Error:") << e.what() << std::endl << std::endl;
     }
 }
+
+///
+/// This sample shows how to process messages with a pool of workers that prefetch messages,
+/// renew the visibility of long-running messages and delete handled messages asynchronously.
+///
+void queue_advanced::consume_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        ucout << U("Pushing messages to the queue") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            for (int i = 0; i < 50; i++)
+            {
+                producer.add_message(cloud_queue_message(U("work item ") + string_util::random_string()), nullptr);
+            }
+        }
+
+        ucout << U("Processing messages with a pool of workers") << std::endl;
+
+        queue_consumer_options options;
+        options.worker_count = 4;
+        options.visibility_timeout = std::chrono::seconds(30);
+        options.renewal_margin = std::chrono::seconds(10);
+
+        // Skip messages that come back after being handled, if their delete didn't go through in time.
+        options.deduplicator = std::make_shared<message_deduplicator>();
+
+        std::mutex output_mutex;
+        queue_consumer consumer(queue, [&output_mutex](const cloud_queue_message& message)
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            ucout << U("Processed: ") << message.content_as_string() << std::endl;
+        }, options);
+
+        consumer.start();
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+        consumer.stop();
+
+        ucout << U("Received ") << consumer.received_count() << U(", processed ") << consumer.processed_count() << U(", renewed ") << consumer.renewed_count() << std::endl;
+        ucout << U("Skipped ") << consumer.duplicate_count() << U(" duplicates, dedupe hit rate ") << options.deduplicator->hit_rate() << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to pack many small records into each queue message, so that each
+/// record doesn't cost a storage transaction of its own.
+///
+void queue_advanced::pack_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        ucout << U("Packing 1000 records into queue messages") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            queue_message_packer packer(producer);
+            for (int i = 0; i < 1000; i++)
+            {
+                packer.add(utility::conversions::to_utf8string(U("record ") + string_util::random_string()));
+            }
+
+            packer.flush();
+            ucout << U("Sent ") << packer.records_added() << U(" records in ") << packer.messages_sent() << U(" messages") << std::endl;
+        }
+
+        ucout << U("Unpacking records") << std::endl;
+        size_t records = 0;
+        std::vector<uint8_t> content;
+        std::vector<cloud_queue_message> messages = queue.get_messages(32);
+        for (auto it = messages.begin(); it != messages.end(); ++it)
+        {
+            // The content is decoded into one reused buffer, and the view reads the records in place.
+            packed_message_view view = packed_message_view::from_message(*it, content);
+            for (auto record = view.begin(); record != view.end(); ++record)
+            {
+                records++;
+            }
+
+            queue.delete_message(*it);
+        }
+
+        ucout << U("Received ") << records << U(" records in ") << messages.size() << U(" messages") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to compress packed messages, so that each message holds more records.
+///
+void queue_advanced::compress_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        // Records that share most of their text compress well, so frames can hold more of them.
+        std::shared_ptr<message_codec> codec = std::make_shared<message_codec>();
+
+        ucout << U("Packing and compressing 5000 records") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            queue_message_packer packer(producer, 0, std::chrono::milliseconds(100), codec);
+            for (int i = 0; i < 5000; i++)
+            {
+                packer.add("{\"sensor\":\"building-7/floor-3\",\"reading\":" + std::to_string(i % 100) + "}");
+            }
+
+            packer.flush();
+            ucout << U("Sent ") << packer.records_added() << U(" records in ") << packer.messages_sent() << U(" messages") << std::endl;
+        }
+
+        message_codec_stats sent = codec->stats();
+        ucout << U("Compressed ") << sent.compressed_messages << U(" of ") << sent.encoded_messages << U(" messages, ratio ")
+            << sent.compression_ratio() << U(", ") << sent.encode_time.count() << U(" us") << std::endl;
+
+        ucout << U("Decompressing records") << std::endl;
+        size_t records = 0;
+        size_t messages = 0;
+        for (;;)
+        {
+            std::vector<cloud_queue_message> batch = queue.get_messages(32);
+            if (batch.empty())
+            {
+                break;
+            }
+
+            for (auto it = batch.begin(); it != batch.end(); ++it)
+            {
+                packed_message_view view = packed_message_view::from_message(*it, *codec);
+                records += view.size();
+                queue.delete_message(*it);
+            }
+
+            messages += batch.size();
+        }
+
+        ucout << U("Received ") << records << U(" records in ") << messages << U(" messages, decode took ")
+            << codec->stats().decode_time.count() << U(" us") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to enqueue through a local spool file, so that adding a message
+/// doesn't wait on the service and survives the service being unreachable for a while.
+///
+void queue_advanced::spool_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        message_spool_options options;
+        options.directory = "queue-spool";
+        options.segment_size = 1024 * 1024;
+
+        {
+            // Messages left over from an earlier run that stopped before sending them go out first.
+            message_spool spool(queue, options);
+            if (spool.replayed_count() > 0)
+            {
+                ucout << U("Replaying ") << spool.replayed_count() << U(" messages from the previous run") << std::endl;
+            }
+
+            ucout << U("Spooling 500 messages") << std::endl;
+            for (int i = 0; i < 500; i++)
+            {
+                // Returns once the message is in the local spool file, without waiting for the service.
+                spool.append(U("spooled message ") + utility::conversions::print_string(i));
+            }
+
+            spool.flush();
+            ucout << U("Sent ") << spool.sent_count() << U(" messages, ") << spool.retry_count() << U(" retried batches") << std::endl;
+        }
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to keep many received messages invisible while they are worked on,
+/// renewing each one shortly before its visibility timeout runs out.
+///
+void queue_advanced::renew_leases(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        ucout << U("Pushing messages to the queue") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            for (int i = 0; i < 32; i++)
+            {
+                producer.add_message(cloud_queue_message(U("long job ") + utility::conversions::print_string(i)), nullptr);
+            }
+        }
+
+        lease_manager_options options;
+        options.visibility_timeout = std::chrono::seconds(4);
+        options.renewal_margin = std::chrono::seconds(2);
+        lease_manager leases(queue, options);
+
+        // Receive the messages with a short visibility timeout and let the lease manager extend it.
+        queue_request_options request_options;
+        std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now();
+        std::vector<cloud_queue_message> messages = queue.get_messages(32, options.visibility_timeout, request_options, operation_context());
+        std::vector<lease_manager::lease_id> ids;
+        for (auto it = messages.begin(); it != messages.end(); ++it)
+        {
+            ids.push_back(leases.track(*it, requested + options.visibility_timeout));
+        }
+
+        ucout << U("Working on ") << ids.size() << U(" messages for longer than their visibility timeout") << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+
+        // Delete each message with the pop receipt of its latest renewal.
+        for (auto it = ids.begin(); it != ids.end(); ++it)
+        {
+            cloud_queue_message message;
+            if (leases.release(*it, message))
+            {
+                queue.delete_message(message);
+            }
+        }
+
+        ucout << U("Renewed ") << leases.renewed_count() << U(" times, lost ") << leases.lost_count() << U(" leases") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to receive into one reusable batch, reading message fields in place
+/// instead of copying each message's content into a new string.
+///
+void queue_advanced::receive_batches(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        ucout << U("Pushing binary messages to the queue") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            utility::string_t text;
+            for (int i = 0; i < 100; i++)
+            {
+                std::vector<uint8_t> payload(256, static_cast<uint8_t>(i));
+                cloud_queue_message message;
+                base64_codec::set_content(message, payload.data(), payload.size(), text);
+                producer.add_message(message, nullptr);
+            }
+        }
+
+        // The batch and the payload buffer are reused for every receive.
+        message_batch batch;
+        std::vector<uint8_t> payload;
+        queue_request_options options;
+        uint64_t total = 0;
+        size_t received = 0;
+        while (true)
+        {
+            batch.receive(queue, 32, std::chrono::seconds(30), options, operation_context());
+            if (batch.empty())
+            {
+                break;
+            }
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                batch.binary_content(i, payload);
+                total += payload.empty() ? 0 : payload[0];
+                cloud_queue_message message = batch.message(i);
+                queue.delete_message(message);
+            }
+
+            received += batch.size();
+        }
+
+        ucout << U("Received ") << received << U(" messages, checksum ") << total << U(", batch storage ") << batch.capacity_bytes() << U(" bytes") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to move messages that keep failing to a poison queue, so they stop
+/// cycling through the consumer, and how to replay them once the problem is fixed.
+///
+void queue_advanced::route_poison_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queues") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        // The poison queue is named after the source queue, here my-sample-queue-poison.
+        poison_queue_options poison_options;
+        poison_options.max_dequeue_count = 3;
+        std::shared_ptr<poison_queue> poison = std::make_shared<poison_queue>(queue, poison_options);
+        poison->create_if_not_exists();
+
+        ucout << U("Pushing messages to the queue, one of which the handler can't process") << std::endl;
+        {
+            queue_producer producer(queue, 16);
+            for (int i = 0; i < 20; i++)
+            {
+                producer.add_message(cloud_queue_message(U("work item ") + string_util::random_string()), nullptr);
+            }
+            producer.add_message(cloud_queue_message(U("malformed item")), nullptr);
+        }
+
+        queue_consumer_options options;
+        options.dead_letter = poison;
+
+        std::atomic<bool> fixed(false);
+        queue_consumer consumer(queue, [&fixed](const cloud_queue_message& message)
+        {
+            if (!fixed && message.content_as_string() == U("malformed item"))
+            {
+                throw std::runtime_error("Can't process this message");
+            }
+        }, options);
+
+        consumer.start();
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+        consumer.stop();
+
+        ucout << U("Processed ") << consumer.processed_count() << U(", failed ") << consumer.failed_count() << U(", moved to ") << poison->queue().name() << U(": ") << consumer.dead_lettered_count() << std::endl;
+
+        ucout << U("Replaying poison messages after fixing the handler") << std::endl;
+        fixed = true;
+        size_t replayed = poison->replay();
+
+        consumer.start();
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        consumer.stop();
+
+        ucout << U("Replayed ") << replayed << U(", processed ") << consumer.processed_count() << U(" in total") << std::endl;
+
+        ucout << U("Deleting queues") << std::endl;
+
+        // Delete queues
+        poison->queue().delete_queue_if_exists();
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to give urgent messages priority over a backlog of bulk work by
+/// keeping a queue per priority and sharing receives between them by weight.
+///
+void queue_advanced::prioritize_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queues") << std::endl;
+
+        // Tier 0 (my-sample-priority-0) gets 8 receives for every 3 of tier 1 and 1 of tier 2.
+        prioritized_queue queue = prioritized_queue::create(queue_client, U("my-sample-priority"), { 8, 3, 1 });
+
+        ucout << U("Pushing a bulk backfill, then a few urgent messages") << std::endl;
+        {
+            std::vector<pplx::task<void>> adds;
+            std::vector<std::shared_ptr<cloud_queue_message>> messages;
+            for (int i = 0; i < 220; i++)
+            {
+                size_t tier = i < 200 ? 2 : 0;
+                messages.push_back(std::make_shared<cloud_queue_message>(tier == 0 ? U("urgent") : U("backfill")));
+                adds.push_back(queue.add_message_async(*messages.back(), tier));
+            }
+
+            pplx::when_all(adds.begin(), adds.end()).wait();
+        }
+
+        prioritized_queue_consumer_options options;
+        options.scheduling = priority_scheduling::weighted;
+        options.worker_count = 2;
+
+        std::atomic<int> handled(0);
+        std::atomic<int> last_urgent(0);
+        prioritized_queue_consumer consumer(queue, [&handled, &last_urgent](const cloud_queue_message& message)
+        {
+            int position = ++handled;
+            if (message.content_as_string() == U("urgent"))
+            {
+                last_urgent = position;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }, options);
+
+        consumer.start();
+        for (int i = 0; i < 100 && handled < 220; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        consumer.stop();
+
+        ucout << U("Handled ") << handled << U(" messages; the last urgent one was number ") << last_urgent << std::endl;
+        for (size_t i = 0; i < queue.tier_count(); i++)
+        {
+            ucout << U("Tier ") << i << U(" received ") << consumer.received_count(i) << std::endl;
+        }
+
+        ucout << U("Deleting queues") << std::endl;
+
+        // Delete queues
+        queue.delete_tiers_if_exist();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to watch the backlog of many queues at once, with growth rates and
+/// time-to-empty estimates an autoscaler can read without waiting on the service.
+///
+void queue_advanced::monitor_backlog(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queues") << std::endl;
+
+        utility::string_t queue_prefix = U("my-sample-backlog-");
+        queue_bulk_operations bulk(queue_client);
+
+        std::vector<cloud_queue> queues;
+        std::vector<utility::string_t> names;
+        for (int i = 0; i < 8; i++)
+        {
+            names.push_back(queue_prefix + utility::conversions::print_string(i));
+            queues.push_back(queue_client.get_queue_reference(names.back()));
+        }
+        bulk.create_queues(names);
+
+        backlog_monitor_options options;
+        options.prefix = queue_prefix;
+        backlog_monitor monitor(queue_client, options);
+
+        // Queue i gets i messages per round, so the later queues grow faster.
+        ucout << U("Adding messages between sweeps") << std::endl;
+        for (int round = 0; round < 4; round++)
+        {
+            for (size_t i = 0; i < queues.size(); i++)
+            {
+                for (size_t j = 0; j < i; j++)
+                {
+                    cloud_queue_message message(U("backlog item"));
+                    queues[i].add_message(message);
+                }
+            }
+
+            monitor.sample();
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+
+        // Readers take the latest snapshot; this doesn't call the service.
+        std::shared_ptr<const backlog_snapshot> snapshot = monitor.snapshot();
+        for (auto it = snapshot->queues.begin(); it != snapshot->queues.end(); ++it)
+        {
+            ucout << it->name << U(": ") << it->message_count << U(" messages, growing ") << it->growth_rate << U(" per second") << std::endl;
+        }
+        ucout << U("Total ") << snapshot->total_messages << U(" messages, last sweep took ") << snapshot->sweep_duration.count() << U(" ms") << std::endl;
+
+        ucout << U("Deleting queues") << std::endl;
+
+        // Delete the queues that exist, listing and deleting at the same time.
+        bulk.delete_queues_with_prefix(queue_prefix);
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to hand out shared access signatures for a queue without signing a
+/// new one for every request.
+///
+void queue_advanced::cache_sas_tokens(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        // Tokens last an hour and are signed again in the background 10 minutes before they expire.
+        sas_token_cache_options options;
+        options.token_lifetime = std::chrono::hours(1);
+        options.refresh_margin = std::chrono::minutes(10);
+        sas_token_cache tokens(options);
+
+        ucout << U("Handing out tokens for 1000 requests") << std::endl;
+        uint8_t permissions = queue_shared_access_policy::permissions::add | queue_shared_access_policy::permissions::process;
+        for (int i = 0; i < 1000; i++)
+        {
+            tokens.get(queue, utility::string_t(), permissions);
+        }
+
+        // A client holding only the token can use the queue.
+        cloud_queue client_queue(queue.uri(), storage_credentials(*tokens.get(queue, utility::string_t(), permissions)));
+        cloud_queue_message message(U("Hello from a SAS client"));
+        client_queue.add_message(message);
+
+        ucout << U("Signed ") << tokens.miss_count() << U(" tokens for ") << tokens.hit_count() + tokens.miss_count() << U(" requests, hit rate ") << tokens.hit_rate() << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to spread one logical queue over several storage accounts, moving
+/// load away from accounts that throttle, and drain every account fairly.
+///
+void queue_advanced::stripe_accounts(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queues") << std::endl;
+
+        // With real accounts this would be striped_queue(connection_strings, U("my-sample-queue")).
+        // The sample has one account, so its stripes are two queues in it.
+        std::vector<cloud_queue> stripes;
+        stripes.push_back(queue_client.get_queue_reference(U("my-sample-stripe-0")));
+        stripes.push_back(queue_client.get_queue_reference(U("my-sample-stripe-1")));
+        striped_queue queue(stripes);
+        queue.create_if_not_exists();
+
+        ucout << U("Pushing messages to the stripes") << std::endl;
+        {
+            std::vector<std::shared_ptr<cloud_queue_message>> messages;
+            std::vector<pplx::task<void>> adds;
+            for (int i = 0; i < 100; i++)
+            {
+                messages.push_back(std::make_shared<cloud_queue_message>(U("work item ") + string_util::random_string()));
+                adds.push_back(queue.add_message_async(*messages.back()));
+            }
+
+            pplx::when_all(adds.begin(), adds.end()).wait();
+        }
+
+        for (size_t i = 0; i < queue.stripe_count(); i++)
+        {
+            ucout << queue.stripe(i).name() << U(": added ") << queue.added_count(i) << U(", throttled ") << queue.throttled_count(i) << U(", weight ") << queue.weight(i) << std::endl;
+        }
+
+        ucout << U("Draining every stripe") << std::endl;
+
+        // Two workers per stripe; a worker whose stripe runs dry helps with the others.
+        sharded_queue_consumer_options options;
+        options.worker_count = queue.stripe_count() * 2;
+
+        std::atomic<int> processed(0);
+        sharded_queue_consumer consumer(queue.shards(), [&processed](const cloud_queue_message&)
+        {
+            processed++;
+        }, options);
+
+        consumer.start();
+        for (int i = 0; i < 50 && processed < 100; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        consumer.stop();
+
+        ucout << U("Processed ") << processed << U(" messages") << std::endl;
+
+        ucout << U("Deleting queues") << std::endl;
+
+        // Delete queues
+        queue.delete_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to handle messages in order within each session while handling
+/// different sessions in parallel.
+///
+void queue_advanced::order_sessions(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue-") + string_util::random_string());
+        queue.create_if_not_exists();
+
+        // Adds are sent concurrently, so messages of a session reach the queue in any order.
+        ucout << U("Pushing messages for three sessions") << std::endl;
+        session_producer producer(queue);
+        {
+            std::vector<pplx::task<void>> adds;
+            for (int i = 0; i < 20; i++)
+            {
+                adds.push_back(producer.add_message_async(U("order-a"), U("step ") + utility::conversions::print_string(i)));
+                adds.push_back(producer.add_message_async(U("order-b"), U("step ") + utility::conversions::print_string(i)));
+                adds.push_back(producer.add_message_async(U("order-c"), U("step ") + utility::conversions::print_string(i)));
+            }
+
+            pplx::when_all(adds.begin(), adds.end()).wait();
+        }
+
+        ucout << U("Handling messages in session order") << std::endl;
+
+        // Only one worker runs a session at a time, so each session's position needs no lock.
+        std::mutex positions_mutex;
+        std::map<utility::string_t, uint64_t> positions;
+        std::atomic<int> out_of_order(0);
+        std::atomic<int> processed(0);
+
+        session_consumer_options options;
+        options.worker_count = 3;
+        session_consumer consumer(queue, [&](const session_message& message)
+        {
+            // Out of order messages run outside their session, so they leave its position alone.
+            if (message.out_of_order)
+            {
+                out_of_order++;
+                processed++;
+                return;
+            }
+
+            uint64_t* position;
+            {
+                std::lock_guard<std::mutex> lock(positions_mutex);
+                position = &positions[message.session];
+            }
+
+            if (message.sequence != *position)
+            {
+                out_of_order++;
+            }
+
+            *position = message.sequence + 1;
+            processed++;
+        }, options);
+
+        consumer.start();
+        for (int i = 0; i < 100 && processed < 60; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        consumer.stop();
+
+        ucout << U("Processed ") << processed << U(" messages, ") << consumer.parked_count() << U(" parked until their turn, ")
+            << out_of_order << U(" out of order") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to schedule many messages for delivery at future times, including
+/// times further away than the service's seven-day visibility limit.
+///
+void queue_advanced::schedule_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating queue") << std::endl;
+
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue-") + string_util::random_string());
+        queue.create_if_not_exists();
+
+        // Most items are due within seconds; the last ones are a month away and travel in hops.
+        ucout << U("Scheduling a batch of messages") << std::endl;
+        delayed_scheduler scheduler(queue);
+
+        std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+        std::vector<scheduled_message> batch;
+        for (int i = 0; i < 100; i++)
+        {
+            batch.push_back(scheduled_message(U("reminder ") + utility::conversions::print_string(i), now + std::chrono::seconds(i % 5)));
+        }
+        for (int i = 0; i < 5; i++)
+        {
+            batch.push_back(scheduled_message(U("renewal ") + utility::conversions::print_string(i), now + std::chrono::hours(24 * 30)));
+        }
+
+        std::vector<size_t> failed = scheduler.schedule(batch);
+        if (!failed.empty())
+        {
+            // Retry only the items that failed.
+            std::vector<scheduled_message> retry;
+            for (auto it = failed.begin(); it != failed.end(); ++it)
+            {
+                retry.push_back(batch[*it]);
+            }
+            failed = scheduler.schedule(retry);
+        }
+
+        ucout << U("Scheduled ") << scheduler.scheduled_count() << U(" messages, ") << failed.size() << U(" failed") << std::endl;
+
+        ucout << U("Receiving messages as they come due") << std::endl;
+
+        std::atomic<int> delivered(0);
+        queue_consumer consumer(queue, scheduler.handler([&delivered](const utility::string_t&)
+        {
+            delivered++;
+        }));
+
+        consumer.start();
+        for (int i = 0; i < 100 && delivered < 100; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        consumer.stop();
+
+        ucout << U("Delivered ") << delivered << U(" messages; the rest are still waiting for their due time") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to send payloads larger than a queue message through blob storage
+/// and stream them back on the consumer side.
+///
+void queue_advanced::claim_check_messages(cloud_storage_account storage_account)
+{
+    try
+    {
+        ucout << U("Creating queue and blob container") << std::endl;
+
+        // Retrieve a reference to a queue and to the container that holds large payloads.
+        cloud_queue queue = storage_account.create_cloud_queue_client().get_queue_reference(U("my-sample-queue"));
+        cloud_blob_container container = storage_account.create_cloud_blob_client().get_container_reference(U("my-sample-claim-checks"));
+
+        // Create them if they don't already exist.
+        queue.create_if_not_exists();
+        container.create_if_not_exists();
+
+        claim_check checker(queue, container);
+
+        ucout << U("Sending a 10 MB payload and a 1 KB payload") << std::endl;
+        checker.send(std::vector<uint8_t>(10 * 1024 * 1024, 'x'));
+        checker.send(std::vector<uint8_t>(1024, 'y'));
+        ucout << U("Sent ") << checker.reference_count() << U(" by reference and ") << checker.inline_count() << U(" inline") << std::endl;
+
+        // Delete each blob once the consumer has deleted the message that refers to it.
+        queue_consumer_options options;
+        options.acknowledged_handler = [&checker](const cloud_queue_message& message)
+        {
+            checker.release_payload(message);
+        };
+
+        std::atomic<uint64_t> received_bytes(0);
+        queue_consumer consumer(queue, [&checker, &received_bytes](const cloud_queue_message& message)
+        {
+            // Read the payload in 64 KB pieces; a large one is never held in memory whole.
+            concurrency::streams::istream payload = checker.open_payload(message);
+            while (true)
+            {
+                concurrency::streams::container_buffer<std::vector<uint8_t>> chunk;
+                size_t read = payload.read(chunk, 64 * 1024).get();
+                if (read == 0)
+                {
+                    break;
+                }
+
+                received_bytes += read;
+            }
+
+            payload.close().wait();
+        }, options);
+
+        ucout << U("Streaming payloads") << std::endl;
+        consumer.start();
+        for (int i = 0; i < 600 && consumer.processed_count() < 2; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        consumer.stop();
+        ucout << U("Received ") << received_bytes << U(" bytes in ") << consumer.processed_count() << U(" messages, released ")
+            << checker.released_count() << U(" blobs") << std::endl;
+
+        ucout << U("Deleting queue and blob container") << std::endl;
+
+        // Delete queue and container
+        queue.delete_queue_if_exists();
+        container.delete_container_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to spread one logical queue over several queues.
+///
+void queue_advanced::shard_messages(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating 4 shards") << std::endl;
+
+        // Create the queues my-sample-shard-0 .. my-sample-shard-3 if they don't already exist.
+        sharded_queue::create(queue_client, U("my-sample-shard-"), 4);
+
+        // Any process can find the same shards by their prefix.
+        sharded_queue queue = sharded_queue::discover(queue_client, U("my-sample-shard-"));
+
+        ucout << U("Adding 100 messages routed by customer") << std::endl;
+        for (int i = 0; i < 100; i++)
+        {
+            // Messages for one customer always land on the same shard.
+            utility::string_t customer = U("customer-") + utility::conversions::print_string(i % 10);
+            cloud_queue_message message(U("order ") + utility::conversions::print_string(i) + U(" for ") + customer);
+            queue.add_message(message, customer);
+        }
+
+        ucout << U("Consuming from all shards") << std::endl;
+        sharded_queue_consumer consumer(queue, [](const cloud_queue_message&)
+        {
+        });
+
+        consumer.start();
+        for (int i = 0; i < 300 && consumer.processed_count() < 100; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        consumer.stop();
+        for (size_t shard = 0; shard < queue.shard_count(); shard++)
+        {
+            ucout << U("Shard ") << queue.shard(shard).name() << U(": ") << consumer.received_count(shard) << U(" messages") << std::endl;
+        }
+
+        ucout << U("Processed ") << consumer.processed_count() << U(" messages, ") << consumer.stolen_count() << U(" taken from another worker's shard") << std::endl;
+
+        ucout << U("Deleting shards") << std::endl;
+
+        // Delete queues
+        queue.delete_shards_if_exist();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to poll several queues from one thread, backing off on the ones
+/// that stay empty.
+///
+void queue_advanced::poll_queues(cloud_queue_client queue_client)
+{
+    try
+    {
+        ucout << U("Creating 3 queues") << std::endl;
+
+        std::vector<cloud_queue> queues;
+        for (int i = 0; i < 3; i++)
+        {
+            // Retrieve a reference to a queue.
+            queues.push_back(queue_client.get_queue_reference(U("my-sample-poll-") + utility::conversions::print_string(i)));
+
+            // Create the queue if it doesn't already exist.
+            queues.back().create_if_not_exists();
+        }
+
+        std::atomic<int> handled(0);
+        queue_poller poller;
+        for (auto it = queues.begin(); it != queues.end(); ++it)
+        {
+            poller.add_queue(*it, [&handled](cloud_queue& queue, std::vector<cloud_queue_message>& messages)
+            {
+                for (auto message = messages.begin(); message != messages.end(); ++message)
+                {
+                    queue.delete_message(*message);
+                    handled++;
+                }
+            });
+        }
+
+        poller.start();
+
+        // Let the empty queues back off, then add messages to one of them.
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+
+        ucout << U("Adding 10 messages to ") << queues[0].name() << std::endl;
+        for (int i = 0; i < 10; i++)
+        {
+            cloud_queue_message message(U("polled message ") + utility::conversions::print_string(i));
+            queues[0].add_message(message);
+        }
+
+        // The producer knows it added messages, so it skips the rest of the backoff.
+        poller.wake(queues[0].name());
+        for (int i = 0; i < 100 && handled < 10; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        poller.stop();
+        ucout << U("Handled ") << handled << U(" messages in ") << poller.poll_count() << U(" receives (") << poller.empty_poll_count()
+            << U(" empty) over ") << poller.wakeup_count() << U(" wake-ups") << std::endl;
+
+        ucout << U("Deleting queues") << std::endl;
+
+        // Delete queues
+        for (auto it = queues.begin(); it != queues.end(); ++it)
+        {
+            it->delete_queue_if_exists();
+        }
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
+
+///
+/// This sample shows how to share one send rate and retry policy between all requests, so
+/// that clients slow down together when the service is busy instead of retrying in lock-step.
+///
+void queue_advanced::throttle_requests(cloud_queue_client queue_client)
+{
+    try
+    {
+        throttling_options options;
+        options.initial_rate = 50;
+        std::shared_ptr<throttling_controller> controller = std::make_shared<throttling_controller>(options);
+
+        // Every request made through this client now retries with the throttling-aware policy.
+        // First attempts are paced by calling acquire() before each one.
+        controller->apply(queue_client);
+
+        ucout << U("Creating queue") << std::endl;
+
+        // Retrieve a reference to a queue.
+        cloud_queue queue = queue_client.get_queue_reference(U("my-sample-queue"));
+
+        // Create the queue if it doesn't already exist.
+        queue.create_if_not_exists();
+
+        // Responses on this context tell the controller when the service is back after an outage.
+        queue_request_options request_options;
+        operation_context context;
+        controller->instrument(context);
+
+        ucout << U("Adding 100 messages at up to ") << controller->current_rate() << U(" per second") << std::endl;
+        for (int i = 0; i < 100; i++)
+        {
+            // Waits for the shared rate limit; throws circuit_open_exception during an outage.
+            controller->acquire();
+
+            cloud_queue_message message(U("throttled message ") + utility::conversions::print_string(i));
+            queue.add_message(message, queue_producer::default_time_to_live, std::chrono::seconds(0), request_options, context);
+        }
+
+        ucout << U("Throttled responses: ") << controller->throttled_count() << U(", rate now ") << controller->current_rate() << U(" per second") << std::endl;
+
+        ucout << U("Deleting queue") << std::endl;
+
+        // Delete queue
+        queue.delete_queue_if_exists();
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << std::endl;
+    }
+}
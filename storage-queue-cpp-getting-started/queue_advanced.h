@@ -25,5 +25,22 @@ public:
     static void set_service_properties(cloud_queue_client queue_client);
     static void set_metadata_and_properties(cloud_queue_client queue_client);
     static void set_queue_acl(cloud_queue_client queue_client);
+    static void consume_messages(cloud_queue_client queue_client);
+    static void pack_messages(cloud_queue_client queue_client);
+    static void compress_messages(cloud_queue_client queue_client);
+    static void shard_messages(cloud_queue_client queue_client);
+    static void poll_queues(cloud_queue_client queue_client);
+    static void throttle_requests(cloud_queue_client queue_client);
+    static void spool_messages(cloud_queue_client queue_client);
+    static void renew_leases(cloud_queue_client queue_client);
+    static void receive_batches(cloud_queue_client queue_client);
+    static void route_poison_messages(cloud_queue_client queue_client);
+    static void prioritize_messages(cloud_queue_client queue_client);
+    static void monitor_backlog(cloud_queue_client queue_client);
+    static void cache_sas_tokens(cloud_queue_client queue_client);
+    static void stripe_accounts(cloud_queue_client queue_client);
+    static void order_sessions(cloud_queue_client queue_client);
+    static void schedule_messages(cloud_queue_client queue_client);
+    static void claim_check_messages(cloud_storage_account storage_account);
 };
 
@@ -16,6 +16,8 @@
 
 #include "stdafx.h"
 #include "queue_basic.h"
+#include "operation_metrics.h"
+#include "queue_producer.h"
 #include "string_util.h"
 
 using namespace azure::storage;
@@ -38,12 +40,21 @@ void queue_basic::queue_operations(cloud_queue_client queue_client)
         cloud_queue_message first_message(U("First Message"));
         queue.add_message(first_message);
 
-        // Add more messages to the queue
+        // Add more messages to the queue. The producer keeps several adds in flight at once
+        // instead of waiting for each round trip before sending the next message.
+        queue_producer producer(queue, 16);
+        std::vector<pplx::task<void>> pending_adds;
         for (int i = 0; i < 5; i++)
         {
             // Create a message and add it to the queue.
             cloud_queue_message message(U("other message ") + string_util::random_string());
-            queue.add_message(message);
+            pending_adds.push_back(producer.add_message(message));
+        }
+
+        // Wait for the adds to complete; get() rethrows the first failure.
+        for (auto it = pending_adds.begin(); it != pending_adds.end(); ++it)
+        {
+            it->get();
         }
 
         // Storage queues are not strictly ordered so while you'll almost always get the first message 'First Message', 
@@ -67,7 +78,11 @@ void queue_basic::queue_operations(cloud_queue_client queue_client)
         // Dequeue some queue messages (maximum 32 at a time) and set their visibility timeout to
         // 5 minutes (300 seconds).
         queue_request_options options;
+
+        // Record the latency, retries and status codes of the requests made with the context.
+        operation_metrics metrics;
         operation_context context;
+        metrics.instrument(context);
 
         // Retrieve 20 messages from the queue with a visibility timeout of 300 seconds.
         std::vector<azure::storage::cloud_queue_message> messages = queue.get_messages(20, std::chrono::seconds(300), options, context);
@@ -77,6 +92,8 @@ void queue_basic::queue_operations(cloud_queue_client queue_client)
             ucout << U("Got: ") << it->content_as_string() << std::endl;
         }
 
+        ucout << U("Request metrics: ") << metrics.to_json() << std::endl;
+
         ucout << U('Getting queue attributes') << std::endl;
         queue.download_attributes();
 
@@ -0,0 +1,228 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "queue_bulk_operations.h"
+
+using namespace azure::storage;
+
+queue_bulk_options::queue_bulk_options()
+    : max_concurrency(32), segment_size(1000)
+{
+}
+
+queue_bulk_operations::window::window(size_t max_in_flight)
+    : m_max_in_flight(max_in_flight > 0 ? max_in_flight : 1), m_in_flight(0), m_changed(0)
+{
+}
+
+void queue_bulk_operations::window::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_in_flight < m_max_in_flight; });
+    ++m_in_flight;
+}
+
+void queue_bulk_operations::window::release(bool changed, std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_in_flight;
+        if (changed)
+        {
+            ++m_changed;
+        }
+
+        if (error && !m_error)
+        {
+            m_error = error;
+        }
+    }
+
+    m_condition.notify_all();
+}
+
+size_t queue_bulk_operations::window::wait_all()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_in_flight == 0; });
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+
+    return m_changed;
+}
+
+queue_bulk_operations::queue_bulk_operations(cloud_queue_client queue_client, const queue_bulk_options& options)
+    : m_queue_client(queue_client), m_options(options)
+{
+}
+
+size_t queue_bulk_operations::create_queues(const std::vector<utility::string_t>& names)
+{
+    std::shared_ptr<window> requests = std::make_shared<window>(m_options.max_concurrency);
+    for (auto it = names.begin(); it != names.end(); ++it)
+    {
+        create_queue(requests, *it);
+    }
+
+    return requests->wait_all();
+}
+
+size_t queue_bulk_operations::delete_queues(const std::vector<utility::string_t>& names)
+{
+    std::shared_ptr<window> requests = std::make_shared<window>(m_options.max_concurrency);
+    for (auto it = names.begin(); it != names.end(); ++it)
+    {
+        delete_queue(requests, *it);
+    }
+
+    return requests->wait_all();
+}
+
+size_t queue_bulk_operations::delete_queues_with_prefix(const utility::string_t& prefix)
+{
+    // Deletes start as soon as their segment arrives instead of after the whole listing.
+    std::shared_ptr<window> requests = std::make_shared<window>(m_options.max_concurrency);
+    try
+    {
+        for_each_queue(prefix, [this, &requests](const cloud_queue& queue)
+        {
+            delete_queue(requests, queue.name());
+        });
+    }
+    catch (...)
+    {
+        try
+        {
+            requests->wait_all();
+        }
+        catch (...)
+        {
+        }
+
+        throw;
+    }
+
+    return requests->wait_all();
+}
+
+void queue_bulk_operations::for_each_queue(const utility::string_t& prefix, const std::function<void(const cloud_queue& queue)>& visitor)
+{
+    pplx::task<queue_result_segment> next = m_queue_client.list_queues_segmented_async(prefix, false, m_options.segment_size,
+        continuation_token(), m_options.request_options, operation_context());
+
+    while (true)
+    {
+        queue_result_segment segment = next.get();
+        bool more = !segment.continuation_token().empty();
+        if (more)
+        {
+            next = m_queue_client.list_queues_segmented_async(prefix, false, m_options.segment_size,
+                segment.continuation_token(), m_options.request_options, operation_context());
+        }
+
+        try
+        {
+            for (auto it = segment.results().begin(); it != segment.results().end(); ++it)
+            {
+                visitor(*it);
+            }
+        }
+        catch (...)
+        {
+            // Don't leave the prefetched segment unobserved.
+            if (more)
+            {
+                try
+                {
+                    next.wait();
+                }
+                catch (...)
+                {
+                }
+            }
+
+            throw;
+        }
+
+        if (!more)
+        {
+            return;
+        }
+    }
+}
+
+void queue_bulk_operations::create_queue(const std::shared_ptr<window>& requests, const utility::string_t& name)
+{
+    std::shared_ptr<cloud_queue> queue = std::make_shared<cloud_queue>(m_queue_client.get_queue_reference(name));
+
+    requests->acquire();
+    pplx::task<bool> operation;
+    try
+    {
+        operation = queue->create_if_not_exists_async(m_options.request_options, operation_context());
+    }
+    catch (...)
+    {
+        operation = pplx::task_from_exception<bool>(std::current_exception());
+    }
+
+    track(requests, queue, operation);
+}
+
+void queue_bulk_operations::delete_queue(const std::shared_ptr<window>& requests, const utility::string_t& name)
+{
+    std::shared_ptr<cloud_queue> queue = std::make_shared<cloud_queue>(m_queue_client.get_queue_reference(name));
+
+    requests->acquire();
+    pplx::task<bool> operation;
+    try
+    {
+        operation = queue->delete_queue_if_exists_async(m_options.request_options, operation_context());
+    }
+    catch (...)
+    {
+        operation = pplx::task_from_exception<bool>(std::current_exception());
+    }
+
+    track(requests, queue, operation);
+}
+
+///
+/// Releases the request's slot once it finishes. The queue is captured so it outlives the
+/// request.
+///
+void queue_bulk_operations::track(const std::shared_ptr<window>& requests, const std::shared_ptr<cloud_queue>& queue, pplx::task<bool> operation)
+{
+    operation.then([requests, queue](pplx::task<bool> previous)
+    {
+        bool changed = false;
+        std::exception_ptr error;
+        try
+        {
+            changed = previous.get();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        requests->release(changed, error);
+    });
+}
@@ -0,0 +1,98 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Settings for queue_bulk_operations.
+///
+struct queue_bulk_options
+{
+    queue_bulk_options();
+
+    // Maximum number of create or delete requests outstanding at once.
+    size_t max_concurrency;
+
+    // Queues requested per list_queues_segmented call (the service allows at most 5000).
+    int segment_size;
+
+    queue_request_options request_options;
+};
+
+///
+/// Creates, lists and deletes many queues at once. Creates and deletes are issued
+/// asynchronously with at most max_concurrency in flight, and listings fetch the next segment
+/// while the current one is being processed.
+///
+/// A failed create or delete does not stop the others; once all of them have finished, the
+/// first failure is rethrown.
+///
+class queue_bulk_operations
+{
+public:
+    explicit queue_bulk_operations(cloud_queue_client queue_client, const queue_bulk_options& options = queue_bulk_options());
+
+    // Returns the number of queues that did not exist before.
+    size_t create_queues(const std::vector<utility::string_t>& names);
+
+    // Returns the number of queues that existed.
+    size_t delete_queues(const std::vector<utility::string_t>& names);
+
+    // Lists and deletes every queue whose name starts with the prefix; returns how many were deleted.
+    size_t delete_queues_with_prefix(const utility::string_t& prefix);
+
+    // Calls the visitor for every queue whose name starts with the prefix.
+    void for_each_queue(const utility::string_t& prefix, const std::function<void(const cloud_queue& queue)>& visitor);
+
+private:
+    // Bounds the requests in flight and collects their results.
+    class window
+    {
+    public:
+        explicit window(size_t max_in_flight);
+
+        void acquire();
+        void release(bool changed, std::exception_ptr error);
+
+        // Waits for every request, then rethrows the first failure if there was one.
+        size_t wait_all();
+
+    private:
+        size_t m_max_in_flight;
+        size_t m_in_flight;
+        size_t m_changed;
+        std::exception_ptr m_error;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+    };
+
+    void create_queue(const std::shared_ptr<window>& requests, const utility::string_t& name);
+    void delete_queue(const std::shared_ptr<window>& requests, const utility::string_t& name);
+    void track(const std::shared_ptr<window>& requests, const std::shared_ptr<cloud_queue>& queue, pplx::task<bool> operation);
+
+    cloud_queue_client m_queue_client;
+    queue_bulk_options m_options;
+};
@@ -0,0 +1,315 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "queue_consumer.h"
+#include "queue_poller.h"
+
+using namespace azure::storage;
+
+queue_consumer_options::queue_consumer_options()
+    : worker_count(4), prefetch_batch_size(32), prefetch_capacity(64), visibility_timeout(30), renewal_margin(10),
+    max_pending_deletes(64), empty_poll_delay(50), max_empty_poll_delay(10000)
+{
+}
+
+queue_consumer::queue_consumer(cloud_queue queue, message_handler handler)
+    : queue_consumer(queue, handler, queue_consumer_options())
+{
+}
+
+queue_consumer::queue_consumer(cloud_queue queue, message_handler handler, const queue_consumer_options& options)
+    : m_queue(queue), m_handler(handler), m_options(options), m_running(false), m_received(0), m_processed(0),
+    m_failed(0), m_duplicates(0), m_dead_lettered(0)
+{
+    m_options.worker_count = std::max<size_t>(m_options.worker_count, 1);
+    m_options.prefetch_batch_size = std::min<size_t>(std::max<size_t>(m_options.prefetch_batch_size, 1), 32);
+    m_options.prefetch_capacity = std::max(m_options.prefetch_capacity, m_options.prefetch_batch_size);
+    m_options.max_pending_deletes = std::max<size_t>(m_options.max_pending_deletes, 1);
+
+    lease_manager_options lease_options;
+    lease_options.visibility_timeout = m_options.visibility_timeout;
+    lease_options.renewal_margin = m_options.renewal_margin;
+    lease_options.request_options = m_options.request_options;
+    m_leases.reset(new lease_manager(m_queue, lease_options));
+    m_deletes.reset(new delete_window(m_queue, m_options.max_pending_deletes, m_options.request_options));
+}
+
+queue_consumer::~queue_consumer()
+{
+    stop();
+}
+
+void queue_consumer::start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    m_prefetcher = std::thread(&queue_consumer::prefetch_loop, this);
+    for (size_t i = 0; i < m_options.worker_count; i++)
+    {
+        m_workers.push_back(std::thread(&queue_consumer::worker_loop, this));
+    }
+}
+
+void queue_consumer::stop()
+{
+    if (!m_running.exchange(false))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_buffer_mutex);
+        m_buffer_not_empty.notify_all();
+        m_buffer_not_full.notify_all();
+    }
+
+    m_prefetcher.join();
+    for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        it->join();
+    }
+    m_workers.clear();
+
+    std::deque<lease_manager::lease_id> unhandled;
+    {
+        std::lock_guard<std::mutex> lock(m_buffer_mutex);
+        unhandled.swap(m_buffer);
+    }
+
+    for (auto it = unhandled.begin(); it != unhandled.end(); ++it)
+    {
+        release(*it);
+    }
+
+    m_deletes->wait();
+}
+
+uint64_t queue_consumer::received_count() const
+{
+    return m_received;
+}
+
+uint64_t queue_consumer::processed_count() const
+{
+    return m_processed;
+}
+
+uint64_t queue_consumer::failed_count() const
+{
+    return m_failed;
+}
+
+uint64_t queue_consumer::renewed_count() const
+{
+    return m_leases->renewed_count();
+}
+
+uint64_t queue_consumer::lost_lease_count() const
+{
+    return m_leases->lost_count();
+}
+
+uint64_t queue_consumer::duplicate_count() const
+{
+    return m_duplicates;
+}
+
+uint64_t queue_consumer::dead_lettered_count() const
+{
+    return m_dead_lettered;
+}
+
+///
+/// Receives batches while the buffer has room for a full batch, so workers find messages
+/// waiting instead of each paying for a receive round trip.
+///
+void queue_consumer::prefetch_loop()
+{
+    polling_backoff backoff(m_options.empty_poll_delay, m_options.max_empty_poll_delay);
+    while (m_running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_buffer_mutex);
+            m_buffer_not_full.wait(lock, [this]
+            {
+                return !m_running || m_buffer.size() + m_options.prefetch_batch_size <= m_options.prefetch_capacity;
+            });
+
+            if (!m_running)
+            {
+                break;
+            }
+        }
+
+        // Leases are measured from before the request so they never outlive the real timeout.
+        std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now();
+        std::vector<cloud_queue_message> messages;
+        try
+        {
+            messages = m_queue.get_messages(m_options.prefetch_batch_size, m_options.visibility_timeout, m_options.request_options, operation_context());
+        }
+        catch (const std::exception&)
+        {
+            // Treat a failed receive like an empty queue and try again after the delay.
+        }
+
+        std::chrono::milliseconds delay = backoff.next(!messages.empty());
+        if (messages.empty())
+        {
+            std::unique_lock<std::mutex> lock(m_buffer_mutex);
+            m_buffer_not_full.wait_for(lock, delay, [this] { return !m_running; });
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_buffer_mutex);
+        for (auto it = messages.begin(); it != messages.end(); ++it)
+        {
+            m_buffer.push_back(m_leases->track(*it, requested + m_options.visibility_timeout));
+        }
+
+        m_received += messages.size();
+        m_buffer_not_empty.notify_all();
+    }
+}
+
+void queue_consumer::worker_loop()
+{
+    while (true)
+    {
+        lease_manager::lease_id id;
+        {
+            std::unique_lock<std::mutex> lock(m_buffer_mutex);
+            m_buffer_not_empty.wait(lock, [this] { return !m_running || !m_buffer.empty(); });
+
+            // Messages still buffered at shutdown are released by stop().
+            if (!m_running)
+            {
+                return;
+            }
+
+            id = m_buffer.front();
+            m_buffer.pop_front();
+            m_buffer_not_full.notify_one();
+        }
+
+        // The handler gets its own copy; renewals update the pop receipt held by the lease manager.
+        cloud_queue_message message;
+        if (!m_leases->get(id, message))
+        {
+            m_leases->release(id, message);
+            continue;
+        }
+
+        // Checked before deduplication so a message that keeps failing never reaches the handler again.
+        if (m_options.dead_letter && m_options.dead_letter->is_poison(message))
+        {
+            dead_letter(id);
+            continue;
+        }
+
+        // The earlier delivery was handled but not deleted in time, so only the delete is left.
+        if (m_options.deduplicator && m_options.deduplicator->is_duplicate(message))
+        {
+            ++m_duplicates;
+            acknowledge(id);
+            continue;
+        }
+
+        bool handled = false;
+        try
+        {
+            m_handler(message);
+            handled = true;
+        }
+        catch (...)
+        {
+        }
+
+        if (handled)
+        {
+            ++m_processed;
+            if (m_options.deduplicator)
+            {
+                m_options.deduplicator->record(message);
+            }
+
+            acknowledge(id);
+        }
+        else
+        {
+            ++m_failed;
+            release(id);
+        }
+    }
+}
+
+///
+/// Deletes a handled message without blocking the worker, unless max_pending_deletes
+/// deletes are already outstanding.
+///
+void queue_consumer::acknowledge(lease_manager::lease_id id)
+{
+    cloud_queue_message message;
+    if (!m_leases->release(id, message))
+    {
+        // The message may already be with another consumer; it reappears if not.
+        return;
+    }
+
+    m_deletes->remove(message, m_options.acknowledged_handler);
+}
+
+///
+/// Moves a poison message to the dead_letter queue without blocking the worker. Moves share
+/// the max_pending_deletes window with deletes, since each ends in a delete.
+///
+void queue_consumer::dead_letter(lease_manager::lease_id id)
+{
+    cloud_queue_message message;
+    if (!m_leases->release(id, message))
+    {
+        return;
+    }
+
+    std::shared_ptr<poison_queue> target = m_options.dead_letter;
+    m_deletes->start([target, message]
+    {
+        return target->move_async(message);
+    }, [this](bool moved)
+    {
+        // Otherwise the message reappears and is moved again on its next delivery.
+        if (moved)
+        {
+            ++m_dead_lettered;
+        }
+    });
+}
+
+///
+/// Makes a message visible again immediately instead of waiting for its lease to run out.
+///
+void queue_consumer::release(lease_manager::lease_id id)
+{
+    cloud_queue_message message;
+    if (m_leases->release(id, message))
+    {
+        m_deletes->release(message);
+    }
+}
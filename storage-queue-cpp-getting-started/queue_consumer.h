@@ -0,0 +1,153 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "delete_window.h"
+#include "lease_manager.h"
+#include "message_deduplicator.h"
+#include "poison_queue.h"
+
+using namespace azure::storage;
+
+///
+/// Settings for queue_consumer. The defaults suit short handlers on a single queue.
+///
+struct queue_consumer_options
+{
+    queue_consumer_options();
+
+    // Number of threads running the message handler.
+    size_t worker_count;
+
+    // Messages requested per get_messages call (the service allows at most 32).
+    size_t prefetch_batch_size;
+
+    // Maximum number of received messages waiting for a worker.
+    size_t prefetch_capacity;
+
+    // Visibility timeout requested on receive and on each renewal.
+    std::chrono::seconds visibility_timeout;
+
+    // A lease is renewed once less than this much of it is left.
+    std::chrono::seconds renewal_margin;
+
+    // Maximum number of deletes and poison queue moves outstanding at once.
+    size_t max_pending_deletes;
+
+    // How long the prefetcher waits after the queue first comes back empty. The wait doubles
+    // with each empty receive, up to max_empty_poll_delay, and resets once messages arrive.
+    std::chrono::milliseconds empty_poll_delay;
+    std::chrono::milliseconds max_empty_poll_delay;
+
+    queue_request_options request_options;
+
+    // Called after a handled message has been deleted, for example to clean up data the
+    // message refers to. Exceptions it throws are ignored.
+    std::function<void(const cloud_queue_message& message)> acknowledged_handler;
+
+    // If set, redelivered messages that were already handled are deleted without calling the
+    // handler again.
+    std::shared_ptr<message_deduplicator> deduplicator;
+
+    // If set, messages received more often than its max_dequeue_count are moved to its poison
+    // queue instead of being handled. The poison queue must already exist.
+    std::shared_ptr<poison_queue> dead_letter;
+};
+
+///
+/// Processes messages from one queue with a pool of worker threads. A prefetcher keeps a
+/// buffer of received messages ahead of the workers, a lease_manager extends the visibility
+/// of messages before their lease runs out, and handled messages are deleted asynchronously
+/// so workers move straight on to the next message.
+///
+/// A message whose handler throws is made visible again right away so it can be retried. A
+/// buffered message whose lease could not be renewed is dropped without being handled, since
+/// it may already have been handed to another consumer. With a dead_letter queue, a message
+/// that has failed too many times is moved there rather than retried forever.
+///
+class queue_consumer
+{
+public:
+    typedef std::function<void(const cloud_queue_message& message)> message_handler;
+
+    queue_consumer(cloud_queue queue, message_handler handler);
+    queue_consumer(cloud_queue queue, message_handler handler, const queue_consumer_options& options);
+
+    // Stops the consumer if it is still running.
+    ~queue_consumer();
+
+    void start();
+
+    ///
+    /// Stops receiving, waits for in-progress handlers and pending deletes, and releases
+    /// messages that were prefetched but never handled.
+    ///
+    void stop();
+
+    uint64_t received_count() const;
+    uint64_t processed_count() const;
+    uint64_t failed_count() const;
+    uint64_t renewed_count() const;
+    uint64_t lost_lease_count() const;
+
+    // Redelivered messages the deduplicator recognised and skipped.
+    uint64_t duplicate_count() const;
+
+    // Messages moved to the dead_letter queue.
+    uint64_t dead_lettered_count() const;
+
+private:
+    queue_consumer(const queue_consumer&);
+    queue_consumer& operator=(const queue_consumer&);
+
+    void prefetch_loop();
+    void worker_loop();
+
+    void acknowledge(lease_manager::lease_id id);
+    void release(lease_manager::lease_id id);
+    void dead_letter(lease_manager::lease_id id);
+
+    cloud_queue m_queue;
+    message_handler m_handler;
+    queue_consumer_options m_options;
+
+    std::atomic<bool> m_running;
+    std::thread m_prefetcher;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_buffer_mutex;
+    std::condition_variable m_buffer_not_empty;
+    std::condition_variable m_buffer_not_full;
+    std::deque<lease_manager::lease_id> m_buffer;
+
+    std::unique_ptr<lease_manager> m_leases;
+    std::unique_ptr<delete_window> m_deletes;
+
+    std::atomic<uint64_t> m_received;
+    std::atomic<uint64_t> m_processed;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_duplicates;
+    std::atomic<uint64_t> m_dead_lettered;
+};
@@ -0,0 +1,158 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "queue_coroutines.h"
+
+#ifdef AZURESTORAGESAMPLES_HAVE_COROUTINES
+
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+coroutine_executor::coroutine_executor(size_t thread_count)
+    : m_stopping(false)
+{
+    for (size_t i = 0; i < std::max<size_t>(thread_count, 1); i++)
+    {
+        m_threads.push_back(std::thread(&coroutine_executor::run, this));
+    }
+}
+
+coroutine_executor::~coroutine_executor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_ready_changed.notify_all();
+    }
+
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+    {
+        it->join();
+    }
+}
+
+void coroutine_executor::post(std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ready.push_back(handle);
+    m_ready_changed.notify_one();
+}
+
+size_t coroutine_executor::thread_count() const
+{
+    return m_threads.size();
+}
+
+coroutine_executor::schedule_awaiter coroutine_executor::schedule()
+{
+    return schedule_awaiter(*this);
+}
+
+void coroutine_executor::run()
+{
+    while (true)
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready_changed.wait(lock, [this] { return m_stopping || !m_ready.empty(); });
+            if (m_ready.empty())
+            {
+                return;
+            }
+
+            handle = m_ready.front();
+            m_ready.pop_front();
+        }
+
+        handle.resume();
+    }
+}
+
+coroutine_queue::coroutine_queue(cloud_queue queue, coroutine_executor& executor, const queue_request_options& options)
+    : m_queue(queue), m_executor(executor), m_options(options)
+{
+}
+
+cloud_queue& coroutine_queue::queue()
+{
+    return m_queue;
+}
+
+coroutine_executor& coroutine_queue::executor()
+{
+    return m_executor;
+}
+
+// The message parameters live in the coroutine frame, so they outlive the async calls that
+// take them by reference.
+
+queue_task<void> coroutine_queue::add_message(cloud_queue_message message)
+{
+    co_await resume_on(m_executor, m_queue.add_message_async(message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options, operation_context()));
+}
+
+queue_task<std::vector<cloud_queue_message>> coroutine_queue::get_messages(size_t count, std::chrono::seconds visibility_timeout)
+{
+    co_return co_await resume_on(m_executor, m_queue.get_messages_async(count, visibility_timeout, m_options, operation_context()));
+}
+
+queue_task<cloud_queue_message> coroutine_queue::update_message(cloud_queue_message message, std::chrono::seconds visibility_timeout, bool update_content)
+{
+    co_await resume_on(m_executor, m_queue.update_message_async(message, visibility_timeout, update_content, m_options, operation_context()));
+    co_return message;
+}
+
+queue_task<void> coroutine_queue::delete_message(cloud_queue_message message)
+{
+    co_await resume_on(m_executor, m_queue.delete_message_async(message, m_options, operation_context()));
+}
+
+queue_task<int> coroutine_queue::approximate_message_count()
+{
+    co_await resume_on(m_executor, m_queue.download_attributes_async(m_options, operation_context()));
+    co_return m_queue.approximate_message_count();
+}
+
+coroutine_queue_client::coroutine_queue_client(cloud_queue_client client, coroutine_executor& executor, const queue_request_options& options)
+    : m_client(client), m_executor(executor), m_options(options)
+{
+}
+
+coroutine_queue coroutine_queue_client::get_queue_reference(const utility::string_t& name)
+{
+    return coroutine_queue(m_client.get_queue_reference(name), m_executor, m_options);
+}
+
+queue_task<std::vector<cloud_queue>> coroutine_queue_client::list_queues(utility::string_t prefix)
+{
+    std::vector<cloud_queue> queues;
+    continuation_token token;
+    do
+    {
+        queue_result_segment segment = co_await resume_on(m_executor, m_client.list_queues_segmented_async(prefix, false, 0, token, m_options, operation_context()));
+        queues.insert(queues.end(), segment.results().begin(), segment.results().end());
+        token = segment.continuation_token();
+    }
+    while (!token.empty());
+
+    co_return queues;
+}
+
+#endif
@@ -0,0 +1,376 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+// The coroutine layer needs a C++20 compiler; configure with -DAZURESTORAGESAMPLES_COROUTINES=ON.
+// Other builds see an empty header.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define AZURESTORAGESAMPLES_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef AZURESTORAGESAMPLES_HAVE_COROUTINES
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// A fixed pool of threads that resumes coroutines. Coroutines waiting on a queue operation
+/// hold no thread, so a few threads can drive thousands of operations at once.
+///
+/// Destroy the executor only after every task running on it has finished.
+///
+class coroutine_executor
+{
+public:
+    explicit coroutine_executor(size_t thread_count = std::max(2u, std::thread::hardware_concurrency()));
+    ~coroutine_executor();
+
+    // Queues the coroutine to be resumed on one of the executor's threads.
+    void post(std::coroutine_handle<> handle);
+
+    size_t thread_count() const;
+
+    // co_await executor.schedule() moves the calling coroutine onto the executor.
+    class schedule_awaiter
+    {
+    public:
+        explicit schedule_awaiter(coroutine_executor& executor) : m_executor(executor) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { m_executor.post(handle); }
+        void await_resume() const noexcept {}
+
+    private:
+        coroutine_executor& m_executor;
+    };
+
+    schedule_awaiter schedule();
+
+private:
+    coroutine_executor(const coroutine_executor&);
+    coroutine_executor& operator=(const coroutine_executor&);
+
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready_changed;
+    std::deque<std::coroutine_handle<>> m_ready;
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+};
+
+template<typename T>
+class queue_task;
+
+namespace coroutine_detail
+{
+    // Lets a thread block until a task it started has finished.
+    class completion
+    {
+    public:
+        completion() : m_done(false) {}
+
+        void set()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+            m_changed.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_done; });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        bool m_done;
+    };
+
+    struct promise_base
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+        std::shared_ptr<completion> finished = std::make_shared<completion>();
+
+        // Set by whichever comes first of the coroutine finishing and its task being destroyed;
+        // the second one destroys the frame.
+        std::atomic<bool> released{false};
+
+        // Tasks are lazy: nothing runs until the task is awaited, started or waited on.
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                // The task's owner may destroy the frame as soon as it is released, so take
+                // what is needed from the promise first.
+                promise_base& promise = handle.promise();
+                std::coroutine_handle<> continuation = promise.continuation;
+                std::shared_ptr<completion> finished = promise.finished;
+
+                if (promise.released.exchange(true))
+                {
+                    // The task was destroyed while this ran, so nobody is left to do it.
+                    handle.destroy();
+                }
+
+                if (continuation)
+                {
+                    return continuation;
+                }
+
+                finished->set();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template<typename T>
+    struct promise : promise_base
+    {
+        std::optional<T> value;
+
+        queue_task<T> get_return_object() { return queue_task<T>(std::coroutine_handle<promise>::from_promise(*this)); }
+        void return_value(T result) { value = std::move(result); }
+    };
+
+    template<>
+    struct promise<void> : promise_base
+    {
+        queue_task<void> get_return_object();
+        void return_void() {}
+    };
+}
+
+///
+/// The result of a coroutine in this layer. A task starts when it is awaited, started on an
+/// executor, or waited on with get(). Awaiting a task resumes the awaiter when it finishes,
+/// on whichever thread finished it.
+///
+/// A started task may be destroyed before it finishes. The coroutine then runs to the end on
+/// its own and frees its frame, and its result or exception is discarded.
+///
+template<typename T>
+class queue_task
+{
+public:
+    typedef coroutine_detail::promise<T> promise_type;
+
+    explicit queue_task(std::coroutine_handle<promise_type> handle) : m_handle(handle), m_started(false) {}
+    queue_task(queue_task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)), m_started(other.m_started) {}
+
+    queue_task& operator=(queue_task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            m_handle = std::exchange(other.m_handle, nullptr);
+            m_started = other.m_started;
+        }
+
+        return *this;
+    }
+
+    ~queue_task()
+    {
+        release();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        m_started = true;
+        m_handle.promise().continuation = awaiter;
+        return m_handle;
+    }
+
+    T await_resume() { return result(); }
+
+    // Starts the task on the executor without waiting for it.
+    void start(coroutine_executor& executor)
+    {
+        m_started = true;
+        executor.post(m_handle);
+    }
+
+    // Starts the task on this thread if it hasn't started yet, then blocks until it finishes.
+    T get()
+    {
+        if (!m_started)
+        {
+            m_started = true;
+            m_handle.resume();
+        }
+
+        m_handle.promise().finished->wait();
+        return result();
+    }
+
+private:
+    queue_task(const queue_task&);
+    queue_task& operator=(const queue_task&);
+
+    // Destroys the frame unless the coroutine is still running, in which case it frees itself.
+    void release()
+    {
+        if (m_handle && (!m_started || m_handle.promise().released.exchange(true)))
+        {
+            m_handle.destroy();
+        }
+
+        m_handle = nullptr;
+    }
+
+    T result()
+    {
+        promise_type& promise = m_handle.promise();
+        if (promise.error)
+        {
+            std::rethrow_exception(promise.error);
+        }
+
+        if constexpr (!std::is_void<T>::value)
+        {
+            return std::move(*promise.value);
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+    bool m_started;
+};
+
+// Defined here because queue_task<void> has to be complete.
+inline queue_task<void> coroutine_detail::promise<void>::get_return_object()
+{
+    return queue_task<void>(std::coroutine_handle<promise>::from_promise(*this));
+}
+
+///
+/// Awaits a pplx task without blocking a thread: the awaiting coroutine is resumed on the
+/// executor once the task completes, and co_await returns the task's result or rethrows its
+/// exception.
+///
+template<typename T>
+class pplx_awaiter
+{
+public:
+    pplx_awaiter(pplx::task<T> task, coroutine_executor& executor) : m_task(task), m_executor(executor) {}
+
+    bool await_ready() const { return m_task.is_done(); }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        // The continuation may resume the coroutine and destroy this awaiter, which lives in
+        // its frame, before then() returns, so then() is called on a copy.
+        pplx::task<T> task = m_task;
+        coroutine_executor* executor = &m_executor;
+        task.then([executor, handle](pplx::task<T>)
+        {
+            executor->post(handle);
+        });
+    }
+
+    T await_resume() { return m_task.get(); }
+
+private:
+    pplx::task<T> m_task;
+    coroutine_executor& m_executor;
+};
+
+template<typename T>
+pplx_awaiter<T> resume_on(coroutine_executor& executor, pplx::task<T> task)
+{
+    return pplx_awaiter<T>(task, executor);
+}
+
+///
+/// Awaitable versions of the cloud_queue operations used by the samples. Each call returns a
+/// task that runs the async client call and resumes on the executor when it completes. The
+/// coroutine_queue must outlive the tasks it returns.
+///
+class coroutine_queue
+{
+public:
+    coroutine_queue(cloud_queue queue, coroutine_executor& executor, const queue_request_options& options = queue_request_options());
+
+    cloud_queue& queue();
+    coroutine_executor& executor();
+
+    queue_task<void> add_message(cloud_queue_message message);
+    queue_task<std::vector<cloud_queue_message>> get_messages(size_t count, std::chrono::seconds visibility_timeout);
+
+    // Returns the message with the pop receipt of the update.
+    queue_task<cloud_queue_message> update_message(cloud_queue_message message, std::chrono::seconds visibility_timeout, bool update_content);
+
+    queue_task<void> delete_message(cloud_queue_message message);
+
+    // Fetches the queue attributes and returns the approximate message count.
+    queue_task<int> approximate_message_count();
+
+private:
+    cloud_queue m_queue;
+    coroutine_executor& m_executor;
+    queue_request_options m_options;
+};
+
+///
+/// Awaitable queue listing. Segments are requested one at a time as the previous one arrives.
+///
+class coroutine_queue_client
+{
+public:
+    coroutine_queue_client(cloud_queue_client client, coroutine_executor& executor, const queue_request_options& options = queue_request_options());
+
+    coroutine_queue get_queue_reference(const utility::string_t& name);
+
+    queue_task<std::vector<cloud_queue>> list_queues(utility::string_t prefix);
+
+private:
+    cloud_queue_client m_client;
+    coroutine_executor& m_executor;
+    queue_request_options m_options;
+};
+
+#endif
@@ -0,0 +1,136 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "queue_group.h"
+
+using namespace azure::storage;
+
+queue_group::batch_result queue_group::receive_and_handle(cloud_queue& queue, size_t batch_size, std::chrono::seconds visibility_timeout, const queue_request_options& options,
+    const std::function<void(const cloud_queue_message& message)>& handler)
+{
+    batch_result result = { 0, 0, 0 };
+    queue_request_options request_options(options);
+
+    std::vector<cloud_queue_message> messages;
+    try
+    {
+        messages = queue.get_messages(batch_size, visibility_timeout, request_options, operation_context());
+    }
+    catch (const std::exception&)
+    {
+        // Treat a queue that can't be read as empty for now; the caller tries again later.
+    }
+
+    result.received = messages.size();
+
+    std::vector<pplx::task<void>> deletes;
+    for (auto it = messages.begin(); it != messages.end(); ++it)
+    {
+        bool handled = false;
+        try
+        {
+            handler(*it);
+            handled = true;
+        }
+        catch (const std::exception&)
+        {
+        }
+
+        try
+        {
+            if (handled)
+            {
+                result.processed++;
+                deletes.push_back(queue.delete_message_async(*it, request_options, operation_context()));
+            }
+            else
+            {
+                result.failed++;
+                queue.update_message(*it, std::chrono::seconds(0), false, request_options, operation_context());
+            }
+        }
+        catch (const std::exception&)
+        {
+            // The message reappears once its visibility timeout lapses.
+        }
+    }
+
+    for (auto it = deletes.begin(); it != deletes.end(); ++it)
+    {
+        try
+        {
+            it->get();
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    return result;
+}
+
+std::vector<int> queue_group::approximate_message_counts(const std::vector<cloud_queue>& queues, const queue_request_options& options)
+{
+    // Fetching updates the queue objects, so work on copies.
+    std::vector<cloud_queue> fetched(queues);
+    queue_request_options request_options(options);
+
+    std::vector<pplx::task<void>> fetches;
+    for (auto it = fetched.begin(); it != fetched.end(); ++it)
+    {
+        try
+        {
+            fetches.push_back(it->download_attributes_async(request_options, operation_context()));
+        }
+        catch (...)
+        {
+            fetches.push_back(pplx::task_from_exception<void>(std::current_exception()));
+        }
+    }
+
+    // Every fetch is waited for, so none is left running or unobserved when one fails.
+    std::exception_ptr error;
+    for (auto it = fetches.begin(); it != fetches.end(); ++it)
+    {
+        try
+        {
+            it->get();
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    std::vector<int> counts;
+    counts.reserve(fetched.size());
+    for (auto it = fetched.begin(); it != fetched.end(); ++it)
+    {
+        counts.push_back(it->approximate_message_count());
+    }
+
+    return counts;
+}
@@ -0,0 +1,55 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Operations shared by the types that spread one logical queue over several physical queues.
+///
+class queue_group
+{
+public:
+    ///
+    /// Counts from one receive_and_handle call.
+    ///
+    struct batch_result
+    {
+        size_t received;
+        size_t processed;
+        size_t failed;
+    };
+
+    ///
+    /// Receives up to batch_size messages and runs the handler on each. Handled messages are
+    /// deleted concurrently, and the deletes are waited for before returning. A message whose
+    /// handler throws is made visible again right away. A failed receive counts as an empty one.
+    ///
+    static batch_result receive_and_handle(cloud_queue& queue, size_t batch_size, std::chrono::seconds visibility_timeout, const queue_request_options& options,
+        const std::function<void(const cloud_queue_message& message)>& handler);
+
+    ///
+    /// Fetches the attributes of every queue concurrently and returns their approximate
+    /// message counts, in the same order. If any fetch fails, the first failure is rethrown
+    /// once all of them have finished.
+    ///
+    static std::vector<int> approximate_message_counts(const std::vector<cloud_queue>& queues, const queue_request_options& options);
+};
@@ -0,0 +1,291 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "queue_poller.h"
+
+#include <algorithm>
+
+using namespace azure::storage;
+
+polling_backoff::polling_backoff(std::chrono::milliseconds min_delay, std::chrono::milliseconds max_delay)
+    : m_min_delay(std::max(min_delay, std::chrono::milliseconds(1))), m_max_delay(std::max(max_delay, m_min_delay)),
+    m_delay(0), m_empty_polls(0), m_random(std::random_device()())
+{
+}
+
+std::chrono::milliseconds polling_backoff::next(bool received)
+{
+    if (received)
+    {
+        reset();
+        return std::chrono::milliseconds(0);
+    }
+
+    m_empty_polls++;
+    m_delay = m_delay.count() == 0 ? m_min_delay : std::min(m_delay * 2, m_max_delay);
+
+    long long half = m_delay.count() / 2;
+    return std::chrono::milliseconds(half + std::uniform_int_distribution<long long>(0, m_delay.count() - half)(m_random));
+}
+
+void polling_backoff::reset()
+{
+    m_delay = std::chrono::milliseconds(0);
+    m_empty_polls = 0;
+}
+
+unsigned int polling_backoff::empty_polls() const
+{
+    return m_empty_polls;
+}
+
+queue_poller_options::queue_poller_options()
+    : min_delay(50), max_delay(30000), coalescing_window(50), batch_size(32), visibility_timeout(30)
+{
+}
+
+queue_poller::entry::entry(cloud_queue queue, batch_handler handler, const queue_poller_options& options)
+    : queue(queue), handler(handler), backoff(options.min_delay, options.max_delay), is_scheduled(false), woken(false), removed(false)
+{
+}
+
+queue_poller::queue_poller(const queue_poller_options& options)
+    : m_options(options), m_running(false), m_polls(0), m_empty_polls(0), m_messages(0), m_wakeups(0)
+{
+}
+
+queue_poller::~queue_poller()
+{
+    stop();
+}
+
+void queue_poller::add_queue(cloud_queue queue, batch_handler handler)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    entry_ptr& target = m_entries[queue.name()];
+    if (target)
+    {
+        target->removed = true;
+        unschedule_locked(target);
+    }
+
+    target = std::make_shared<entry>(queue, handler, m_options);
+    schedule_locked(target, std::chrono::steady_clock::now());
+}
+
+void queue_poller::remove_queue(const utility::string_t& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(name);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+
+    // A poll in progress finishes, but the queue is not scheduled again.
+    it->second->removed = true;
+    unschedule_locked(it->second);
+    m_entries.erase(it);
+}
+
+void queue_poller::wake(const utility::string_t& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(name);
+    if (it == m_entries.end())
+    {
+        return;
+    }
+
+    entry_ptr target = it->second;
+    if (target->is_scheduled)
+    {
+        target->backoff.reset();
+        unschedule_locked(target);
+        schedule_locked(target, std::chrono::steady_clock::now());
+    }
+    else
+    {
+        // Being polled right now; poll again as soon as that finishes.
+        target->woken = true;
+    }
+}
+
+void queue_poller::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running)
+    {
+        return;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&queue_poller::poll_loop, this);
+}
+
+void queue_poller::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+        {
+            return;
+        }
+
+        m_running = false;
+        m_changed.notify_all();
+    }
+
+    m_thread.join();
+}
+
+uint64_t queue_poller::poll_count() const
+{
+    return m_polls;
+}
+
+uint64_t queue_poller::empty_poll_count() const
+{
+    return m_empty_polls;
+}
+
+uint64_t queue_poller::message_count() const
+{
+    return m_messages;
+}
+
+uint64_t queue_poller::wakeup_count() const
+{
+    return m_wakeups;
+}
+
+void queue_poller::poll_loop()
+{
+    while (true)
+    {
+        std::vector<entry_ptr> due;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (m_running && (m_schedule.empty() || m_schedule.begin()->first > std::chrono::steady_clock::now()))
+            {
+                if (m_schedule.empty())
+                {
+                    m_changed.wait(lock);
+                }
+                else
+                {
+                    m_changed.wait_until(lock, m_schedule.begin()->first);
+                }
+            }
+
+            if (!m_running)
+            {
+                return;
+            }
+
+            // Take everything due now or within the coalescing window.
+            std::chrono::steady_clock::time_point horizon = std::chrono::steady_clock::now() + m_options.coalescing_window;
+            while (!m_schedule.empty() && m_schedule.begin()->first <= horizon)
+            {
+                entry_ptr target = m_schedule.begin()->second;
+                unschedule_locked(target);
+                due.push_back(target);
+            }
+        }
+
+        m_wakeups++;
+
+        std::vector<pplx::task<std::vector<cloud_queue_message>>> receives;
+        for (auto it = due.begin(); it != due.end(); ++it)
+        {
+            try
+            {
+                receives.push_back((*it)->queue.get_messages_async(m_options.batch_size, m_options.visibility_timeout, m_options.request_options, operation_context()));
+            }
+            catch (...)
+            {
+                receives.push_back(pplx::task_from_exception<std::vector<cloud_queue_message>>(std::current_exception()));
+            }
+        }
+
+        for (size_t i = 0; i < due.size(); i++)
+        {
+            entry_ptr target = due[i];
+
+            std::vector<cloud_queue_message> messages;
+            try
+            {
+                messages = receives[i].get();
+            }
+            catch (const std::exception&)
+            {
+                // Treat a failed receive like an empty queue; the backoff keeps retries cheap.
+            }
+
+            m_polls++;
+            if (messages.empty())
+            {
+                m_empty_polls++;
+            }
+            else
+            {
+                m_messages += messages.size();
+                try
+                {
+                    target->handler(target->queue, messages);
+                }
+                catch (const std::exception&)
+                {
+                    // Unhandled messages reappear once their visibility timeout lapses.
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (target->removed)
+            {
+                continue;
+            }
+
+            std::chrono::milliseconds delay = target->backoff.next(!messages.empty());
+            if (target->woken)
+            {
+                target->woken = false;
+                target->backoff.reset();
+                delay = std::chrono::milliseconds(0);
+            }
+
+            schedule_locked(target, std::chrono::steady_clock::now() + delay);
+        }
+    }
+}
+
+void queue_poller::schedule_locked(const entry_ptr& target, std::chrono::steady_clock::time_point due)
+{
+    target->scheduled = m_schedule.insert(std::make_pair(due, target));
+    target->is_scheduled = true;
+    m_changed.notify_all();
+}
+
+void queue_poller::unschedule_locked(const entry_ptr& target)
+{
+    if (target->is_scheduled)
+    {
+        m_schedule.erase(target->scheduled);
+        target->is_scheduled = false;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Delay before the next receive on a queue. Each empty receive doubles the delay, up to
+/// max_delay; a receive that returns messages drops it straight back to zero. The delay is
+/// jittered between half and all of its nominal value so pollers don't fall into step.
+///
+class polling_backoff
+{
+public:
+    polling_backoff(std::chrono::milliseconds min_delay, std::chrono::milliseconds max_delay);
+
+    // Records the outcome of a receive and returns how long to wait before the next one.
+    std::chrono::milliseconds next(bool received);
+
+    void reset();
+
+    // Empty receives in a row.
+    unsigned int empty_polls() const;
+
+private:
+    std::chrono::milliseconds m_min_delay;
+    std::chrono::milliseconds m_max_delay;
+    std::chrono::milliseconds m_delay;
+    unsigned int m_empty_polls;
+    std::mt19937 m_random;
+};
+
+///
+/// Settings for queue_poller.
+///
+struct queue_poller_options
+{
+    queue_poller_options();
+
+    // Delay after the first empty receive; it doubles with each empty receive after that.
+    std::chrono::milliseconds min_delay;
+
+    // Longest delay between receives on an idle queue.
+    std::chrono::milliseconds max_delay;
+
+    // Queues due within this long of each other are polled in the same wake-up.
+    std::chrono::milliseconds coalescing_window;
+
+    // Messages requested per get_messages call (the service allows at most 32).
+    size_t batch_size;
+
+    std::chrono::seconds visibility_timeout;
+
+    queue_request_options request_options;
+};
+
+///
+/// Polls many queues from one thread. Each queue has its own polling_backoff, so idle queues
+/// are polled rarely while busy ones are polled again as soon as their batch is handled.
+/// Queues that come due close together are received from concurrently in one wake-up.
+///
+/// Handlers run on the poller thread, so they should hand messages off rather than process
+/// them in place. A handler is responsible for deleting the messages it is given.
+///
+class queue_poller
+{
+public:
+    typedef std::function<void(cloud_queue& queue, std::vector<cloud_queue_message>& messages)> batch_handler;
+
+    explicit queue_poller(const queue_poller_options& options = queue_poller_options());
+
+    // Stops the poller if it is still running.
+    ~queue_poller();
+
+    // Starts polling the queue; replaces the handler if the queue was already added.
+    void add_queue(cloud_queue queue, batch_handler handler);
+    void remove_queue(const utility::string_t& name);
+
+    ///
+    /// Polls the queue right away and resets its backoff, for example when a producer knows it
+    /// just added messages.
+    ///
+    void wake(const utility::string_t& name);
+
+    void start();
+
+    // Stops polling and waits for the current wake-up to finish.
+    void stop();
+
+    uint64_t poll_count() const;
+    uint64_t empty_poll_count() const;
+    uint64_t message_count() const;
+
+    // Wake-ups of the poller thread; fewer than polls when receives are coalesced.
+    uint64_t wakeup_count() const;
+
+private:
+    struct entry
+    {
+        entry(cloud_queue queue, batch_handler handler, const queue_poller_options& options);
+
+        cloud_queue queue;
+        batch_handler handler;
+        polling_backoff backoff;
+        std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<entry>>::iterator scheduled;
+        bool is_scheduled;
+        bool woken;
+        bool removed;
+    };
+
+    typedef std::shared_ptr<entry> entry_ptr;
+    typedef std::multimap<std::chrono::steady_clock::time_point, entry_ptr> schedule;
+
+    queue_poller(const queue_poller&);
+    queue_poller& operator=(const queue_poller&);
+
+    void poll_loop();
+    void schedule_locked(const entry_ptr& target, std::chrono::steady_clock::time_point due);
+    void unschedule_locked(const entry_ptr& target);
+
+    queue_poller_options m_options;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::unordered_map<utility::string_t, entry_ptr> m_entries;
+    schedule m_schedule;
+    bool m_running;
+    std::thread m_thread;
+
+    std::atomic<uint64_t> m_polls;
+    std::atomic<uint64_t> m_empty_polls;
+    std::atomic<uint64_t> m_messages;
+    std::atomic<uint64_t> m_wakeups;
+};
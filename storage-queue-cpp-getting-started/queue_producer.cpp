@@ -0,0 +1,186 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+// Same defaults the client library uses for the single-argument add_message overload.
+const std::chrono::seconds queue_producer::default_time_to_live(604800);
+const std::chrono::seconds queue_producer::default_initial_visibility_timeout(0);
+
+queue_producer::window::window(size_t max_in_flight)
+    : m_max_in_flight(max_in_flight > 0 ? max_in_flight : 1), m_in_flight(0), m_succeeded(0), m_failed(0)
+{
+}
+
+void queue_producer::window::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_in_flight < m_max_in_flight; });
+    ++m_in_flight;
+}
+
+void queue_producer::window::release(bool succeeded)
+{
+    if (succeeded)
+    {
+        ++m_succeeded;
+    }
+    else
+    {
+        ++m_failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_in_flight;
+    }
+
+    // Both blocked producers and flush() wait on the same condition.
+    m_condition.notify_all();
+}
+
+void queue_producer::window::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_in_flight == 0; });
+}
+
+queue_producer::queue_producer(cloud_queue queue, size_t max_in_flight)
+    : m_queue(queue), m_window(std::make_shared<window>(max_in_flight))
+{
+}
+
+queue_producer::queue_producer(cloud_queue queue, size_t max_in_flight, const queue_request_options& options)
+    : m_queue(queue), m_options(options), m_window(std::make_shared<window>(max_in_flight))
+{
+}
+
+queue_producer::~queue_producer()
+{
+    flush();
+}
+
+pplx::task<void> queue_producer::add_message(cloud_queue_message message)
+{
+    return add_message(message, default_time_to_live, default_initial_visibility_timeout);
+}
+
+pplx::task<void> queue_producer::add_message(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout)
+{
+    pplx::task_completion_event<void> completed;
+    send(message, time_to_live, initial_visibility_timeout, [completed](const cloud_queue_message&, std::exception_ptr error)
+    {
+        if (error)
+        {
+            completed.set_exception(error);
+        }
+        else
+        {
+            completed.set();
+        }
+    });
+
+    return pplx::create_task(completed);
+}
+
+void queue_producer::add_message(cloud_queue_message message, completion_callback callback)
+{
+    send(message, default_time_to_live, default_initial_visibility_timeout, callback);
+}
+
+void queue_producer::add_message(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout, completion_callback callback)
+{
+    send(message, time_to_live, initial_visibility_timeout, callback);
+}
+
+void queue_producer::flush()
+{
+    m_window->wait_idle();
+}
+
+size_t queue_producer::max_in_flight() const
+{
+    return m_window->m_max_in_flight;
+}
+
+size_t queue_producer::in_flight() const
+{
+    std::lock_guard<std::mutex> lock(m_window->m_mutex);
+    return m_window->m_in_flight;
+}
+
+uint64_t queue_producer::succeeded_count() const
+{
+    return m_window->m_succeeded;
+}
+
+uint64_t queue_producer::failed_count() const
+{
+    return m_window->m_failed;
+}
+
+///
+/// Takes a slot in the window (blocking while it is full) and starts the add. The continuation
+/// reports the outcome and then gives the slot back, so flush() never returns ahead of a callback.
+///
+void queue_producer::send(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout, completion_callback callback)
+{
+    m_window->acquire();
+
+    // add_message_async takes the message by reference, so it has to outlive the operation.
+    std::shared_ptr<cloud_queue_message> pending = std::make_shared<cloud_queue_message>(message);
+    std::shared_ptr<window> slots = m_window;
+
+    pplx::task<void> operation;
+    try
+    {
+        operation = m_queue.add_message_async(*pending, time_to_live, initial_visibility_timeout, m_options, operation_context());
+    }
+    catch (...)
+    {
+        operation = pplx::task_from_exception<void>(std::current_exception());
+    }
+
+    operation.then([slots, pending, callback](pplx::task<void> previous)
+    {
+        std::exception_ptr error;
+        try
+        {
+            previous.get();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        if (callback)
+        {
+            try
+            {
+                callback(*pending, error);
+            }
+            catch (...)
+            {
+                // A failing callback must not leak the slot.
+            }
+        }
+
+        slots->release(!error);
+    });
+}
@@ -0,0 +1,92 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+using namespace azure::storage;
+
+///
+/// Enqueues messages with add_message_async while keeping at most max_in_flight requests
+/// outstanding. When the window is full, add_message blocks the caller until a slot frees up.
+///
+class queue_producer
+{
+public:
+    typedef std::function<void(const cloud_queue_message& message, std::exception_ptr error)> completion_callback;
+
+    static const std::chrono::seconds default_time_to_live;
+    static const std::chrono::seconds default_initial_visibility_timeout;
+
+    explicit queue_producer(cloud_queue queue, size_t max_in_flight = 32);
+    queue_producer(cloud_queue queue, size_t max_in_flight, const queue_request_options& options);
+
+    // Waits for every outstanding add to complete.
+    ~queue_producer();
+
+    ///
+    /// Enqueues a message and returns a task that completes (or faults) with the add operation.
+    /// The returned task must be observed by the caller.
+    ///
+    pplx::task<void> add_message(cloud_queue_message message);
+    pplx::task<void> add_message(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout);
+
+    ///
+    /// Enqueues a message and invokes the callback on completion. error is null on success.
+    ///
+    void add_message(cloud_queue_message message, completion_callback callback);
+    void add_message(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout, completion_callback callback);
+
+    // Blocks until no add operation is outstanding.
+    void flush();
+
+    size_t max_in_flight() const;
+    size_t in_flight() const;
+    uint64_t succeeded_count() const;
+    uint64_t failed_count() const;
+
+private:
+    class window
+    {
+    public:
+        explicit window(size_t max_in_flight);
+
+        void acquire();
+        void release(bool succeeded);
+        void wait_idle();
+
+        size_t m_max_in_flight;
+        size_t m_in_flight;
+        std::atomic<uint64_t> m_succeeded;
+        std::atomic<uint64_t> m_failed;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_condition;
+    };
+
+    queue_producer(const queue_producer&);
+    queue_producer& operator=(const queue_producer&);
+
+    void send(cloud_queue_message message, std::chrono::seconds time_to_live, std::chrono::seconds initial_visibility_timeout, completion_callback callback);
+
+    cloud_queue m_queue;
+    queue_request_options m_options;
+    std::shared_ptr<window> m_window;
+};
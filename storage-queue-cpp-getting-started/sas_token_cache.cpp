@@ -0,0 +1,321 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "sas_token_cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+sas_token_cache_options::sas_token_cache_options()
+    : token_lifetime(3600), refresh_margin(600), clock_skew(300), capacity(1024)
+{
+}
+
+sas_token_cache::sas_token_cache(const sas_token_cache_options& options)
+    : m_options(options), m_slot_mask(0), m_size(0), m_stop(false), m_epoch(0), m_hits(0), m_misses(0), m_refreshes(0)
+{
+    m_readers[0].store(0, std::memory_order_relaxed);
+    m_readers[1].store(0, std::memory_order_relaxed);
+
+    m_options.token_lifetime = std::max(m_options.token_lifetime, std::chrono::seconds(2));
+    m_options.refresh_margin = std::min(m_options.refresh_margin, m_options.token_lifetime / 2);
+    m_options.capacity = std::max<size_t>(m_options.capacity, 1);
+
+    size_t slot_count = 2;
+    while (slot_count < m_options.capacity * 2)
+    {
+        slot_count *= 2;
+    }
+
+    m_slot_mask = slot_count - 1;
+    m_slots.reset(new std::atomic<const entry*>[slot_count]);
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        m_slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    m_refresher = std::thread(&sas_token_cache::refresh_loop, this);
+}
+
+sas_token_cache::~sas_token_cache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_stopping.notify_all();
+    }
+    m_refresher.join();
+
+    for (size_t i = 0; i <= m_slot_mask; i++)
+    {
+        delete m_slots[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::shared_ptr<const utility::string_t> sas_token_cache::get(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions)
+{
+    uint64_t hash = key_hash(queue.name(), policy_id, permissions);
+
+    // The entry found may be replaced at any moment, but isn't freed until this thread leaves
+    // the reader count.
+    std::atomic<size_t>& readers = m_readers[m_epoch.load() & 1];
+    readers.fetch_add(1);
+
+    size_t slot;
+    std::shared_ptr<const utility::string_t> token;
+    const entry* found = find(hash, queue.name(), policy_id, permissions, slot);
+    if (found != nullptr && std::chrono::steady_clock::now() < found->expires_at - m_options.refresh_margin / 2)
+    {
+        token = found->token;
+    }
+
+    readers.fetch_sub(1);
+
+    if (token)
+    {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return token;
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return get_slow(queue, policy_id, permissions, hash);
+}
+
+size_t sas_token_cache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+uint64_t sas_token_cache::hit_count() const
+{
+    return m_hits;
+}
+
+uint64_t sas_token_cache::miss_count() const
+{
+    return m_misses;
+}
+
+uint64_t sas_token_cache::refresh_count() const
+{
+    return m_refreshes;
+}
+
+double sas_token_cache::hit_rate() const
+{
+    uint64_t hits = m_hits;
+    uint64_t total = hits + m_misses;
+    return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+}
+
+// FNV-1a over the characters of both strings and the permissions.
+uint64_t sas_token_cache::key_hash(const utility::string_t& queue_name, const utility::string_t& policy_id, uint8_t permissions)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto it = queue_name.begin(); it != queue_name.end(); ++it)
+    {
+        hash ^= static_cast<uint64_t>(*it);
+        hash *= 1099511628211ULL;
+    }
+
+    // Queue names can't contain '/', so this keeps "a" + "b/" apart from "a/" + "b".
+    hash ^= '/';
+    hash *= 1099511628211ULL;
+    for (auto it = policy_id.begin(); it != policy_id.end(); ++it)
+    {
+        hash ^= static_cast<uint64_t>(*it);
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= permissions;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+const sas_token_cache::entry* sas_token_cache::find(uint64_t hash, const utility::string_t& queue_name, const utility::string_t& policy_id, uint8_t permissions, size_t& slot) const
+{
+    slot = static_cast<size_t>(hash) & m_slot_mask;
+    while (true)
+    {
+        const entry* candidate = m_slots[slot].load(std::memory_order_acquire);
+        if (candidate == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (candidate->hash == hash && candidate->permissions == permissions && candidate->queue_name == queue_name && candidate->policy_id == policy_id)
+        {
+            return candidate;
+        }
+
+        slot = (slot + 1) & m_slot_mask;
+    }
+}
+
+///
+/// Signs a token for a key that isn't cached, or whose token the refresh thread hasn't
+/// replaced in time, and publishes it. Another thread may have done so while this one waited
+/// for the lock, in which case its token is used.
+///
+std::shared_ptr<const utility::string_t> sas_token_cache::get_slow(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions, uint64_t hash)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    size_t slot;
+    const entry* current = find(hash, queue.name(), policy_id, permissions, slot);
+    if (current != nullptr && now < current->expires_at - m_options.refresh_margin / 2)
+    {
+        return current->token;
+    }
+
+    std::unique_ptr<entry> signed_entry = sign(queue, policy_id, permissions, hash);
+    const entry* published = signed_entry.get();
+
+    if (current != nullptr)
+    {
+        m_slots[slot].store(signed_entry.release(), std::memory_order_release);
+        retire_locked(current);
+    }
+    else if (m_size < m_options.capacity)
+    {
+        m_slots[slot].store(signed_entry.release(), std::memory_order_release);
+        m_size++;
+    }
+    else
+    {
+        // The cache is full, so the token is handed over without being kept.
+        return signed_entry->token;
+    }
+
+    return published->token;
+}
+
+std::unique_ptr<sas_token_cache::entry> sas_token_cache::sign(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions, uint64_t hash) const
+{
+    std::unique_ptr<entry> signed_entry(new entry);
+    signed_entry->hash = hash;
+    signed_entry->queue_name = queue.name();
+    signed_entry->policy_id = policy_id;
+    signed_entry->permissions = permissions;
+    signed_entry->queue = queue;
+
+    if (policy_id.empty())
+    {
+        if (permissions == queue_shared_access_policy::permissions::none)
+        {
+            throw std::invalid_argument("A token without a stored access policy needs permissions");
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        utility::datetime signed_at = utility::datetime::utc_now();
+        queue_shared_access_policy policy(signed_at - utility::datetime::from_seconds(static_cast<unsigned int>(m_options.clock_skew.count())),
+            signed_at + utility::datetime::from_seconds(static_cast<unsigned int>(m_options.token_lifetime.count())), permissions);
+
+        signed_entry->token = std::make_shared<const utility::string_t>(signed_entry->queue.get_shared_access_signature(policy));
+        signed_entry->expires_at = now + m_options.token_lifetime;
+        signed_entry->refresh_at = signed_entry->expires_at - m_options.refresh_margin;
+    }
+    else
+    {
+        if (permissions != queue_shared_access_policy::permissions::none)
+        {
+            throw std::invalid_argument("A token with a stored access policy takes its permissions from the policy");
+        }
+
+        // The stored policy holds the expiry, so the token never changes and is never refreshed.
+        signed_entry->token = std::make_shared<const utility::string_t>(signed_entry->queue.get_shared_access_signature(queue_shared_access_policy(), policy_id));
+        signed_entry->expires_at = std::chrono::steady_clock::time_point::max();
+        signed_entry->refresh_at = std::chrono::steady_clock::time_point::max();
+    }
+
+    return signed_entry;
+}
+
+void sas_token_cache::retire_locked(const entry* value)
+{
+    m_retired.push_back(std::unique_ptr<const entry>(value));
+}
+
+///
+/// Returns once every get() that could have found an entry unpublished before the call has
+/// finished with it. A reader may read the epoch, stall, and only then count itself under it,
+/// after the epoch has moved on; advancing twice and draining both counters covers it.
+///
+void sas_token_cache::wait_for_readers()
+{
+    for (int round = 0; round < 2; round++)
+    {
+        uint64_t epoch = m_epoch.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (m_readers[epoch & 1].load() != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+///
+/// Replaces tokens that are due for refresh and frees retired ones. Checks four times per
+/// refresh_margin, so a token is replaced with most of its margin still left.
+///
+void sas_token_cache::refresh_loop()
+{
+    std::chrono::seconds interval = std::min(std::max(m_options.refresh_margin / 4, std::chrono::seconds(1)), std::chrono::seconds(30));
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping.wait_for(lock, interval, [this] { return m_stop; }))
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i <= m_slot_mask; i++)
+        {
+            const entry* current = m_slots[i].load(std::memory_order_relaxed);
+            if (current == nullptr || now < current->refresh_at)
+            {
+                continue;
+            }
+
+            try
+            {
+                std::unique_ptr<entry> replacement = sign(current->queue, current->policy_id, current->permissions, current->hash);
+                m_slots[i].store(replacement.release(), std::memory_order_release);
+                retire_locked(current);
+                m_refreshes++;
+            }
+            catch (const std::exception&)
+            {
+                // Try again on the next pass; get() signs its own once the token gets too old.
+            }
+        }
+
+        if (!m_retired.empty())
+        {
+            // Entries are only retired under the lock, so everything taken here is already
+            // unpublished. Readers hold no lock, so the wait doesn't need this one.
+            std::vector<std::unique_ptr<const entry>> retired;
+            retired.swap(m_retired);
+            lock.unlock();
+            wait_for_readers();
+            retired.clear();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// Settings for sas_token_cache.
+///
+struct sas_token_cache_options
+{
+    sas_token_cache_options();
+
+    // Lifetime of the tokens the cache signs without a stored access policy.
+    std::chrono::seconds token_lifetime;
+
+    // A token is signed again once less than this much of its lifetime is left. At most half
+    // of token_lifetime.
+    std::chrono::seconds refresh_margin;
+
+    // Tokens start this long before they are signed, so clients with a slow clock accept them.
+    std::chrono::seconds clock_skew;
+
+    // Number of distinct queue, policy and permissions combinations the cache holds. Tokens
+    // for further combinations are signed on every request and not kept.
+    size_t capacity;
+};
+
+///
+/// Caches shared access signatures for queues, keyed by queue name, stored access policy id
+/// and permissions, so a front end that hands out tokens per request doesn't sign each one.
+/// A background thread signs replacement tokens before the current ones come within
+/// refresh_margin of expiring, so requests keep hitting the cache.
+///
+/// A hit takes no lock and allocates nothing: it hashes the key, probes an open-addressing
+/// table of atomic pointers to immutable entries, and returns the cached token as a shared
+/// pointer, which costs one reference count increment. Misses and refreshes are serialized by
+/// a mutex and publish new entries atomically. Entries are never removed, only replaced.
+/// While it reads the table, get() is counted in one of two reader counters picked by the
+/// current epoch; the refresh thread frees replaced entries only after advancing the epoch
+/// twice and seeing each counter drain, so a reader preempted mid-lookup delays the free
+/// rather than reading freed memory.
+///
+/// Keys hold the queue name only, so use one cache per storage account.
+///
+class sas_token_cache
+{
+public:
+    explicit sas_token_cache(const sas_token_cache_options& options = sas_token_cache_options());
+
+    // Stops the refresh thread and frees every entry. Tokens returned earlier stay valid.
+    ~sas_token_cache();
+
+    ///
+    /// Returns a token with at least half of refresh_margin left, or one signed with the
+    /// stored access policy policy_id. Without a policy id, permissions are a combination of
+    /// queue_shared_access_policy::permissions. With one, the stored policy supplies them, so
+    /// permissions must be none. The queue's credentials must hold the account key.
+    ///
+    /// The returned token stays valid for as long as the caller holds it, even after the cache
+    /// replaces it or is destroyed. Once the cache is full, a token for a new combination is
+    /// signed for this call only.
+    ///
+    std::shared_ptr<const utility::string_t> get(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions);
+
+    // Distinct keys cached.
+    size_t size() const;
+
+    uint64_t hit_count() const;
+    uint64_t miss_count() const;
+    uint64_t refresh_count() const;
+
+    // Fraction of requests served from the cache, or 0 before the first request.
+    double hit_rate() const;
+
+private:
+    // Immutable once published.
+    struct entry
+    {
+        uint64_t hash;
+        utility::string_t queue_name;
+        utility::string_t policy_id;
+        uint8_t permissions;
+        cloud_queue queue;
+        std::shared_ptr<const utility::string_t> token;
+        std::chrono::steady_clock::time_point refresh_at;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    sas_token_cache(const sas_token_cache&);
+    sas_token_cache& operator=(const sas_token_cache&);
+
+    static uint64_t key_hash(const utility::string_t& queue_name, const utility::string_t& policy_id, uint8_t permissions);
+
+    // The entry for the key, or null; slot is where it is, or the empty slot ending the probe.
+    const entry* find(uint64_t hash, const utility::string_t& queue_name, const utility::string_t& policy_id, uint8_t permissions, size_t& slot) const;
+
+    std::shared_ptr<const utility::string_t> get_slow(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions, uint64_t hash);
+    std::unique_ptr<entry> sign(const cloud_queue& queue, const utility::string_t& policy_id, uint8_t permissions, uint64_t hash) const;
+    void retire_locked(const entry* value);
+    void wait_for_readers();
+    void refresh_loop();
+
+    sas_token_cache_options m_options;
+
+    // Twice capacity rounded up to a power of two, so probes stay short and always end.
+    size_t m_slot_mask;
+    std::unique_ptr<std::atomic<const entry*>[]> m_slots;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_stopping;
+    size_t m_size;
+    // Replaced entries, freed once no get() can still be reading them.
+    std::vector<std::unique_ptr<const entry>> m_retired;
+    bool m_stop;
+    std::thread m_refresher;
+
+    // get() counts itself in m_readers[m_epoch & 1] while it reads an entry.
+    std::atomic<uint64_t> m_epoch;
+    std::atomic<size_t> m_readers[2];
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_refreshes;
+};
@@ -0,0 +1,807 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "session_queue.h"
+#include "queue_poller.h"
+#include "queue_producer.h"
+
+using namespace azure::storage;
+
+static const utility::string_t envelope_prefix(U("session:1;"));
+
+// Parses the decimal number that starts at position and ends at the next ';', and moves
+// position past the separator.
+static bool parse_field(const utility::string_t& content, utility::string_t::size_type& position, uint64_t& value)
+{
+    utility::string_t::size_type separator = content.find(U(';'), position);
+    if (separator == utility::string_t::npos || separator == position || separator - position > 19)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (utility::string_t::size_type i = position; i < separator; i++)
+    {
+        if (content[i] < U('0') || content[i] > U('9'))
+        {
+            return false;
+        }
+
+        value = value * 10 + static_cast<uint64_t>(content[i] - U('0'));
+    }
+
+    position = separator + 1;
+    return true;
+}
+
+// True if a message is a copy of the one recorded at its position: the same message
+// redelivered, or the same body added again by a retried add.
+static bool same_message(const utility::string_t& message_id, size_t body_hash, const utility::string_t& recorded_id, size_t recorded_hash)
+{
+    return message_id == recorded_id || body_hash == recorded_hash;
+}
+
+session_message::session_message()
+    : sequence(0), out_of_order(false)
+{
+}
+
+cloud_queue_message session_envelope::create(const session_message& message)
+{
+    utility::string_t content(envelope_prefix);
+    content += utility::conversions::print_string(message.sequence);
+    content += U(";");
+    content += utility::conversions::print_string(static_cast<uint64_t>(message.session.size()));
+    content += U(";");
+    content += message.session;
+    content += message.body;
+    return cloud_queue_message(content);
+}
+
+bool session_envelope::parse(const cloud_queue_message& message, session_message& parsed)
+{
+    utility::string_t content = message.content_as_string();
+    if (content.compare(0, envelope_prefix.size(), envelope_prefix) != 0)
+    {
+        return false;
+    }
+
+    utility::string_t::size_type position = envelope_prefix.size();
+    uint64_t sequence;
+    uint64_t key_length;
+    if (!parse_field(content, position, sequence) || !parse_field(content, position, key_length) || key_length > content.size() - position)
+    {
+        return false;
+    }
+
+    parsed.session = content.substr(position, static_cast<size_t>(key_length));
+    parsed.sequence = sequence;
+    parsed.body = content.substr(position + static_cast<size_t>(key_length));
+    return true;
+}
+
+session_producer::session_producer(cloud_queue queue, const queue_request_options& options)
+    : m_queue(queue), m_options(options)
+{
+}
+
+void session_producer::add_message(const utility::string_t& session, const utility::string_t& body)
+{
+    cloud_queue_message message = session_envelope::create(stamp(session, body));
+    m_queue.add_message(message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options, operation_context());
+}
+
+pplx::task<void> session_producer::add_message_async(const utility::string_t& session, const utility::string_t& body)
+{
+    // The async call takes the message by reference, so it lives in the continuation.
+    std::shared_ptr<cloud_queue_message> message = std::make_shared<cloud_queue_message>(session_envelope::create(stamp(session, body)));
+
+    pplx::task<void> add;
+    try
+    {
+        add = m_queue.add_message_async(*message, queue_producer::default_time_to_live, std::chrono::seconds(0), m_options, operation_context());
+    }
+    catch (...)
+    {
+        return pplx::task_from_exception<void>(std::current_exception());
+    }
+
+    return add.then([message](pplx::task<void> previous)
+    {
+        previous.get();
+    });
+}
+
+uint64_t session_producer::next_sequence(const utility::string_t& session) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_sequences.find(session);
+    return it == m_sequences.end() ? 0 : it->second;
+}
+
+void session_producer::set_next_sequence(const utility::string_t& session, uint64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sequences[session] = sequence;
+}
+
+session_message session_producer::stamp(const utility::string_t& session, const utility::string_t& body)
+{
+    session_message message;
+    message.session = session;
+    message.body = body;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    message.sequence = m_sequences[session]++;
+    return message;
+}
+
+session_consumer_options::session_consumer_options()
+    : worker_count(4), prefetch_batch_size(32), prefetch_capacity(1024), visibility_timeout(30), renewal_margin(10),
+    max_pending_deletes(64), empty_poll_delay(50), max_empty_poll_delay(10000), max_gap_wait(120), overflow_delay(30),
+    idle_session_timeout(3600), redelivery_window(300)
+{
+}
+
+session_consumer::session_consumer(cloud_queue queue, message_handler handler)
+    : session_consumer(queue, handler, session_consumer_options())
+{
+}
+
+session_consumer::session_consumer(cloud_queue queue, message_handler handler, const session_consumer_options& options)
+    : m_queue(queue), m_handler(handler), m_options(options), m_running(false), m_held(0), m_active(0),
+    m_last_expiry(std::chrono::steady_clock::now()), m_received(0), m_processed(0), m_failed(0),
+    m_parked(0), m_overflow(0), m_duplicates(0), m_out_of_order(0), m_skipped(0), m_dead_lettered(0)
+{
+    m_options.worker_count = std::max<size_t>(m_options.worker_count, 1);
+    m_options.prefetch_batch_size = std::min<size_t>(std::max<size_t>(m_options.prefetch_batch_size, 1), 32);
+    m_options.prefetch_capacity = std::max(m_options.prefetch_capacity, m_options.prefetch_batch_size);
+    m_options.max_pending_deletes = std::max<size_t>(m_options.max_pending_deletes, 1);
+
+    lease_manager_options lease_options;
+    lease_options.visibility_timeout = m_options.visibility_timeout;
+    lease_options.renewal_margin = m_options.renewal_margin;
+    lease_options.request_options = m_options.request_options;
+    m_leases.reset(new lease_manager(m_queue, lease_options));
+    m_deletes.reset(new delete_window(m_queue, m_options.max_pending_deletes, m_options.request_options));
+}
+
+session_consumer::~session_consumer()
+{
+    stop();
+}
+
+void session_consumer::start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    m_prefetcher = std::thread(&session_consumer::prefetch_loop, this);
+    for (size_t i = 0; i < m_options.worker_count; i++)
+    {
+        m_workers.push_back(std::thread(&session_consumer::worker_loop, this));
+    }
+}
+
+void session_consumer::stop()
+{
+    if (!m_running.exchange(false))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_work_available.notify_all();
+        m_space_available.notify_all();
+    }
+
+    m_prefetcher.join();
+    for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        it->join();
+    }
+    m_workers.clear();
+
+    // Session positions are kept, so a restarted consumer still recognises redeliveries.
+    std::vector<lease_manager::lease_id> held;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_unordered.begin(); it != m_unordered.end(); ++it)
+        {
+            held.push_back(it->id);
+        }
+
+        m_unordered.clear();
+        m_ready.clear();
+        for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it)
+        {
+            for (auto parked = it->second.parked.begin(); parked != it->second.parked.end(); ++parked)
+            {
+                held.push_back(parked->second.id);
+            }
+
+            it->second.parked.clear();
+            it->second.queued = false;
+        }
+
+        m_held = 0;
+    }
+
+    for (auto it = held.begin(); it != held.end(); ++it)
+    {
+        release(*it);
+    }
+
+    m_deletes->wait();
+}
+
+uint64_t session_consumer::received_count() const
+{
+    return m_received;
+}
+
+uint64_t session_consumer::processed_count() const
+{
+    return m_processed;
+}
+
+uint64_t session_consumer::failed_count() const
+{
+    return m_failed;
+}
+
+uint64_t session_consumer::parked_count() const
+{
+    return m_parked;
+}
+
+uint64_t session_consumer::overflow_count() const
+{
+    return m_overflow;
+}
+
+uint64_t session_consumer::duplicate_count() const
+{
+    return m_duplicates;
+}
+
+uint64_t session_consumer::out_of_order_count() const
+{
+    return m_out_of_order;
+}
+
+uint64_t session_consumer::skipped_count() const
+{
+    return m_skipped;
+}
+
+uint64_t session_consumer::dead_lettered_count() const
+{
+    return m_dead_lettered;
+}
+
+size_t session_consumer::session_count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sessions.size();
+}
+
+///
+/// Receives while there is room for a full batch. When every held message is parked behind
+/// a gap and no worker is busy, it keeps receiving past the capacity, since the missing
+/// messages can only arrive that way; out-of-turn arrivals then go back to the queue.
+///
+void session_consumer::prefetch_loop()
+{
+    polling_backoff backoff(m_options.empty_poll_delay, m_options.max_empty_poll_delay);
+    while (m_running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (m_running && !can_receive_locked())
+            {
+                m_space_available.wait_for(lock, std::chrono::seconds(1));
+                expire_locked(std::chrono::steady_clock::now());
+            }
+
+            if (!m_running)
+            {
+                break;
+            }
+        }
+
+        std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now();
+        std::vector<cloud_queue_message> messages;
+        try
+        {
+            messages = m_queue.get_messages(m_options.prefetch_batch_size, m_options.visibility_timeout, m_options.request_options, operation_context());
+        }
+        catch (const std::exception&)
+        {
+            // Treat a failed receive like an empty queue and try again after the delay.
+        }
+
+        std::chrono::milliseconds delay = backoff.next(!messages.empty());
+
+        std::vector<cloud_queue_message> duplicates;
+        std::vector<cloud_queue_message> overflow;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (messages.empty())
+            {
+                m_space_available.wait_for(lock, delay, [this] { return !m_running; });
+                expire_locked(std::chrono::steady_clock::now());
+                continue;
+            }
+
+            for (auto it = messages.begin(); it != messages.end(); ++it)
+            {
+                accept_locked(*it, requested + m_options.visibility_timeout, duplicates, overflow);
+            }
+
+            expire_locked(std::chrono::steady_clock::now());
+        }
+
+        m_received += messages.size();
+
+        for (auto it = duplicates.begin(); it != duplicates.end(); ++it)
+        {
+            m_deletes->remove(*it);
+        }
+
+        for (auto it = overflow.begin(); it != overflow.end(); ++it)
+        {
+            try
+            {
+                m_queue.update_message(*it, m_options.overflow_delay, false, m_options.request_options, operation_context());
+            }
+            catch (const std::exception&)
+            {
+                // The message reappears once its visibility timeout lapses.
+            }
+        }
+    }
+}
+
+void session_consumer::worker_loop()
+{
+    while (true)
+    {
+        utility::string_t key;
+        lease_manager::lease_id id = 0;
+        bool unordered = false;
+        bool out_of_order = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_work_available.wait(lock, [this] { return !m_running || !m_unordered.empty() || !m_ready.empty(); });
+
+            // Messages still held at shutdown are released by stop().
+            if (!m_running)
+            {
+                return;
+            }
+
+            if (!m_unordered.empty())
+            {
+                id = m_unordered.front().id;
+                out_of_order = m_unordered.front().out_of_order;
+                m_unordered.pop_front();
+                m_held--;
+                unordered = true;
+            }
+            else
+            {
+                key = m_ready.front();
+                m_ready.pop_front();
+
+                session_state& state = m_sessions[key];
+                state.queued = false;
+                state.active = true;
+                m_active++;
+            }
+
+            m_space_available.notify_all();
+        }
+
+        if (unordered)
+        {
+            process(id, out_of_order);
+        }
+        else
+        {
+            run_session(key);
+        }
+    }
+}
+
+///
+/// Handles the session's parked messages in order while the next one is there. Only one
+/// worker runs a session at a time, so its handler calls never overlap.
+///
+void session_consumer::run_session(const utility::string_t& key)
+{
+    while (true)
+    {
+        lease_manager::lease_id id;
+        uint64_t sequence;
+        utility::string_t message_id;
+        size_t body_hash;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            session_state& state = m_sessions[key];
+            if (!m_running || state.parked.empty() || state.parked.begin()->first != state.next_sequence)
+            {
+                state.active = false;
+                state.waiting_since = std::chrono::steady_clock::now();
+                m_active--;
+                m_space_available.notify_all();
+                return;
+            }
+
+            id = state.parked.begin()->second.id;
+            sequence = state.parked.begin()->first;
+            message_id = state.parked.begin()->second.message_id;
+            body_hash = state.parked.begin()->second.body_hash;
+            state.parked.erase(state.parked.begin());
+            m_held--;
+            m_space_available.notify_all();
+        }
+
+        outcome result = process(id, false);
+
+        // A failed or lost message comes back and is parked again; until then the session waits.
+        if (result == outcome::handled)
+        {
+            std::vector<cloud_queue_message> duplicates;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                session_state& state = m_sessions[key];
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                state.next_sequence = sequence + 1;
+                state.last_activity = now;
+
+                handled_message record;
+                record.message_id = message_id;
+                record.body_hash = body_hash;
+                record.handled_at = now;
+                state.handled[sequence] = record;
+
+                purge_locked(state, duplicates);
+            }
+
+            for (auto it = duplicates.begin(); it != duplicates.end(); ++it)
+            {
+                m_deletes->remove(*it);
+            }
+        }
+    }
+}
+
+///
+/// Runs the handler on a held message. A poison message, or an out of order one when
+/// dead_letter is set, is moved synchronously, so its session only moves past it once the
+/// move has succeeded.
+///
+session_consumer::outcome session_consumer::process(lease_manager::lease_id id, bool out_of_order)
+{
+    cloud_queue_message message;
+    if (!m_leases->get(id, message))
+    {
+        m_leases->release(id, message);
+        return outcome::lost;
+    }
+
+    if (m_options.dead_letter && (out_of_order || m_options.dead_letter->is_poison(message)))
+    {
+        if (!m_leases->release(id, message))
+        {
+            return outcome::lost;
+        }
+
+        try
+        {
+            m_options.dead_letter->move(message);
+            ++m_dead_lettered;
+            return outcome::handled;
+        }
+        catch (const std::exception&)
+        {
+            // The message reappears once its visibility timeout lapses and is moved again.
+            return outcome::lost;
+        }
+    }
+
+    session_message parsed;
+    if (!session_envelope::parse(message, parsed))
+    {
+        parsed.body = message.content_as_string();
+    }
+
+    parsed.out_of_order = out_of_order;
+
+    bool handled = false;
+    try
+    {
+        m_handler(parsed);
+        handled = true;
+    }
+    catch (...)
+    {
+    }
+
+    if (handled)
+    {
+        ++m_processed;
+        acknowledge(id);
+        return outcome::handled;
+    }
+
+    ++m_failed;
+    release(id);
+    return outcome::failed;
+}
+
+bool session_consumer::can_receive_locked() const
+{
+    return m_held + m_options.prefetch_batch_size <= m_options.prefetch_capacity || (m_active == 0 && m_ready.empty() && m_unordered.empty());
+}
+
+///
+/// Files a received message: parks it in its session, makes the session ready if it is the
+/// expected one, sets it aside to be deleted as a copy or returned as overflow, or hands it
+/// over as out of order.
+///
+void session_consumer::accept_locked(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires,
+    std::vector<cloud_queue_message>& duplicates, std::vector<cloud_queue_message>& overflow)
+{
+    session_message parsed;
+    if (!session_envelope::parse(message, parsed))
+    {
+        hand_over_locked(message, expires, false);
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    auto found = m_sessions.find(parsed.session);
+    if (found == m_sessions.end())
+    {
+        session_state state;
+        state.next_sequence = m_options.initial_sequence ? m_options.initial_sequence(parsed.session) : 0;
+        state.queued = false;
+        state.active = false;
+        state.waiting_since = now;
+        found = m_sessions.insert(std::make_pair(parsed.session, state)).first;
+    }
+
+    session_state& state = found->second;
+    state.last_activity = now;
+    size_t body_hash = std::hash<utility::string_t>()(parsed.body);
+
+    if (parsed.sequence < state.next_sequence)
+    {
+        auto handled = state.handled.find(parsed.sequence);
+        if (handled != state.handled.end() && same_message(message.id(), body_hash, handled->second.message_id, handled->second.body_hash))
+        {
+            ++m_duplicates;
+            duplicates.push_back(message);
+            return;
+        }
+
+        // The session skipped its position, or another producer used it.
+        ++m_out_of_order;
+        hand_over_locked(message, expires, true);
+        return;
+    }
+
+    auto parked = state.parked.find(parsed.sequence);
+    if (parked != state.parked.end())
+    {
+        if (parked->second.message_id == message.id())
+        {
+            // The parked copy lost its lease and the message came back; track the new receipt.
+            cloud_queue_message stale;
+            m_leases->release(parked->second.id, stale);
+            parked->second.id = m_leases->track(message, expires);
+            return;
+        }
+
+        if (parked->second.body_hash == body_hash)
+        {
+            // A retried add put the message in twice; keep the first.
+            ++m_duplicates;
+            duplicates.push_back(message);
+            return;
+        }
+
+        // Another producer used the same position.
+        ++m_out_of_order;
+        hand_over_locked(message, expires, true);
+        return;
+    }
+
+    bool expected = parsed.sequence == state.next_sequence;
+    if (!expected && m_held >= m_options.prefetch_capacity)
+    {
+        ++m_overflow;
+        overflow.push_back(message);
+        return;
+    }
+
+    if (state.parked.empty())
+    {
+        state.waiting_since = now;
+    }
+
+    parked_message entry;
+    entry.id = m_leases->track(message, expires);
+    entry.message_id = message.id();
+    entry.body_hash = body_hash;
+    state.parked.insert(std::make_pair(parsed.sequence, entry));
+    m_held++;
+
+    if (expected)
+    {
+        make_ready_locked(found->first, state);
+    }
+    else
+    {
+        ++m_parked;
+    }
+}
+
+// Queues a message to be handled on its own, outside any session.
+void session_consumer::hand_over_locked(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires, bool out_of_order)
+{
+    unordered_message entry;
+    entry.id = m_leases->track(message, expires);
+    entry.out_of_order = out_of_order;
+    m_unordered.push_back(entry);
+    m_held++;
+    m_work_available.notify_one();
+}
+
+void session_consumer::make_ready_locked(const utility::string_t& key, session_state& state)
+{
+    if (state.queued || state.active)
+    {
+        return;
+    }
+
+    state.queued = true;
+    m_ready.push_back(key);
+    m_work_available.notify_one();
+}
+
+///
+/// Parked messages from before the session's position arrived while the message at their
+/// position was being handled. Copies of it are set aside to be deleted, and any other is
+/// handed over as out of order, so the session doesn't stall behind them.
+///
+void session_consumer::purge_locked(session_state& state, std::vector<cloud_queue_message>& duplicates)
+{
+    while (!state.parked.empty() && state.parked.begin()->first < state.next_sequence)
+    {
+        auto parked = state.parked.begin();
+        auto handled = state.handled.find(parked->first);
+        if (handled != state.handled.end() && same_message(parked->second.message_id, parked->second.body_hash, handled->second.message_id, handled->second.body_hash))
+        {
+            cloud_queue_message message;
+            if (m_leases->release(parked->second.id, message))
+            {
+                duplicates.push_back(message);
+            }
+
+            ++m_duplicates;
+            m_held--;
+            m_space_available.notify_all();
+        }
+        else
+        {
+            // Still held, so it moves from the session to the unordered messages as it is.
+            unordered_message entry;
+            entry.id = parked->second.id;
+            entry.out_of_order = true;
+            m_unordered.push_back(entry);
+            ++m_out_of_order;
+            m_work_available.notify_one();
+        }
+
+        state.parked.erase(parked);
+    }
+}
+
+///
+/// Once a second, forgets handled messages older than redelivery_window, moves sessions that
+/// have waited max_gap_wait for a missing message on to the lowest one they hold, and
+/// forgets idle sessions with nothing held.
+///
+void session_consumer::expire_locked(std::chrono::steady_clock::time_point now)
+{
+    if (now - m_last_expiry < std::chrono::seconds(1))
+    {
+        return;
+    }
+
+    m_last_expiry = now;
+    for (auto it = m_sessions.begin(); it != m_sessions.end();)
+    {
+        session_state& state = it->second;
+        while (!state.handled.empty() && now - state.handled.begin()->second.handled_at >= m_options.redelivery_window)
+        {
+            state.handled.erase(state.handled.begin());
+        }
+
+        if (state.queued || state.active)
+        {
+            ++it;
+            continue;
+        }
+
+        if (state.parked.empty())
+        {
+            if (now - state.last_activity >= m_options.idle_session_timeout)
+            {
+                it = m_sessions.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+            continue;
+        }
+
+        uint64_t lowest = state.parked.begin()->first;
+        if (lowest > state.next_sequence && now - state.waiting_since >= m_options.max_gap_wait)
+        {
+            m_skipped += lowest - state.next_sequence;
+            state.next_sequence = lowest;
+            make_ready_locked(it->first, state);
+        }
+
+        ++it;
+    }
+}
+
+///
+/// Deletes a handled message without blocking the worker, unless max_pending_deletes
+/// deletes are already outstanding. If the delete fails, the message comes back from
+/// before its session's position and is deleted then, as a copy of a handled message.
+///
+void session_consumer::acknowledge(lease_manager::lease_id id)
+{
+    cloud_queue_message message;
+    if (m_leases->release(id, message))
+    {
+        m_deletes->remove(message);
+    }
+}
+
+///
+/// Makes a message visible again immediately instead of waiting for its lease to run out.
+///
+void session_consumer::release(lease_manager::lease_id id)
+{
+    cloud_queue_message message;
+    if (m_leases->release(id, message))
+    {
+        m_deletes->release(message);
+    }
+}
@@ -0,0 +1,321 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "delete_window.h"
+#include "lease_manager.h"
+#include "poison_queue.h"
+
+using namespace azure::storage;
+
+///
+/// The parts of a session message: the key of the session it belongs to, its position in
+/// the session, and the payload.
+///
+struct session_message
+{
+    session_message();
+
+    utility::string_t session;
+    uint64_t sequence;
+    utility::string_t body;
+
+    // Set by session_consumer for a message it could not place in its session: one that came
+    // after the session moved past its sequence number, or one whose position another message
+    // already holds. It is handled on its own, in no particular order.
+    bool out_of_order;
+};
+
+///
+/// Envelope that carries the session key and sequence number in the message content:
+///
+///     session:1;<sequence>;<key length>;<key><body>
+///
+/// The key is length-prefixed, so it may contain any character.
+///
+class session_envelope
+{
+public:
+    static cloud_queue_message create(const session_message& message);
+
+    // Returns false if the message has no session envelope.
+    static bool parse(const cloud_queue_message& message, session_message& parsed);
+};
+
+///
+/// Stamps each message with its session key and the next sequence number of that session.
+/// Sequences start at zero for every session key this producer has not seen before. Only one
+/// producer may add to a session, since each numbers its messages on its own.
+///
+/// Adds may complete out of order, even within a session; session_consumer puts them back
+/// in order. Thread-safe.
+///
+class session_producer
+{
+public:
+    explicit session_producer(cloud_queue queue, const queue_request_options& options = queue_request_options());
+
+    void add_message(const utility::string_t& session, const utility::string_t& body);
+    pplx::task<void> add_message_async(const utility::string_t& session, const utility::string_t& body);
+
+    // The sequence number the next message of the session will get.
+    uint64_t next_sequence(const utility::string_t& session) const;
+
+    // Continues a session from a known position, for example after a producer restart.
+    void set_next_sequence(const utility::string_t& session, uint64_t sequence);
+
+private:
+    session_producer(const session_producer&);
+    session_producer& operator=(const session_producer&);
+
+    session_message stamp(const utility::string_t& session, const utility::string_t& body);
+
+    cloud_queue m_queue;
+    queue_request_options m_options;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<utility::string_t, uint64_t> m_sequences;
+};
+
+///
+/// Settings for session_consumer.
+///
+struct session_consumer_options
+{
+    session_consumer_options();
+
+    // Number of threads running the message handler. Each works on one session at a time.
+    size_t worker_count;
+
+    // Messages requested per get_messages call (the service allows at most 32).
+    size_t prefetch_batch_size;
+
+    // Maximum number of received messages held, parked or waiting for a worker.
+    size_t prefetch_capacity;
+
+    // Visibility timeout requested on receive and on each renewal of a held message.
+    std::chrono::seconds visibility_timeout;
+
+    // A lease is renewed once less than this much of it is left.
+    std::chrono::seconds renewal_margin;
+
+    // Maximum number of deletes outstanding at once.
+    size_t max_pending_deletes;
+
+    // How long the prefetcher waits after the queue first comes back empty, doubling up to
+    // max_empty_poll_delay.
+    std::chrono::milliseconds empty_poll_delay;
+    std::chrono::milliseconds max_empty_poll_delay;
+
+    // How long a session waits for a missing sequence number before skipping to the lowest
+    // one it holds.
+    std::chrono::seconds max_gap_wait;
+
+    // Once prefetch_capacity messages are held, messages that are not next in their session
+    // are made visible again after this long instead of being parked.
+    std::chrono::seconds overflow_delay;
+
+    // A session with nothing held is forgotten after this long without messages. Keep it
+    // above redelivery_window.
+    std::chrono::seconds idle_session_timeout;
+
+    // How long the ids of handled messages are kept, so a copy redelivered after a failed
+    // delete or a lost lease is recognised and deleted. Keep it well above the visibility
+    // timeout; a copy that comes back later is handed over as out of order.
+    std::chrono::seconds redelivery_window;
+
+    queue_request_options request_options;
+
+    // Where a session the consumer has not seen starts. Without it every session starts at
+    // zero, and a session that began before this consumer waits max_gap_wait once.
+    std::function<uint64_t(const utility::string_t& session)> initial_sequence;
+
+    // If set, messages received more often than its max_dequeue_count are moved to its poison
+    // queue and their session moves on, and out of order messages are moved there instead of
+    // being handled. The poison queue must already exist.
+    std::shared_ptr<poison_queue> dead_letter;
+};
+
+///
+/// Handles messages from a session_producer in sequence order within each session, while
+/// different sessions are handled in parallel.
+///
+/// Each session keeps a reorder buffer. A message that arrives ahead of its turn is parked:
+/// it stays received, and a lease_manager extends its visibility with update_message, so it
+/// is neither redelivered nor handled twice. When the expected message arrives, a worker
+/// takes the session and handles its parked messages in order until the next gap.
+///
+/// A copy of a message that was already handled or is already parked, recognised by its
+/// message id or, for a retried add, its body, is deleted unhandled. A message from before
+/// the session's position that is not such a copy, or that conflicts with the message
+/// holding its position, is out of order: it goes to dead_letter if set, and otherwise to
+/// the handler with out_of_order set.
+///
+/// A message whose handler throws is made visible again and its session waits for it, so
+/// later messages are never handled first. Messages without a session envelope are
+/// handled as they arrive, with an empty session key.
+///
+/// Session positions live in the consumer, so run only one session_consumer per queue, and
+/// only one session_producer per session.
+///
+class session_consumer
+{
+public:
+    typedef std::function<void(const session_message& message)> message_handler;
+
+    session_consumer(cloud_queue queue, message_handler handler);
+    session_consumer(cloud_queue queue, message_handler handler, const session_consumer_options& options);
+
+    // Stops the consumer if it is still running.
+    ~session_consumer();
+
+    void start();
+
+    ///
+    /// Stops receiving, waits for in-progress handlers and pending deletes, and makes parked
+    /// messages visible again.
+    ///
+    void stop();
+
+    uint64_t received_count() const;
+    uint64_t processed_count() const;
+    uint64_t failed_count() const;
+
+    // Messages that arrived ahead of their turn and were parked.
+    uint64_t parked_count() const;
+
+    // Messages made visible again because prefetch_capacity messages were already held.
+    uint64_t overflow_count() const;
+
+    // Redelivered or re-added copies of messages already handled or parked.
+    uint64_t duplicate_count() const;
+
+    // Messages that could not be placed in their session; see session_message::out_of_order.
+    uint64_t out_of_order_count() const;
+
+    // Sequence numbers skipped after waiting max_gap_wait for them.
+    uint64_t skipped_count() const;
+
+    uint64_t dead_lettered_count() const;
+
+    // Sessions currently tracked.
+    size_t session_count() const;
+
+private:
+    struct parked_message
+    {
+        lease_manager::lease_id id;
+        utility::string_t message_id;
+        size_t body_hash;
+    };
+
+    struct handled_message
+    {
+        utility::string_t message_id;
+        size_t body_hash;
+        std::chrono::steady_clock::time_point handled_at;
+    };
+
+    struct unordered_message
+    {
+        lease_manager::lease_id id;
+        bool out_of_order;
+    };
+
+    struct session_state
+    {
+        uint64_t next_sequence;
+        std::map<uint64_t, parked_message> parked;
+
+        // Handled within redelivery_window, by sequence number.
+        std::map<uint64_t, handled_message> handled;
+
+        bool queued;
+        bool active;
+        std::chrono::steady_clock::time_point waiting_since;
+        std::chrono::steady_clock::time_point last_activity;
+    };
+
+    enum class outcome
+    {
+        handled,
+        failed,
+        lost
+    };
+
+    session_consumer(const session_consumer&);
+    session_consumer& operator=(const session_consumer&);
+
+    void prefetch_loop();
+    void worker_loop();
+    void run_session(const utility::string_t& key);
+    outcome process(lease_manager::lease_id id, bool out_of_order);
+
+    bool can_receive_locked() const;
+    void accept_locked(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires, std::vector<cloud_queue_message>& duplicates, std::vector<cloud_queue_message>& overflow);
+    void hand_over_locked(const cloud_queue_message& message, std::chrono::steady_clock::time_point expires, bool out_of_order);
+    void make_ready_locked(const utility::string_t& key, session_state& state);
+    void purge_locked(session_state& state, std::vector<cloud_queue_message>& duplicates);
+    void expire_locked(std::chrono::steady_clock::time_point now);
+
+    void acknowledge(lease_manager::lease_id id);
+    void release(lease_manager::lease_id id);
+
+    cloud_queue m_queue;
+    message_handler m_handler;
+    session_consumer_options m_options;
+
+    std::atomic<bool> m_running;
+    std::thread m_prefetcher;
+    std::vector<std::thread> m_workers;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_space_available;
+    std::unordered_map<utility::string_t, session_state> m_sessions;
+    std::deque<utility::string_t> m_ready;
+    std::deque<unordered_message> m_unordered;
+    size_t m_held;
+    size_t m_active;
+    std::chrono::steady_clock::time_point m_last_expiry;
+
+    std::unique_ptr<lease_manager> m_leases;
+    std::unique_ptr<delete_window> m_deletes;
+
+    std::atomic<uint64_t> m_received;
+    std::atomic<uint64_t> m_processed;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_parked;
+    std::atomic<uint64_t> m_overflow;
+    std::atomic<uint64_t> m_duplicates;
+    std::atomic<uint64_t> m_out_of_order;
+    std::atomic<uint64_t> m_skipped;
+    std::atomic<uint64_t> m_dead_lettered;
+};
@@ -0,0 +1,285 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "sharded_queue.h"
+#include "queue_group.h"
+#include "queue_poller.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+sharded_queue::sharded_queue(std::vector<cloud_queue> shards)
+    : m_shards(std::move(shards)), m_next(std::make_shared<std::atomic<size_t>>(0))
+{
+    if (m_shards.empty())
+    {
+        throw std::invalid_argument("A sharded queue needs at least one shard");
+    }
+}
+
+sharded_queue sharded_queue::discover(cloud_queue_client queue_client, const utility::string_t& prefix)
+{
+    std::vector<utility::string_t> names;
+    queue_result_iterator end_of_results;
+    for (auto it = queue_client.list_queues(prefix); it != end_of_results; ++it)
+    {
+        names.push_back(it->name());
+    }
+
+    std::sort(names.begin(), names.end());
+
+    std::vector<cloud_queue> shards;
+    for (auto it = names.begin(); it != names.end(); ++it)
+    {
+        shards.push_back(queue_client.get_queue_reference(*it));
+    }
+
+    return sharded_queue(std::move(shards));
+}
+
+sharded_queue sharded_queue::create(cloud_queue_client queue_client, const utility::string_t& prefix, size_t shard_count)
+{
+    std::vector<cloud_queue> shards;
+    std::vector<pplx::task<bool>> creates;
+    for (size_t i = 0; i < shard_count; i++)
+    {
+        shards.push_back(queue_client.get_queue_reference(prefix + utility::conversions::print_string(i)));
+        creates.push_back(shards.back().create_if_not_exists_async());
+    }
+
+    pplx::when_all(creates.begin(), creates.end()).wait();
+
+    return sharded_queue(std::move(shards));
+}
+
+size_t sharded_queue::shard_count() const
+{
+    return m_shards.size();
+}
+
+cloud_queue& sharded_queue::shard(size_t index)
+{
+    return m_shards.at(index);
+}
+
+size_t sharded_queue::shard_for_key(const utility::string_t& key) const
+{
+    std::string bytes = utility::conversions::to_utf8string(key);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto it = bytes.begin(); it != bytes.end(); ++it)
+    {
+        hash ^= static_cast<uint8_t>(*it);
+        hash *= 1099511628211ULL;
+    }
+
+    return static_cast<size_t>(hash % m_shards.size());
+}
+
+size_t sharded_queue::next_shard()
+{
+    return (*m_next)++ % m_shards.size();
+}
+
+void sharded_queue::add_message(cloud_queue_message& message)
+{
+    m_shards[next_shard()].add_message(message);
+}
+
+void sharded_queue::add_message(cloud_queue_message& message, const utility::string_t& key)
+{
+    m_shards[shard_for_key(key)].add_message(message);
+}
+
+pplx::task<void> sharded_queue::add_message_async(cloud_queue_message& message)
+{
+    return m_shards[next_shard()].add_message_async(message);
+}
+
+pplx::task<void> sharded_queue::add_message_async(cloud_queue_message& message, const utility::string_t& key)
+{
+    return m_shards[shard_for_key(key)].add_message_async(message);
+}
+
+int sharded_queue::approximate_message_count()
+{
+    std::vector<int> counts = queue_group::approximate_message_counts(m_shards, queue_request_options());
+    return std::accumulate(counts.begin(), counts.end(), 0);
+}
+
+void sharded_queue::delete_shards_if_exist()
+{
+    for (auto it = m_shards.begin(); it != m_shards.end(); ++it)
+    {
+        it->delete_queue_if_exists();
+    }
+}
+
+sharded_queue_consumer_options::sharded_queue_consumer_options()
+    : worker_count(4), batch_size(16), visibility_timeout(30), empty_poll_delay(50), max_empty_poll_delay(10000)
+{
+}
+
+sharded_queue_consumer::sharded_queue_consumer(sharded_queue queue, message_handler handler)
+    : sharded_queue_consumer(queue, handler, sharded_queue_consumer_options())
+{
+}
+
+sharded_queue_consumer::sharded_queue_consumer(sharded_queue queue, message_handler handler, const sharded_queue_consumer_options& options)
+    : m_queue(queue), m_handler(handler), m_options(options), m_running(false), m_last_batch(queue.shard_count()),
+    m_received(queue.shard_count()), m_processed(0), m_failed(0), m_stolen(0)
+{
+}
+
+sharded_queue_consumer::~sharded_queue_consumer()
+{
+    stop();
+}
+
+void sharded_queue_consumer::start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < std::max<size_t>(m_options.worker_count, 1); i++)
+    {
+        m_workers.push_back(std::thread(&sharded_queue_consumer::worker_loop, this, i % m_queue.shard_count()));
+    }
+}
+
+void sharded_queue_consumer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running.exchange(false))
+        {
+            return;
+        }
+
+        m_stopping.notify_all();
+    }
+
+    for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        it->join();
+    }
+
+    m_workers.clear();
+}
+
+uint64_t sharded_queue_consumer::processed_count() const
+{
+    return m_processed;
+}
+
+uint64_t sharded_queue_consumer::failed_count() const
+{
+    return m_failed;
+}
+
+uint64_t sharded_queue_consumer::stolen_count() const
+{
+    return m_stolen;
+}
+
+uint64_t sharded_queue_consumer::received_count(size_t shard) const
+{
+    return m_received.at(shard);
+}
+
+void sharded_queue_consumer::worker_loop(size_t home)
+{
+    size_t shard_count = m_queue.shard_count();
+    polling_backoff backoff(m_options.empty_poll_delay, m_options.max_empty_poll_delay);
+    while (m_running)
+    {
+        if (drain(home, home))
+        {
+            backoff.reset();
+            continue;
+        }
+
+        size_t victim = hottest_shard(home);
+        bool found = victim != home && drain(victim, home);
+        for (size_t i = 1; !found && i < shard_count && m_running; i++)
+        {
+            size_t shard = (home + i) % shard_count;
+            if (shard != victim)
+            {
+                found = drain(shard, home);
+            }
+        }
+
+        std::chrono::milliseconds delay = backoff.next(found);
+        if (!found)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_stopping.wait_for(lock, delay, [this] { return !m_running; });
+        }
+    }
+}
+
+///
+/// Receives and handles one batch from the shard. Returns false if the shard was empty.
+///
+bool sharded_queue_consumer::drain(size_t shard, size_t home)
+{
+    queue_group::batch_result batch = queue_group::receive_and_handle(m_queue.shard(shard), m_options.batch_size, m_options.visibility_timeout, m_options.request_options, m_handler);
+
+    m_last_batch[shard] = batch.received;
+    if (batch.received == 0)
+    {
+        return false;
+    }
+
+    m_received[shard] += batch.received;
+    if (shard != home)
+    {
+        m_stolen += batch.received;
+    }
+
+    m_processed += batch.processed;
+    m_failed += batch.failed;
+    return true;
+}
+
+///
+/// The shard other than home that returned the largest batch on its last receive, or home if
+/// no other shard had messages.
+///
+size_t sharded_queue_consumer::hottest_shard(size_t home) const
+{
+    size_t hottest = home;
+    size_t largest = 0;
+    for (size_t i = 0; i < m_last_batch.size(); i++)
+    {
+        size_t batch = m_last_batch[i];
+        if (i != home && batch > largest)
+        {
+            hottest = i;
+            largest = batch;
+        }
+    }
+
+    return hottest;
+}
@@ -0,0 +1,154 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace azure::storage;
+
+///
+/// One logical queue spread over several physical queues, so throughput is not capped by the
+/// per-queue limit of the service. Messages are routed to a shard by hashing a key, which keeps
+/// messages with the same key on the same shard, or round-robin when there is no key.
+///
+/// Copies share the round-robin position.
+///
+class sharded_queue
+{
+public:
+    explicit sharded_queue(std::vector<cloud_queue> shards);
+
+    ///
+    /// Finds the existing queues whose names start with the prefix. Shards are ordered by name,
+    /// so every process that discovers the same queues routes keys the same way. Adding or
+    /// removing a shard changes where most keys go.
+    ///
+    static sharded_queue discover(cloud_queue_client queue_client, const utility::string_t& prefix);
+
+    // Creates the queues prefix0 .. prefix<shard_count - 1> if they don't already exist.
+    static sharded_queue create(cloud_queue_client queue_client, const utility::string_t& prefix, size_t shard_count);
+
+    size_t shard_count() const;
+    cloud_queue& shard(size_t index);
+
+    // Shard for a key; FNV-1a over the UTF-8 bytes of the key, so it is the same on every platform.
+    size_t shard_for_key(const utility::string_t& key) const;
+
+    // Next shard in round-robin order.
+    size_t next_shard();
+
+    void add_message(cloud_queue_message& message);
+    void add_message(cloud_queue_message& message, const utility::string_t& key);
+    // The message is updated when the add completes, so it must outlive the task.
+    pplx::task<void> add_message_async(cloud_queue_message& message);
+    pplx::task<void> add_message_async(cloud_queue_message& message, const utility::string_t& key);
+
+    // Sum of the approximate message counts of all shards; fetches the attributes of each.
+    int approximate_message_count();
+
+    void delete_shards_if_exist();
+
+private:
+    std::vector<cloud_queue> m_shards;
+    std::shared_ptr<std::atomic<size_t>> m_next;
+};
+
+///
+/// Settings for sharded_queue_consumer.
+///
+struct sharded_queue_consumer_options
+{
+    sharded_queue_consumer_options();
+
+    // Number of worker threads; worker i starts on shard i modulo the shard count.
+    size_t worker_count;
+
+    // Messages requested per get_messages call (the service allows at most 32).
+    size_t batch_size;
+
+    // Visibility timeout requested on receive; handlers are expected to finish within it.
+    std::chrono::seconds visibility_timeout;
+
+    // How long a worker waits after first finding every shard empty. The wait doubles each
+    // time the shards are all empty again, up to max_empty_poll_delay.
+    std::chrono::milliseconds empty_poll_delay;
+    std::chrono::milliseconds max_empty_poll_delay;
+
+    queue_request_options request_options;
+};
+
+///
+/// Consumes a sharded_queue with a pool of workers. Each worker has a home shard it drains
+/// first. When its home shard is empty it steals from the shard that most recently returned
+/// the fullest batch, then from the others in turn, so idle workers help with hot shards.
+///
+/// A message whose handler throws is made visible again right away so it can be retried.
+///
+class sharded_queue_consumer
+{
+public:
+    typedef std::function<void(const cloud_queue_message& message)> message_handler;
+
+    sharded_queue_consumer(sharded_queue queue, message_handler handler);
+    sharded_queue_consumer(sharded_queue queue, message_handler handler, const sharded_queue_consumer_options& options);
+
+    // Stops the consumer if it is still running.
+    ~sharded_queue_consumer();
+
+    void start();
+
+    // Stops receiving and waits for in-progress batches to finish.
+    void stop();
+
+    uint64_t processed_count() const;
+    uint64_t failed_count() const;
+
+    // Messages a worker received from a shard other than its home shard.
+    uint64_t stolen_count() const;
+
+    uint64_t received_count(size_t shard) const;
+
+private:
+    sharded_queue_consumer(const sharded_queue_consumer&);
+    sharded_queue_consumer& operator=(const sharded_queue_consumer&);
+
+    void worker_loop(size_t home);
+    bool drain(size_t shard, size_t home);
+    size_t hottest_shard(size_t home) const;
+
+    sharded_queue m_queue;
+    message_handler m_handler;
+    sharded_queue_consumer_options m_options;
+
+    std::atomic<bool> m_running;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_stopping;
+
+    std::vector<std::atomic<size_t>> m_last_batch;
+    std::vector<std::atomic<uint64_t>> m_received;
+    std::atomic<uint64_t> m_processed;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_stolen;
+};
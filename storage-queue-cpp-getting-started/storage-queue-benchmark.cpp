@@ -0,0 +1,867 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "base64_codec.h"
+#include "latency_histogram.h"
+#include "local_queue_service.h"
+#include "queue_coroutines.h"
+#include "string_util.h"
+#include "throttling_retry_policy.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace azure::storage;
+
+// Operations the benchmark can drive, in the order each worker runs them per iteration.
+enum benchmark_operation
+{
+    operation_add,
+    operation_peek,
+    operation_get,
+    operation_update,
+    operation_delete,
+    operation_get_messages,
+    operation_count
+};
+
+static const char* operation_names[operation_count] = { "add", "peek", "get", "update", "delete", "get_messages" };
+
+struct benchmark_options
+{
+    benchmark_options()
+        : local(false), concurrency(4), message_size(256), duration(10), batch_size(32), prefill(0), json(false), throttling(false),
+        base64(false), coroutines(false), local_latency(0), local_throttle_rate(0.0), local_error_rate(0.0)
+    {
+        std::fill(enabled, enabled + operation_count, true);
+    }
+
+    utility::string_t connection_string;
+    bool local;
+    size_t concurrency;
+    size_t message_size;
+    std::chrono::seconds duration;
+    size_t batch_size;
+    size_t prefill;
+    bool json;
+    bool throttling;
+    bool base64;
+    bool coroutines;
+    bool enabled[operation_count];
+    std::chrono::milliseconds local_latency;
+    double local_throttle_rate;
+    double local_error_rate;
+};
+
+// Results for one operation type, kept per worker and merged at the end.
+struct operation_stats
+{
+    operation_stats()
+        : operations(0), messages(0), bytes(0), errors(0)
+    {
+    }
+
+    void merge(const operation_stats& other)
+    {
+        operations += other.operations;
+        messages += other.messages;
+        bytes += other.bytes;
+        errors += other.errors;
+        latency.merge(other.latency);
+    }
+
+    uint64_t operations;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t errors;
+    latency_histogram latency;
+};
+
+static void print_usage()
+{
+    ucout << U("Usage: azurestoragesamples_bench [options]") << std::endl
+        << U("  --connection-string <value>  Run against this storage account (default: --local)") << std::endl
+        << U("  --local                      Run against an in-process local_queue_service") << std::endl
+        << U("  --concurrency <n>            Worker threads (default 4)") << std::endl
+        << U("  --message-size <bytes>       Message content size (default 256)") << std::endl
+        << U("  --duration <seconds>         Measurement time (default 10)") << std::endl
+        << U("  --operations <list>          Comma-separated subset of add,peek,get,update,delete,get_messages") << std::endl
+        << U("  --batch-size <n>             Messages per get_messages call, at most 32 (default 32)") << std::endl
+        << U("  --prefill <n>                Messages added before measuring (default 0)") << std::endl
+        << U("  --local-latency <ms>         Latency injected by the local service") << std::endl
+        << U("  --local-throttle-rate <0-1>  Fraction of requests the local service throttles") << std::endl
+        << U("  --local-error-rate <0-1>     Fraction of requests the local service fails") << std::endl
+        << U("  --throttling                 Pace requests with a shared throttling_controller") << std::endl
+        << U("  --base64                     Compare base64 paths for binary content instead (no queue needed)") << std::endl
+        << U("  --coroutines                 Compare blocking worker threads with the coroutine layer (C++20 build)") << std::endl
+        << U("  --json                       Print results as JSON") << std::endl;
+}
+
+static bool parse_options(int argc, char* argv[], benchmark_options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string name(argv[i]);
+        bool has_value = i + 1 < argc;
+
+        if (name == "--local")
+        {
+            options.local = true;
+        }
+        else if (name == "--json")
+        {
+            options.json = true;
+        }
+        else if (name == "--throttling")
+        {
+            options.throttling = true;
+        }
+        else if (name == "--base64")
+        {
+            options.base64 = true;
+        }
+        else if (name == "--coroutines")
+        {
+            options.coroutines = true;
+        }
+        else if (name == "--connection-string" && has_value)
+        {
+            options.connection_string = utility::conversions::to_string_t(std::string(argv[++i]));
+        }
+        else if (name == "--concurrency" && has_value)
+        {
+            options.concurrency = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (name == "--message-size" && has_value)
+        {
+            options.message_size = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (name == "--duration" && has_value)
+        {
+            options.duration = std::chrono::seconds(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (name == "--batch-size" && has_value)
+        {
+            options.batch_size = std::min(32, std::max(1, std::atoi(argv[++i])));
+        }
+        else if (name == "--prefill" && has_value)
+        {
+            options.prefill = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (name == "--local-latency" && has_value)
+        {
+            options.local_latency = std::chrono::milliseconds(std::max(0, std::atoi(argv[++i])));
+        }
+        else if (name == "--local-throttle-rate" && has_value)
+        {
+            options.local_throttle_rate = std::atof(argv[++i]);
+        }
+        else if (name == "--local-error-rate" && has_value)
+        {
+            options.local_error_rate = std::atof(argv[++i]);
+        }
+        else if (name == "--operations" && has_value)
+        {
+            std::fill(options.enabled, options.enabled + operation_count, false);
+
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+            {
+                const char** found = std::find_if(operation_names, operation_names + operation_count, [&item](const char* candidate) { return item == candidate; });
+                if (found == operation_names + operation_count)
+                {
+                    return false;
+                }
+
+                options.enabled[found - operation_names] = true;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (options.connection_string.empty())
+    {
+        options.local = true;
+    }
+
+    return true;
+}
+
+// Runs one operation and records its latency, or counts an error if it throws. With a
+// controller, the wait for the shared rate limit is not counted as latency.
+template<typename Operation>
+static bool timed(throttling_controller* controller, operation_stats& stats, Operation operation)
+{
+    std::chrono::steady_clock::time_point start;
+    try
+    {
+        if (controller != nullptr)
+        {
+            controller->acquire();
+        }
+
+        start = std::chrono::steady_clock::now();
+        operation();
+    }
+    catch (const std::exception&)
+    {
+        stats.errors++;
+        return false;
+    }
+
+    stats.operations++;
+    stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+    return true;
+}
+
+///
+/// Each worker repeats the cycle shown in queue_basic::queue_operations: add, peek, get,
+/// update and delete a message, then receive and delete a batch with get_messages.
+///
+static void run_worker(cloud_queue queue, const benchmark_options& options, const utility::string_t& content,
+    std::chrono::steady_clock::time_point deadline, throttling_controller* controller, std::vector<operation_stats>& stats)
+{
+    queue_request_options request_options;
+    size_t content_bytes = content.size();
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (options.enabled[operation_add])
+        {
+            cloud_queue_message message(content);
+            if (timed(controller, stats[operation_add], [&] { queue.add_message(message); }))
+            {
+                stats[operation_add].messages++;
+                stats[operation_add].bytes += content_bytes;
+            }
+        }
+
+        if (options.enabled[operation_peek])
+        {
+            cloud_queue_message message;
+            if (timed(controller, stats[operation_peek], [&] { message = queue.peek_message(); }) && !message.id().empty())
+            {
+                stats[operation_peek].messages++;
+                stats[operation_peek].bytes += message.content_as_string().size();
+            }
+        }
+
+        cloud_queue_message received;
+        if (options.enabled[operation_get])
+        {
+            if (timed(controller, stats[operation_get], [&] { received = queue.get_message(); }) && !received.id().empty())
+            {
+                stats[operation_get].messages++;
+                stats[operation_get].bytes += received.content_as_string().size();
+            }
+        }
+
+        if (!received.id().empty() && options.enabled[operation_update])
+        {
+            received.set_content(content);
+            if (timed(controller, stats[operation_update], [&] { queue.update_message(received, std::chrono::seconds(30), true); }))
+            {
+                stats[operation_update].messages++;
+                stats[operation_update].bytes += content_bytes;
+            }
+        }
+
+        if (!received.id().empty() && options.enabled[operation_delete])
+        {
+            if (timed(controller, stats[operation_delete], [&] { queue.delete_message(received); }))
+            {
+                stats[operation_delete].messages++;
+            }
+        }
+
+        if (options.enabled[operation_get_messages])
+        {
+            std::vector<cloud_queue_message> batch;
+            if (timed(controller, stats[operation_get_messages], [&] { batch = queue.get_messages(options.batch_size, std::chrono::seconds(30), request_options, operation_context()); }))
+            {
+                for (auto it = batch.begin(); it != batch.end(); ++it)
+                {
+                    stats[operation_get_messages].messages++;
+                    stats[operation_get_messages].bytes += it->content_as_string().size();
+
+                    if (options.enabled[operation_delete] && timed(controller, stats[operation_delete], [&] { queue.delete_message(*it); }))
+                    {
+                        stats[operation_delete].messages++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void print_text(const benchmark_options& options, const std::vector<operation_stats>& totals, double elapsed)
+{
+    ucout << U("concurrency ") << options.concurrency << U(", message size ") << options.message_size << U(" bytes, ")
+        << std::fixed << std::setprecision(1) << elapsed << U(" s") << std::endl << std::endl;
+
+    ucout << std::left << std::setw(14) << U("operation") << std::right
+        << std::setw(10) << U("ops") << std::setw(10) << U("errors")
+        << std::setw(12) << U("msgs/s") << std::setw(14) << U("bytes/s")
+        << std::setw(10) << U("p50 us") << std::setw(10) << U("p90 us") << std::setw(10) << U("p99 us") << std::setw(11) << U("p99.9 us") << std::endl;
+
+    for (int i = 0; i < operation_count; i++)
+    {
+        if (!options.enabled[i])
+        {
+            continue;
+        }
+
+        const operation_stats& stats = totals[i];
+        ucout << std::left << std::setw(14) << utility::conversions::to_string_t(std::string(operation_names[i])) << std::right
+            << std::setw(10) << stats.operations << std::setw(10) << stats.errors
+            << std::setw(12) << std::setprecision(1) << stats.messages / elapsed
+            << std::setw(14) << std::setprecision(0) << stats.bytes / elapsed
+            << std::setw(10) << stats.latency.percentile(0.5).count()
+            << std::setw(10) << stats.latency.percentile(0.9).count()
+            << std::setw(10) << stats.latency.percentile(0.99).count()
+            << std::setw(11) << stats.latency.percentile(0.999).count() << std::endl;
+    }
+}
+
+static void print_json(const benchmark_options& options, const std::vector<operation_stats>& totals, double elapsed)
+{
+    ucout << U("{\"concurrency\":") << options.concurrency
+        << U(",\"message_size\":") << options.message_size
+        << U(",\"elapsed_seconds\":") << std::fixed << std::setprecision(3) << elapsed
+        << U(",\"operations\":[");
+
+    bool first = true;
+    for (int i = 0; i < operation_count; i++)
+    {
+        if (!options.enabled[i])
+        {
+            continue;
+        }
+
+        const operation_stats& stats = totals[i];
+        ucout << (first ? U("") : U(",")) << U("{\"name\":\"") << utility::conversions::to_string_t(std::string(operation_names[i])) << U("\"")
+            << U(",\"count\":") << stats.operations
+            << U(",\"errors\":") << stats.errors
+            << U(",\"messages_per_second\":") << stats.messages / elapsed
+            << U(",\"bytes_per_second\":") << stats.bytes / elapsed
+            << U(",\"latency_us\":{\"p50\":") << stats.latency.percentile(0.5).count()
+            << U(",\"p90\":") << stats.latency.percentile(0.9).count()
+            << U(",\"p99\":") << stats.latency.percentile(0.99).count()
+            << U(",\"p999\":") << stats.latency.percentile(0.999).count()
+            << U(",\"mean\":") << stats.latency.mean().count()
+            << U(",\"max\":") << stats.latency.maximum().count() << U("}}");
+        first = false;
+    }
+
+    ucout << U("]}") << std::endl;
+}
+
+// Calls the operation repeatedly for the given time and returns calls per second.
+template<typename Operation>
+static double calls_per_second(std::chrono::duration<double> duration, Operation operation)
+{
+    uint64_t calls = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+    std::chrono::steady_clock::time_point now = start;
+    while (now < deadline)
+    {
+        // Check the clock every few calls so reading it doesn't dominate small messages.
+        for (int i = 0; i < 16; i++)
+        {
+            operation();
+        }
+
+        calls += 16;
+        now = std::chrono::steady_clock::now();
+    }
+
+    return calls / std::chrono::duration<double>(now - start).count();
+}
+
+///
+/// Compares the client library's path for binary content, set_content(std::vector<uint8_t>)
+/// and content_as_binary, with the same round trip through base64_codec. Then times the bare
+/// encoder and decoder for each base64 implementation this CPU supports. The duration is
+/// split evenly between the paths.
+///
+static void run_base64_benchmark(const benchmark_options& options)
+{
+    std::vector<uint8_t> payload(options.message_size);
+    for (size_t i = 0; i < payload.size(); i++)
+    {
+        payload[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+
+    const base64_implementation implementations[] = { base64_implementation::scalar, base64_implementation::sse41, base64_implementation::avx2 };
+    const char* implementation_names[] = { "scalar", "sse41", "avx2" };
+
+    std::vector<std::string> names;
+    std::vector<double> encodes;
+    std::vector<double> decodes;
+    size_t paths = 2;
+    for (size_t i = 0; i < 3; i++)
+    {
+        paths += base64_codec::is_supported(implementations[i]) ? 1 : 0;
+    }
+    std::chrono::duration<double> duration = std::chrono::duration<double>(options.duration) / static_cast<double>(paths * 2);
+
+    {
+        cloud_queue_message message;
+        std::vector<uint8_t> decoded;
+        names.push_back("client_library");
+        encodes.push_back(calls_per_second(duration, [&] { message.set_content(payload); }));
+        decodes.push_back(calls_per_second(duration, [&] { decoded = message.content_as_binary(); }));
+    }
+
+    {
+        cloud_queue_message message;
+        utility::string_t text;
+        std::vector<uint8_t> decoded;
+        names.push_back("base64_codec");
+        encodes.push_back(calls_per_second(duration, [&] { base64_codec::set_content(message, payload.data(), payload.size(), text); }));
+        decodes.push_back(calls_per_second(duration, [&] { base64_codec::content(message, decoded); }));
+    }
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (!base64_codec::is_supported(implementations[i]))
+        {
+            continue;
+        }
+
+        base64_implementation implementation = implementations[i];
+        std::string encoded(base64_codec::encoded_size(payload.size()), '\0');
+        std::vector<uint8_t> decoded(payload.size());
+        names.push_back(implementation_names[i]);
+        encodes.push_back(calls_per_second(duration, [&] { base64_codec::encode(implementation, payload.data(), payload.size(), &encoded[0]); }));
+        decodes.push_back(calls_per_second(duration, [&] { base64_codec::decode(implementation, encoded.data(), encoded.size(), decoded.data()); }));
+    }
+
+    double megabytes = static_cast<double>(payload.size()) / (1024 * 1024);
+    if (options.json)
+    {
+        ucout << U("{\"message_size\":") << options.message_size << U(",\"base64\":[");
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            ucout << (i == 0 ? U("") : U(",")) << U("{\"name\":\"") << utility::conversions::to_string_t(names[i]) << U("\"")
+                << U(",\"encodes_per_second\":") << std::fixed << std::setprecision(0) << encodes[i]
+                << U(",\"decodes_per_second\":") << decodes[i] << U("}");
+        }
+        ucout << U("]}") << std::endl;
+        return;
+    }
+
+    ucout << U("message size ") << options.message_size << U(" bytes") << std::endl << std::endl;
+    ucout << std::left << std::setw(16) << U("path") << std::right
+        << std::setw(14) << U("encodes/s") << std::setw(12) << U("MB/s")
+        << std::setw(14) << U("decodes/s") << std::setw(12) << U("MB/s") << std::endl;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        ucout << std::left << std::setw(16) << utility::conversions::to_string_t(names[i]) << std::right << std::fixed
+            << std::setw(14) << std::setprecision(0) << encodes[i] << std::setw(12) << std::setprecision(1) << encodes[i] * megabytes
+            << std::setw(14) << std::setprecision(0) << decodes[i] << std::setw(12) << std::setprecision(1) << decodes[i] * megabytes << std::endl;
+    }
+}
+
+#ifdef AZURESTORAGESAMPLES_HAVE_COROUTINES
+
+// Threads in this process, or 0 where /proc is not available.
+static size_t current_thread_count()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 8, "Threads:") == 0)
+        {
+            return static_cast<size_t>(std::strtoul(line.c_str() + 8, nullptr, 10));
+        }
+    }
+
+    return 0;
+}
+
+// Voluntary and involuntary context switches of this process so far, or 0 if unknown.
+static uint64_t context_switches()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(usage.ru_nvcsw) + static_cast<uint64_t>(usage.ru_nivcsw);
+#endif
+}
+
+// Results for one way of driving the queue.
+struct style_result
+{
+    style_result()
+        : operations(0), errors(0), peak_threads(0), context_switches(0), elapsed(0)
+    {
+    }
+
+    std::string name;
+    uint64_t operations;
+    uint64_t errors;
+    size_t peak_threads;
+    uint64_t context_switches;
+    double elapsed;
+};
+
+// Samples the thread count while a style runs. The peak includes the sampling thread.
+class thread_count_monitor
+{
+public:
+    thread_count_monitor()
+        : m_stopping(false), m_peak(current_thread_count())
+    {
+        m_thread = std::thread([this]
+        {
+            while (!m_stopping)
+            {
+                m_peak = std::max<size_t>(m_peak, current_thread_count());
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        });
+    }
+
+    size_t stop()
+    {
+        m_stopping = true;
+        m_thread.join();
+        return m_peak;
+    }
+
+private:
+    std::atomic<bool> m_stopping;
+    std::atomic<size_t> m_peak;
+    std::thread m_thread;
+};
+
+///
+/// One unit of work for the coroutine style: add a message, receive one and delete what came
+/// back, the same cycle the blocking style runs on a thread of its own. The references outlive
+/// the task because run_coroutine_benchmark waits for every task before returning.
+///
+static queue_task<void> coroutine_worker(coroutine_queue& queue, const utility::string_t& content, std::chrono::steady_clock::time_point deadline,
+    std::atomic<uint64_t>& operations, std::atomic<uint64_t>& errors)
+{
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        try
+        {
+            co_await queue.add_message(cloud_queue_message(content));
+            operations++;
+
+            std::vector<cloud_queue_message> batch = co_await queue.get_messages(1, std::chrono::seconds(30));
+            operations++;
+
+            for (auto it = batch.begin(); it != batch.end(); ++it)
+            {
+                co_await queue.delete_message(*it);
+                operations++;
+            }
+        }
+        catch (const std::exception&)
+        {
+            errors++;
+        }
+    }
+}
+
+///
+/// Runs --concurrency units of add, receive and delete twice, half the duration each: first
+/// with a blocking thread per unit, then as coroutines on a coroutine_executor with one thread
+/// per core. Reports throughput next to the peak thread count and the context switches each
+/// style cost. The client library's own I/O threads are running in both.
+///
+static void run_coroutine_benchmark(cloud_queue queue, const benchmark_options& options)
+{
+    utility::string_t content;
+    while (content.size() < options.message_size)
+    {
+        content.append(string_util::random_string());
+    }
+    content.resize(options.message_size);
+
+    std::chrono::steady_clock::duration duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options.duration) / 2;
+    std::vector<style_result> results(2);
+
+    {
+        style_result& result = results[0];
+        result.name = "blocking";
+        std::atomic<uint64_t> operations(0);
+        std::atomic<uint64_t> errors(0);
+
+        uint64_t switches = context_switches();
+        thread_count_monitor monitor;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = start + duration;
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < options.concurrency; i++)
+        {
+            workers.push_back(std::thread([&, queue]() mutable
+            {
+                queue_request_options request_options;
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    try
+                    {
+                        cloud_queue_message message(content);
+                        queue.add_message(message);
+                        operations++;
+
+                        std::vector<cloud_queue_message> batch = queue.get_messages(1, std::chrono::seconds(30), request_options, operation_context());
+                        operations++;
+
+                        for (auto it = batch.begin(); it != batch.end(); ++it)
+                        {
+                            queue.delete_message(*it);
+                            operations++;
+                        }
+                    }
+                    catch (const std::exception&)
+                    {
+                        errors++;
+                    }
+                }
+            }));
+        }
+
+        for (auto it = workers.begin(); it != workers.end(); ++it)
+        {
+            it->join();
+        }
+
+        result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.peak_threads = monitor.stop();
+        result.context_switches = context_switches() - switches;
+        result.operations = operations;
+        result.errors = errors;
+    }
+
+    {
+        style_result& result = results[1];
+        result.name = "coroutines";
+        std::atomic<uint64_t> operations(0);
+        std::atomic<uint64_t> errors(0);
+
+        uint64_t switches = context_switches();
+        thread_count_monitor monitor;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = start + duration;
+
+        coroutine_executor executor;
+        coroutine_queue coroutines(queue, executor);
+        std::vector<queue_task<void>> tasks;
+        for (size_t i = 0; i < options.concurrency; i++)
+        {
+            tasks.push_back(coroutine_worker(coroutines, content, deadline, operations, errors));
+            tasks.back().start(executor);
+        }
+
+        for (auto it = tasks.begin(); it != tasks.end(); ++it)
+        {
+            it->get();
+        }
+
+        result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.peak_threads = monitor.stop();
+        result.context_switches = context_switches() - switches;
+        result.operations = operations;
+        result.errors = errors;
+    }
+
+    if (options.json)
+    {
+        ucout << U("{\"concurrency\":") << options.concurrency << U(",\"message_size\":") << options.message_size << U(",\"styles\":[");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const style_result& result = results[i];
+            ucout << (i == 0 ? U("") : U(",")) << U("{\"name\":\"") << utility::conversions::to_string_t(result.name) << U("\"")
+                << U(",\"count\":") << result.operations
+                << U(",\"errors\":") << result.errors
+                << U(",\"operations_per_second\":") << std::fixed << std::setprecision(1) << result.operations / result.elapsed
+                << U(",\"peak_threads\":") << result.peak_threads
+                << U(",\"context_switches\":") << result.context_switches << U("}");
+        }
+        ucout << U("]}") << std::endl;
+        return;
+    }
+
+    ucout << U("concurrency ") << options.concurrency << U(", message size ") << options.message_size << U(" bytes") << std::endl << std::endl;
+    ucout << std::left << std::setw(14) << U("style") << std::right
+        << std::setw(10) << U("ops") << std::setw(10) << U("errors") << std::setw(12) << U("ops/s")
+        << std::setw(10) << U("threads") << std::setw(14) << U("ctx switches") << std::endl;
+    for (auto it = results.begin(); it != results.end(); ++it)
+    {
+        ucout << std::left << std::setw(14) << utility::conversions::to_string_t(it->name) << std::right
+            << std::setw(10) << it->operations << std::setw(10) << it->errors
+            << std::setw(12) << std::fixed << std::setprecision(1) << it->operations / it->elapsed
+            << std::setw(10) << it->peak_threads << std::setw(14) << it->context_switches << std::endl;
+    }
+}
+
+#endif
+
+///
+/// Measures throughput and latency of the queue operations used by the samples, either
+/// against a storage account or against the in-process local_queue_service.
+///
+int main(int argc, char* argv[])
+{
+    benchmark_options options;
+    if (!parse_options(argc, argv, options))
+    {
+        print_usage();
+        return 1;
+    }
+
+    try
+    {
+        if (options.base64)
+        {
+            run_base64_benchmark(options);
+            return 0;
+        }
+
+#ifndef AZURESTORAGESAMPLES_HAVE_COROUTINES
+        if (options.coroutines)
+        {
+            ucout << U("--coroutines needs a C++20 build; configure with -DAZURESTORAGESAMPLES_COROUTINES=ON") << std::endl;
+            return 1;
+        }
+#endif
+
+        std::unique_ptr<local_queue_service> local_service;
+        if (options.local)
+        {
+            local_queue_service_options service_options;
+            service_options.latency = options.local_latency;
+            service_options.throttle_rate = options.local_throttle_rate;
+            service_options.error_rate = options.local_error_rate;
+
+            local_service.reset(new local_queue_service(service_options));
+            local_service->start();
+            options.connection_string = local_service->connection_string();
+        }
+
+        cloud_storage_account storage_account = cloud_storage_account::parse(options.connection_string);
+        cloud_queue_client queue_client = storage_account.create_cloud_queue_client();
+
+        std::shared_ptr<throttling_controller> controller;
+        if (options.throttling)
+        {
+            controller = std::make_shared<throttling_controller>();
+            controller->apply(queue_client);
+        }
+
+        // A fresh queue per run keeps results independent of earlier runs.
+        cloud_queue queue = queue_client.get_queue_reference(U("bench-queue-") + string_util::random_string());
+        queue.create_if_not_exists();
+
+#ifdef AZURESTORAGESAMPLES_HAVE_COROUTINES
+        if (options.coroutines)
+        {
+            run_coroutine_benchmark(queue, options);
+            queue.delete_queue_if_exists();
+            return 0;
+        }
+#endif
+
+        utility::string_t content;
+        while (content.size() < options.message_size)
+        {
+            content.append(string_util::random_string());
+        }
+        content.resize(options.message_size);
+
+        for (size_t i = 0; i < options.prefill; i++)
+        {
+            cloud_queue_message message(content);
+            queue.add_message(message);
+        }
+
+        std::vector<std::vector<operation_stats>> worker_stats(options.concurrency, std::vector<operation_stats>(operation_count));
+        std::vector<std::thread> workers;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = start + options.duration;
+        for (size_t i = 0; i < options.concurrency; i++)
+        {
+            workers.push_back(std::thread(run_worker, queue, std::cref(options), std::cref(content), deadline, controller.get(), std::ref(worker_stats[i])));
+        }
+
+        for (auto it = workers.begin(); it != workers.end(); ++it)
+        {
+            it->join();
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<operation_stats> totals(operation_count);
+        for (auto it = worker_stats.begin(); it != worker_stats.end(); ++it)
+        {
+            for (int i = 0; i < operation_count; i++)
+            {
+                totals[i].merge((*it)[i]);
+            }
+        }
+
+        queue.delete_queue_if_exists();
+
+        if (options.json)
+        {
+            print_json(options, totals, elapsed);
+        }
+        else
+        {
+            print_text(options, totals, elapsed);
+        }
+    }
+    catch (const azure::storage::storage_exception& e)
+    {
+        ucout << U("Error: ") << e.what() << " .Extended error:" << e.result().extended_error().message() << std::endl;
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
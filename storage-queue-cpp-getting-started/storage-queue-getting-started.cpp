@@ -17,12 +17,13 @@
 #include "stdafx.h"
 #include "queue_basic.h"
 #include "queue_advanced.h"
+#include "local_queue_service.h"
 
 using namespace azure::storage;
 
 void run_storage_queue_samples(utility::string_t storage_connection_string);
 
-int main()
+int main(int argc, char* argv[])
 {
     // *************************************************************************************************************************
     // Instructions: This sample can be run using either the Azure Storage Emulator that installs as part of the Windows Azure SDK (in Windows only) - or by
@@ -39,19 +40,45 @@ int main()
     //      2. Create a Storage Account through the Azure Portal and provide your [AccountName] and [AccountKey] in 
     //         this file. See http://go.microsoft.com/fwlink/?LinkId=325277 for more information
     //      3. Set breakpoints and run the project using F10. 
+    //
+    // To run the sample without the emulator or network access (for example on Linux)
+    //      1. Run the sample with the --local argument. It starts an in-process stand-in for the Queue service
+    //         (see local_queue_service.h) and points the samples at it.
+    //
+    // A connection string can also be passed as the first argument instead of editing this file.
     // 
     // *************************************************************************************************************************
 
-    const utility::string_t storage_connection_string(U("UseDevelopmentStorage=true"));
+    utility::string_t storage_connection_string(U("UseDevelopmentStorage=true"));
 
     try
     {
+        std::unique_ptr<local_queue_service> local_service;
+        if (argc > 1)
+        {
+            std::string argument(argv[1]);
+            if (argument == "--local")
+            {
+                local_service.reset(new local_queue_service());
+                local_service->start();
+                storage_connection_string = local_service->connection_string();
+            }
+            else
+            {
+                storage_connection_string = utility::conversions::to_string_t(argument);
+            }
+        }
+
         run_storage_queue_samples(storage_connection_string);
     }
     catch (const azure::storage::storage_exception& e)
     {
         ucout << U("Error:") << e.what() << std::endl << U("Unexpected exception while running the sample.") << std::endl;
     }
+    catch (const std::exception& e)
+    {
+        ucout << U("Error:") << e.what() << std::endl << U("Unexpected exception while running the sample.") << std::endl;
+    }
 
     return 0;
 }
@@ -85,5 +112,60 @@ void run_storage_queue_samples(utility::string_t storage_connection_string)
 
     ucout << U("*** Set Queue ACL ***") << std::endl;
     queue_advanced::set_queue_acl(queue_client);
+
+    ucout << U("*** Consume Messages ***") << std::endl;
+    queue_advanced::consume_messages(queue_client);
+
+    ucout << U("*** Pack Messages ***") << std::endl;
+    queue_advanced::pack_messages(queue_client);
+
+    ucout << U("*** Compress Messages ***") << std::endl;
+    queue_advanced::compress_messages(queue_client);
+
+    ucout << U("*** Shard Messages ***") << std::endl;
+    queue_advanced::shard_messages(queue_client);
+
+    ucout << U("*** Poll Queues ***") << std::endl;
+    queue_advanced::poll_queues(queue_client);
+
+    ucout << U("*** Throttle Requests ***") << std::endl;
+    queue_advanced::throttle_requests(queue_client);
+
+    ucout << U("*** Spool Messages ***") << std::endl;
+    queue_advanced::spool_messages(queue_client);
+
+    ucout << U("*** Renew Leases ***") << std::endl;
+    queue_advanced::renew_leases(queue_client);
+
+    ucout << U("*** Receive Batches ***") << std::endl;
+    queue_advanced::receive_batches(queue_client);
+
+    ucout << U("*** Route Poison Messages ***") << std::endl;
+    queue_advanced::route_poison_messages(queue_client);
+
+    ucout << U("*** Prioritize Messages ***") << std::endl;
+    queue_advanced::prioritize_messages(queue_client);
+
+    ucout << U("*** Monitor Backlog ***") << std::endl;
+    queue_advanced::monitor_backlog(queue_client);
+
+    ucout << U("*** Cache SAS Tokens ***") << std::endl;
+    queue_advanced::cache_sas_tokens(queue_client);
+
+    ucout << U("*** Stripe Accounts ***") << std::endl;
+    queue_advanced::stripe_accounts(queue_client);
+
+    ucout << U("*** Order Sessions ***") << std::endl;
+    queue_advanced::order_sessions(queue_client);
+
+    ucout << U("*** Schedule Messages ***") << std::endl;
+    queue_advanced::schedule_messages(queue_client);
+
+    // The claim-check sample also needs the Blob service, which the local stand-in doesn't provide.
+    if (!storage_account.blob_endpoint().primary_uri().is_empty())
+    {
+        ucout << U("*** Claim Check Messages ***") << std::endl;
+        queue_advanced::claim_check_messages(storage_account);
+    }
 }
 
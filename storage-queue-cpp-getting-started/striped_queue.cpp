@@ -0,0 +1,245 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "striped_queue.h"
+#include "queue_group.h"
+#include "queue_producer.h"
+#include "throttling_retry_policy.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+striped_queue_options::striped_queue_options()
+    : decrease_factor(0.5), decrease_cooldown(1000), recovery_rate(0.1), min_weight(0.05)
+{
+}
+
+striped_queue::state::state(std::vector<cloud_queue> stripes, const striped_queue_options& options)
+    : stripes(std::move(stripes)), options(options), weights(this->stripes.size(), 1.0), current(this->stripes.size(), 0.0),
+    last_decrease(this->stripes.size()), last_recovery(std::chrono::steady_clock::now()), added(this->stripes.size()), throttled(this->stripes.size())
+{
+    this->options.min_weight = std::min(std::max(this->options.min_weight, 0.001), 1.0);
+}
+
+///
+/// Smooth weighted round-robin: every stripe gains its weight, the one with the most credit is
+/// picked and pays back the total. Over time each stripe is picked in proportion to its weight,
+/// with the picks spread out rather than in runs.
+///
+size_t striped_queue::state::next_stripe(size_t excluded)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    recover_locked(std::chrono::steady_clock::now());
+
+    double total = 0;
+    size_t chosen = stripes.size();
+    for (size_t i = 0; i < stripes.size(); i++)
+    {
+        if (i == excluded)
+        {
+            continue;
+        }
+
+        current[i] += weights[i];
+        total += weights[i];
+        if (chosen == stripes.size() || current[i] > current[chosen])
+        {
+            chosen = i;
+        }
+    }
+
+    current[chosen] -= total;
+    return chosen;
+}
+
+void striped_queue::state::record_throttled(size_t index)
+{
+    throttled[index]++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    recover_locked(now);
+
+    if (now - last_decrease[index] >= options.decrease_cooldown)
+    {
+        weights[index] = std::max(weights[index] * options.decrease_factor, options.min_weight);
+        last_decrease[index] = now;
+    }
+}
+
+void striped_queue::state::recover_locked(std::chrono::steady_clock::time_point now)
+{
+    double seconds = std::chrono::duration<double>(now - last_recovery).count();
+    last_recovery = now;
+
+    for (auto it = weights.begin(); it != weights.end(); ++it)
+    {
+        *it = std::min(*it + seconds * options.recovery_rate, 1.0);
+    }
+}
+
+striped_queue::striped_queue(const std::vector<utility::string_t>& connection_strings, const utility::string_t& queue_name, const striped_queue_options& options)
+    : striped_queue(stripes_for(connection_strings, queue_name), options)
+{
+}
+
+striped_queue::striped_queue(std::vector<cloud_queue> stripes, const striped_queue_options& options)
+{
+    if (stripes.empty())
+    {
+        throw std::invalid_argument("A striped queue needs at least one stripe");
+    }
+
+    m_state = std::make_shared<state>(std::move(stripes), options);
+}
+
+std::vector<cloud_queue> striped_queue::stripes_for(const std::vector<utility::string_t>& connection_strings, const utility::string_t& queue_name)
+{
+    std::vector<cloud_queue> stripes;
+    for (auto it = connection_strings.begin(); it != connection_strings.end(); ++it)
+    {
+        cloud_storage_account storage_account = cloud_storage_account::parse(*it);
+        stripes.push_back(storage_account.create_cloud_queue_client().get_queue_reference(queue_name));
+    }
+
+    return stripes;
+}
+
+size_t striped_queue::stripe_count() const
+{
+    return m_state->stripes.size();
+}
+
+cloud_queue& striped_queue::stripe(size_t index)
+{
+    return m_state->stripes.at(index);
+}
+
+double striped_queue::weight(size_t index)
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->recover_locked(std::chrono::steady_clock::now());
+    return m_state->weights.at(index);
+}
+
+void striped_queue::create_if_not_exists()
+{
+    std::vector<pplx::task<bool>> creates;
+    for (auto it = m_state->stripes.begin(); it != m_state->stripes.end(); ++it)
+    {
+        creates.push_back(it->create_if_not_exists_async(m_state->options.request_options, operation_context()));
+    }
+
+    pplx::when_all(creates.begin(), creates.end()).wait();
+}
+
+void striped_queue::delete_if_exists()
+{
+    std::vector<pplx::task<bool>> deletes;
+    for (auto it = m_state->stripes.begin(); it != m_state->stripes.end(); ++it)
+    {
+        deletes.push_back(it->delete_queue_if_exists_async(m_state->options.request_options, operation_context()));
+    }
+
+    pplx::when_all(deletes.begin(), deletes.end()).wait();
+}
+
+size_t striped_queue::next_stripe()
+{
+    return m_state->next_stripe(m_state->stripes.size());
+}
+
+void striped_queue::add_message(cloud_queue_message& message)
+{
+    add_message_async(message).get();
+}
+
+pplx::task<void> striped_queue::add_message_async(cloud_queue_message& message)
+{
+    return add_to_stripe(m_state, message, next_stripe(), m_state->stripes.size() > 1);
+}
+
+///
+/// Adds the message to one stripe. Every throttling response, including those the client
+/// retries on its own, is reported to the routing weights as soon as it arrives.
+///
+pplx::task<void> striped_queue::add_to_stripe(const std::shared_ptr<state>& shared, cloud_queue_message& message, size_t index, bool fail_over)
+{
+    operation_context context;
+    context.set_response_received([shared, index](web::http::http_request&, const web::http::http_response& response, operation_context)
+    {
+        if (throttling_controller::is_throttling(response))
+        {
+            shared->record_throttled(index);
+        }
+    });
+
+    pplx::task<void> operation;
+    try
+    {
+        operation = shared->stripes[index].add_message_async(message, queue_producer::default_time_to_live, std::chrono::seconds(0), shared->options.request_options, context);
+    }
+    catch (...)
+    {
+        operation = pplx::task_from_exception<void>(std::current_exception());
+    }
+
+    cloud_queue_message* target = &message;
+    return operation.then([shared, index, target, fail_over](pplx::task<void> previous) -> pplx::task<void>
+    {
+        try
+        {
+            previous.get();
+            shared->added[index]++;
+            return pplx::task_from_result();
+        }
+        catch (const storage_exception& e)
+        {
+            if (!fail_over || !throttling_controller::is_throttling(e.result()))
+            {
+                throw;
+            }
+        }
+
+        return add_to_stripe(shared, *target, shared->next_stripe(index), false);
+    });
+}
+
+int striped_queue::approximate_message_count()
+{
+    std::vector<int> counts = queue_group::approximate_message_counts(m_state->stripes, m_state->options.request_options);
+    return std::accumulate(counts.begin(), counts.end(), 0);
+}
+
+sharded_queue striped_queue::shards() const
+{
+    return sharded_queue(m_state->stripes);
+}
+
+uint64_t striped_queue::added_count(size_t index) const
+{
+    return m_state->added.at(index);
+}
+
+uint64_t striped_queue::throttled_count(size_t index) const
+{
+    return m_state->throttled.at(index);
+}
@@ -0,0 +1,128 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "sharded_queue.h"
+
+using namespace azure::storage;
+
+///
+/// Settings for striped_queue.
+///
+struct striped_queue_options
+{
+    striped_queue_options();
+
+    // A throttling response multiplies the stripe's weight by this; further throttling within
+    // decrease_cooldown counts as the same overload and doesn't lower it again.
+    double decrease_factor;
+    std::chrono::milliseconds decrease_cooldown;
+
+    // Weight a stripe recovers each second, up to the full weight of 1.
+    double recovery_rate;
+
+    // Lowest weight a stripe is cut to, so a throttled account still gets some adds and its
+    // weight can recover.
+    double min_weight;
+
+    queue_request_options request_options;
+};
+
+///
+/// One logical queue striped over queues in several storage accounts, so ingest is not capped
+/// by the request rate of a single account. Adds are spread over the stripes by smooth
+/// weighted round-robin. Every throttling response (503 Server Busy, 500 Operation Timed Out)
+/// from an account cuts its stripe's weight, and weights recover steadily while the account
+/// keeps up, so load moves to the accounts with headroom. An add that still fails with
+/// throttling after the client's retries is tried once more on another stripe.
+///
+/// To consume, pass shards() to a sharded_queue_consumer. With a worker count that is a
+/// multiple of the stripe count, every stripe has the same number of workers, and idle
+/// workers help drain the busiest stripe.
+///
+/// Copies share the weights and counters.
+///
+class striped_queue
+{
+public:
+    // One stripe per connection string, each the queue named queue_name in that account.
+    striped_queue(const std::vector<utility::string_t>& connection_strings, const utility::string_t& queue_name,
+        const striped_queue_options& options = striped_queue_options());
+
+    explicit striped_queue(std::vector<cloud_queue> stripes, const striped_queue_options& options = striped_queue_options());
+
+    size_t stripe_count() const;
+    cloud_queue& stripe(size_t index);
+
+    // Current routing weight of the stripe, between min_weight and 1.
+    double weight(size_t index);
+
+    // Creates or deletes the queue in every account concurrently.
+    void create_if_not_exists();
+    void delete_if_exists();
+
+    // Next stripe in weighted round-robin order.
+    size_t next_stripe();
+
+    void add_message(cloud_queue_message& message);
+    // The message is updated when the add completes, so it must outlive the task.
+    pplx::task<void> add_message_async(cloud_queue_message& message);
+
+    // Sum of the approximate message counts of all stripes; fetches the attributes of each.
+    int approximate_message_count();
+
+    // The stripes as a sharded_queue, for sharded_queue_consumer.
+    sharded_queue shards() const;
+
+    uint64_t added_count(size_t index) const;
+    uint64_t throttled_count(size_t index) const;
+
+private:
+    // Shared by copies and by the continuations of adds in flight.
+    struct state
+    {
+        state(std::vector<cloud_queue> stripes, const striped_queue_options& options);
+
+        size_t next_stripe(size_t excluded);
+        void record_throttled(size_t index);
+        void recover_locked(std::chrono::steady_clock::time_point now);
+
+        std::vector<cloud_queue> stripes;
+        striped_queue_options options;
+
+        std::mutex mutex;
+        std::vector<double> weights;
+        std::vector<double> current;
+        std::vector<std::chrono::steady_clock::time_point> last_decrease;
+        std::chrono::steady_clock::time_point last_recovery;
+
+        std::vector<std::atomic<uint64_t>> added;
+        std::vector<std::atomic<uint64_t>> throttled;
+    };
+
+    static std::vector<cloud_queue> stripes_for(const std::vector<utility::string_t>& connection_strings, const utility::string_t& queue_name);
+    static pplx::task<void> add_to_stripe(const std::shared_ptr<state>& shared, cloud_queue_message& message, size_t index, bool fail_over);
+
+    std::shared_ptr<state> m_state;
+};
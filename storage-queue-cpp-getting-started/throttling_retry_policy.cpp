@@ -0,0 +1,306 @@
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "throttling_retry_policy.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace azure::storage;
+
+circuit_open_exception::circuit_open_exception()
+    : std::runtime_error("Circuit breaker is open; the service is failing and requests are not being sent")
+{
+}
+
+throttling_options::throttling_options()
+    : initial_rate(500), min_rate(10), max_rate(2000), burst(50), decrease_factor(0.5), decrease_cooldown(1000),
+    additive_increase(20), base_backoff(200), max_backoff(30000), max_attempts(6),
+    failure_threshold(50), failure_window(10000), open_duration(30000)
+{
+}
+
+throttling_controller::throttling_controller(const throttling_options& options)
+    : m_options(options), m_rate(options.initial_rate), m_tokens(options.burst), m_last_refill(std::chrono::steady_clock::now()),
+    m_state(circuit_state::closed), m_window_failures(0), m_window_start(m_last_refill), m_state_changed(m_last_refill),
+    m_probe_sent(false), m_random(std::random_device()()), m_throttled(0), m_rejected(0)
+{
+}
+
+void throttling_controller::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        update_circuit_locked(now);
+
+        if (m_state == circuit_state::open || (m_state == circuit_state::half_open && m_probe_sent))
+        {
+            m_rejected++;
+            throw circuit_open_exception();
+        }
+
+        if (m_state == circuit_state::half_open)
+        {
+            m_probe_sent = true;
+            m_state_changed = now;
+        }
+    }
+
+    std::chrono::milliseconds wait = reserve();
+    if (wait.count() > 0)
+    {
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+std::chrono::milliseconds throttling_controller::reserve()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    refill_locked(std::chrono::steady_clock::now());
+
+    // Going into debt keeps later callers queued behind earlier ones.
+    m_tokens -= 1.0;
+    if (m_tokens >= 0.0)
+    {
+        return std::chrono::milliseconds(0);
+    }
+
+    return std::chrono::milliseconds(static_cast<long long>(-m_tokens / m_rate * 1000.0) + 1);
+}
+
+void throttling_controller::record_failure(bool throttled)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    refill_locked(now);
+
+    if (throttled)
+    {
+        m_throttled++;
+        if (now - m_last_decrease >= m_options.decrease_cooldown)
+        {
+            m_rate = std::max(m_options.min_rate, m_rate * m_options.decrease_factor);
+            m_tokens = std::min(m_tokens, 0.0);
+            m_last_decrease = now;
+        }
+    }
+
+    if (m_state == circuit_state::half_open)
+    {
+        // The probe failed.
+        m_state = circuit_state::open;
+        m_state_changed = now;
+        return;
+    }
+
+    if (now - m_window_start > m_options.failure_window)
+    {
+        m_window_start = now;
+        m_window_failures = 0;
+    }
+
+    if (++m_window_failures >= m_options.failure_threshold && m_state == circuit_state::closed)
+    {
+        m_state = circuit_state::open;
+        m_state_changed = now;
+    }
+}
+
+void throttling_controller::record_success()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_state == circuit_state::half_open && m_probe_sent)
+    {
+        close_circuit_locked(std::chrono::steady_clock::now());
+    }
+}
+
+bool throttling_controller::allow_retry()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    update_circuit_locked(std::chrono::steady_clock::now());
+    return m_state == circuit_state::closed;
+}
+
+std::chrono::milliseconds throttling_controller::backoff(int retry_count)
+{
+    long long ceiling = m_options.base_backoff.count() << std::min(retry_count, 20);
+    ceiling = std::min(ceiling, static_cast<long long>(m_options.max_backoff.count()));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::chrono::milliseconds(std::uniform_int_distribution<long long>(0, std::max(ceiling, 0LL))(m_random));
+}
+
+void throttling_controller::apply(cloud_queue_client& queue_client)
+{
+    queue_request_options options = queue_client.default_request_options();
+    options.set_retry_policy(throttling_retry_policy(shared_from_this()));
+    queue_client.set_default_request_options(options);
+}
+
+void throttling_controller::instrument(operation_context& context)
+{
+    std::shared_ptr<throttling_controller> self = shared_from_this();
+    context.set_response_received([self](web::http::http_request&, const web::http::http_response& response, operation_context)
+    {
+        // Failures are reported by the retry policy, which sees them with their retry count.
+        web::http::status_code status = response.status_code();
+        if (status != web::http::status_codes::RequestTimeout && status < 500)
+        {
+            self->record_success();
+        }
+    });
+}
+
+bool throttling_controller::is_throttling(web::http::status_code status, const utility::string_t& error_code)
+{
+    return status == web::http::status_codes::ServiceUnavailable ||
+        (status == web::http::status_codes::InternalError && error_code == U("OperationTimedOut"));
+}
+
+bool throttling_controller::is_throttling(const request_result& result)
+{
+    return result.is_response_available() && is_throttling(result.http_status_code(), result.extended_error().code());
+}
+
+bool throttling_controller::is_throttling(const web::http::http_response& response)
+{
+    const web::http::http_headers& headers = response.headers();
+    web::http::http_headers::const_iterator code = headers.find(U("x-ms-error-code"));
+    return is_throttling(response.status_code(), code == headers.end() ? utility::string_t() : code->second);
+}
+
+const throttling_options& throttling_controller::options() const
+{
+    return m_options;
+}
+
+double throttling_controller::current_rate()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    refill_locked(std::chrono::steady_clock::now());
+    return m_rate;
+}
+
+throttling_controller::circuit_state throttling_controller::state()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    update_circuit_locked(std::chrono::steady_clock::now());
+    return m_state;
+}
+
+uint64_t throttling_controller::throttled_count() const
+{
+    return m_throttled;
+}
+
+uint64_t throttling_controller::rejected_count() const
+{
+    return m_rejected;
+}
+
+///
+/// Adds the tokens earned since the last refill and grows the rate back towards max_rate.
+///
+void throttling_controller::refill_locked(std::chrono::steady_clock::time_point now)
+{
+    double elapsed = std::chrono::duration<double>(now - m_last_refill).count();
+    if (elapsed <= 0.0)
+    {
+        return;
+    }
+
+    m_last_refill = now;
+    m_tokens = std::min(m_options.burst, m_tokens + elapsed * m_rate);
+    m_rate = std::min(m_options.max_rate, m_rate + elapsed * m_options.additive_increase);
+}
+
+void throttling_controller::update_circuit_locked(std::chrono::steady_clock::time_point now)
+{
+    if (m_state == circuit_state::open && now - m_state_changed >= m_options.open_duration)
+    {
+        m_state = circuit_state::half_open;
+        m_state_changed = now;
+        m_probe_sent = false;
+    }
+    else if (m_state == circuit_state::half_open && m_probe_sent && now - m_state_changed >= m_options.open_duration)
+    {
+        // No failure was reported for the probe, so the service is back.
+        close_circuit_locked(now);
+    }
+}
+
+void throttling_controller::close_circuit_locked(std::chrono::steady_clock::time_point now)
+{
+    m_state = circuit_state::closed;
+    m_state_changed = now;
+    m_window_start = now;
+    m_window_failures = 0;
+}
+
+basic_throttling_retry_policy::basic_throttling_retry_policy(std::shared_ptr<throttling_controller> controller)
+    : m_controller(controller)
+{
+}
+
+retry_info basic_throttling_retry_policy::evaluate(const retry_context& retry_context, operation_context context)
+{
+    bool retryable = true;
+    bool throttled = false;
+
+    const request_result& result = retry_context.last_request_result();
+    if (result.is_response_available())
+    {
+        web::http::status_code status = result.http_status_code();
+
+        // Like the built-in policies, don't retry client errors other than timeouts, or
+        // requests the service says it can't handle.
+        if ((status >= 400 && status < 500 && status != web::http::status_codes::RequestTimeout) ||
+            status == web::http::status_codes::NotImplemented || status == web::http::status_codes::HttpVersionNotSupported)
+        {
+            retryable = false;
+        }
+
+        throttled = throttling_controller::is_throttling(result);
+    }
+
+    if (retryable || throttled)
+    {
+        m_controller->record_failure(throttled);
+    }
+
+    if (!retryable || retry_context.current_retry_count() + 1 >= m_controller->options().max_attempts || !m_controller->allow_retry())
+    {
+        return retry_info();
+    }
+
+    retry_info info(retry_context);
+    info.set_retry_interval(std::max(m_controller->backoff(retry_context.current_retry_count()), m_controller->reserve()));
+    return info;
+}
+
+retry_policy basic_throttling_retry_policy::clone() const
+{
+    return retry_policy(std::make_shared<basic_throttling_retry_policy>(m_controller));
+}
+
+throttling_retry_policy::throttling_retry_policy(std::shared_ptr<throttling_controller> controller)
+    : retry_policy(std::make_shared<basic_throttling_retry_policy>(controller))
+{
+}
@@ -0,0 +1,198 @@
+#pragma once
+//----------------------------------------------------------------------------------
+// Microsoft Developer & Platform Evangelism
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND, 
+// EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED WARRANTIES 
+// OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+//----------------------------------------------------------------------------------
+// The example companies, organizations, products, domain names,
+// e-mail addresses, logos, people, places, and events depicted
+// herein are fictitious.  No association with any real company,
+// organization, product, domain name, email address, logo, person,
+// places, or events is intended or should be inferred.
+//----------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+
+using namespace azure::storage;
+
+///
+/// Thrown by throttling_controller::acquire while the circuit breaker is open.
+///
+class circuit_open_exception : public std::runtime_error
+{
+public:
+    circuit_open_exception();
+};
+
+///
+/// Settings for throttling_controller.
+///
+struct throttling_options
+{
+    throttling_options();
+
+    // Requests per second allowed at start-up and the bounds the rate is adjusted within.
+    double initial_rate;
+    double min_rate;
+    double max_rate;
+
+    // Requests that may be sent back to back when the bucket is full.
+    double burst;
+
+    // A throttling response multiplies the rate by this; further throttling within
+    // decrease_cooldown counts as the same overload and doesn't lower it again.
+    double decrease_factor;
+    std::chrono::milliseconds decrease_cooldown;
+
+    // Requests per second the rate recovers by each second without throttling.
+    double additive_increase;
+
+    // Retries wait a random time up to min(max_backoff, base_backoff * 2^retry).
+    std::chrono::milliseconds base_backoff;
+    std::chrono::milliseconds max_backoff;
+    int max_attempts;
+
+    // The circuit opens after failure_threshold failures within failure_window and stays open
+    // for open_duration. After that a single probe request is let through. The circuit closes
+    // as soon as the probe succeeds, or, if its response isn't reported, once it hasn't failed
+    // within another open_duration.
+    unsigned int failure_threshold;
+    std::chrono::milliseconds failure_window;
+    std::chrono::milliseconds open_duration;
+};
+
+///
+/// Process-wide send rate and circuit breaker shared by every request that uses it. The rate is
+/// a token bucket adjusted additive-increase/multiplicative-decrease: throttling responses
+/// (see is_throttling) cut it for everyone at once, and it grows back steadily while the
+/// service keeps up.
+///
+/// Create it with std::make_shared, since apply hands a reference to it to the retry policy.
+///
+/// Pacing is opt-in per call: the client has no hook that runs before every request, so first
+/// attempts only wait for the bucket when the caller calls acquire() before each operation.
+/// Retries made through the retry policy installed by apply always take a token.
+///
+class throttling_controller : public std::enable_shared_from_this<throttling_controller>
+{
+public:
+    enum class circuit_state
+    {
+        closed,
+        open,
+        half_open
+    };
+
+    explicit throttling_controller(const throttling_options& options = throttling_options());
+
+    ///
+    /// Waits for a token before a request is sent. Throws circuit_open_exception instead of
+    /// waiting while the circuit is open.
+    ///
+    void acquire();
+
+    // Takes a token without waiting; returns how long until the token would have been available.
+    std::chrono::milliseconds reserve();
+
+    // Records a failed request. Throttling responses also lower the rate.
+    void record_failure(bool throttled);
+
+    // Records a request the service handled. A successful probe closes the circuit.
+    void record_success();
+
+    // Whether a failed request may be retried; false while the circuit is open.
+    bool allow_retry();
+
+    // Jittered backoff before the given retry (0 for the first retry).
+    std::chrono::milliseconds backoff(int retry_count);
+
+    ///
+    /// Makes every request made with the client's default options use throttling_retry_policy.
+    /// This only covers retries; call acquire() before each operation to pace first attempts.
+    ///
+    void apply(cloud_queue_client& queue_client);
+
+    ///
+    /// Reports the responses to requests made with this context, so a successful probe closes
+    /// the circuit as soon as it returns instead of after open_duration. Replaces the
+    /// context's response-received callback.
+    ///
+    void instrument(operation_context& context);
+
+    ///
+    /// True for the responses the service sheds load with: 503 Server Busy, and 500 with the
+    /// OperationTimedOut error code. Other 500s are server faults, not throttling. error_code
+    /// is the x-ms-error-code header or the code in the error body, empty if unknown.
+    ///
+    static bool is_throttling(web::http::status_code status, const utility::string_t& error_code);
+    static bool is_throttling(const request_result& result);
+    static bool is_throttling(const web::http::http_response& response);
+
+    const throttling_options& options() const;
+    double current_rate();
+    circuit_state state();
+    uint64_t throttled_count() const;
+    uint64_t rejected_count() const;
+
+private:
+    throttling_controller(const throttling_controller&);
+    throttling_controller& operator=(const throttling_controller&);
+
+    void refill_locked(std::chrono::steady_clock::time_point now);
+    void update_circuit_locked(std::chrono::steady_clock::time_point now);
+    void close_circuit_locked(std::chrono::steady_clock::time_point now);
+
+    throttling_options m_options;
+
+    std::mutex m_mutex;
+    double m_rate;
+    double m_tokens;
+    std::chrono::steady_clock::time_point m_last_refill;
+    std::chrono::steady_clock::time_point m_last_decrease;
+
+    circuit_state m_state;
+    unsigned int m_window_failures;
+    std::chrono::steady_clock::time_point m_window_start;
+    std::chrono::steady_clock::time_point m_state_changed;
+    bool m_probe_sent;
+
+    std::mt19937 m_random;
+
+    std::atomic<uint64_t> m_throttled;
+    std::atomic<uint64_t> m_rejected;
+};
+
+///
+/// Retry policy that reports failures to a throttling_controller and spaces retries with full
+/// jitter, so clients that failed together don't retry together. A retry also takes a token
+/// from the shared bucket, waiting longer if the process is over its rate. Nothing is retried
+/// while the circuit is open.
+///
+class basic_throttling_retry_policy : public basic_retry_policy
+{
+public:
+    explicit basic_throttling_retry_policy(std::shared_ptr<throttling_controller> controller);
+
+    retry_info evaluate(const retry_context& retry_context, operation_context context) override;
+    retry_policy clone() const override;
+
+private:
+    std::shared_ptr<throttling_controller> m_controller;
+};
+
+class throttling_retry_policy : public retry_policy
+{
+public:
+    explicit throttling_retry_policy(std::shared_ptr<throttling_controller> controller);
+};